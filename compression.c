@@ -0,0 +1,164 @@
+#include "compression.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static uint32_t lz_hash(const unsigned char *ptr) {
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(uint32_t));
+
+  return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static int put_varint(unsigned char *dst, int pos, int capacity,
+                      unsigned int value) {
+  /** @brief Writes an unsigned value using 7 bits per byte (the high bit is
+   * set on all the bytes but the last one).
+   * @return The position after the value, -1 if it does not fit.
+   */
+  do {
+    if (pos >= capacity) {
+      return -1;
+    }
+    dst[pos++] = (value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+    value >>= 7;
+  } while (value > 0);
+
+  return pos;
+}
+
+static int get_varint(const unsigned char *src, int pos, int length,
+                      unsigned int *value) {
+  /** @brief Reads a value written by put_varint.
+   * @return The position after the value, -1 if the input is truncated.
+   */
+  int shift = 0;
+  *value = 0;
+
+  do {
+    if (pos >= length || shift > 28) {
+      return -1;
+    }
+    *value |= (unsigned int)(src[pos] & 0x7f) << shift;
+    shift += 7;
+  } while (src[pos++] & 0x80);
+
+  return pos;
+}
+
+static int put_literals(unsigned char *dst, int pos, int capacity,
+                        const unsigned char *literals, int count) {
+  pos = put_varint(dst, pos, capacity, count);
+  if (pos == -1 || pos + count > capacity) {
+    return -1;
+  }
+  memcpy(dst + pos, literals, count);
+
+  return pos + count;
+}
+
+int lz_compress(const char *src, int src_length, char *dst, int dst_capacity) {
+  /** @brief Compresses a buffer with a greedy LZ77 scheme. The output is a
+   * sequence of literal runs, each one followed by a match (except the last
+   * one): a run is its length (varint) and its bytes, a match is its length
+   * minus LZ_MIN_MATCH (varint) and its offset (2 bytes, little endian).
+   * @param dst_capacity The size of dst; the compression gives up as soon as
+   * the output does not fit, so passing less than src_length also checks that
+   * compressing is worth it.
+   * @return The size of the compressed data, -1 if it does not fit in dst.
+   */
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *out = (unsigned char *)dst;
+  int table[1 << LZ_HASH_BITS];
+  int pos = 0, anchor = 0, out_pos = 0;
+
+  for (int i = 0; i < (1 << LZ_HASH_BITS); i++) {
+    table[i] = -1;
+  }
+
+  while (pos + LZ_MIN_MATCH <= src_length) {
+    uint32_t hash = lz_hash(in + pos);
+    int candidate = table[hash];
+    table[hash] = pos;
+
+    if (candidate == -1 || pos - candidate > LZ_MAX_OFFSET ||
+        memcmp(in + candidate, in + pos, LZ_MIN_MATCH) != 0) {
+      pos++;
+      continue;
+    }
+
+    int match_length = LZ_MIN_MATCH;
+    while (pos + match_length < src_length &&
+           in[candidate + match_length] == in[pos + match_length]) {
+      match_length++;
+    }
+
+    out_pos = put_literals(out, out_pos, dst_capacity, in + anchor,
+                           pos - anchor);
+    if (out_pos == -1) {
+      return -1;
+    }
+
+    out_pos = put_varint(out, out_pos, dst_capacity,
+                         match_length - LZ_MIN_MATCH);
+    if (out_pos == -1 || out_pos + 2 > dst_capacity) {
+      return -1;
+    }
+    int offset = pos - candidate;
+    out[out_pos++] = offset & 0xff;
+    out[out_pos++] = offset >> 8;
+
+    pos += match_length;
+    anchor = pos;
+  }
+
+  // The last run is always written (even if empty), so that the decompression
+  // knows where to stop
+  return put_literals(out, out_pos, dst_capacity, in + anchor,
+                      src_length - anchor);
+}
+
+int lz_decompress(const char *src, int src_length, char *dst, int dst_length) {
+  /** @brief Decompresses a buffer compressed with lz_compress.
+   * @param dst_length The size of the decompressed data (known by the caller).
+   * @return 0 on success, -1 if the input is corrupted.
+   */
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *out = (unsigned char *)dst;
+  int in_pos = 0, out_pos = 0;
+
+  while (1) {
+    unsigned int count;
+    in_pos = get_varint(in, in_pos, src_length, &count);
+    if (in_pos == -1 || count > (unsigned int)(dst_length - out_pos) ||
+        count > (unsigned int)(src_length - in_pos)) {
+      return -1;
+    }
+    memcpy(out + out_pos, in + in_pos, count);
+    in_pos += count;
+    out_pos += count;
+
+    if (out_pos == dst_length) {
+      return in_pos == src_length ? 0 : -1;
+    }
+
+    unsigned int match_length;
+    in_pos = get_varint(in, in_pos, src_length, &match_length);
+    if (in_pos == -1 || in_pos + 2 > src_length) {
+      return -1;
+    }
+    match_length += LZ_MIN_MATCH;
+    int offset = in[in_pos] | (in[in_pos + 1] << 8);
+    in_pos += 2;
+
+    if (offset == 0 || offset > out_pos ||
+        match_length > (unsigned int)(dst_length - out_pos)) {
+      return -1;
+    }
+
+    // The match can overlap the bytes it produces, so copy byte by byte
+    for (unsigned int i = 0; i < match_length; i++, out_pos++) {
+      out[out_pos] = out[out_pos - offset];
+    }
+  }
+}
@@ -0,0 +1,23 @@
+#ifndef COMPRESSION_H__
+#define COMPRESSION_H__
+
+/**
+ * @brief The minimum length of a match (back-reference); shorter repetitions
+ * are stored as literals.
+ */
+#define LZ_MIN_MATCH 4
+
+/**
+ * @brief The maximum distance of a match (the offsets are stored on 2 bytes).
+ */
+#define LZ_MAX_OFFSET 65535
+
+/**
+ * @brief The number of bits of the match finder hash table.
+ */
+#define LZ_HASH_BITS 14
+
+int lz_compress(const char *src, int src_length, char *dst, int dst_capacity);
+int lz_decompress(const char *src, int src_length, char *dst, int dst_length);
+
+#endif
@@ -0,0 +1,619 @@
+#include "corpus.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ALIGN_UP(x, alignment)                                                  \
+  (((x) + (alignment)-1) / (alignment) * (alignment))
+
+static size_t put_varint(unsigned char *dst, size_t pos, uint64_t value) {
+  do {
+    dst[pos++] = (value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+    value >>= 7;
+  } while (value > 0);
+
+  return pos;
+}
+
+static size_t get_varint(const unsigned char *src, size_t pos, size_t length,
+                         uint64_t *value) {
+  /** @return The position after the value, 0 if the input is truncated (a
+   * varint never ends at position 0).
+   */
+  int shift = 0;
+  *value = 0;
+
+  do {
+    if (pos >= length || shift > 63) {
+      return 0;
+    }
+    *value |= (uint64_t)(src[pos] & 0x7f) << shift;
+    shift += 7;
+  } while (src[pos++] & 0x80);
+
+  return pos;
+}
+
+static int cmp_ints(const void *a, const void *b) {
+  return *((int *)a) - *((int *)b);
+}
+
+static unsigned char *encode_ref(input_t *input, output_t *ref, size_t *size) {
+  /** @brief Encodes a ref in the format described in corpus_test_t; every ref
+   * line is matched with a pattern of the input (the first unused one with the
+   * same text).
+   * @param size The size of the encoded ref (output).
+   * @return The encoded ref (free it with free), NULL on failure.
+   */
+  size_t capacity = 10;
+  for (int i = 0; i < ref->n_patterns; i++) {
+    capacity += 30 + 10 * (size_t)ref->identified_patterns[i]->len;
+  }
+
+  unsigned char *res = (unsigned char *)(malloc(capacity));
+  char *used = (char *)(calloc(input->n_patterns + 1, 1));
+  if (res == NULL || used == NULL) {
+    perror("Error allocating memory for ref");
+    free(res);
+    free(used);
+    return NULL;
+  }
+
+  size_t pos = put_varint(res, 0, ref->n_patterns);
+  for (int i = 0; i < ref->n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = ref->identified_patterns[i];
+
+    int pattern_idx = -1;
+    for (int j = 0; j < input->n_patterns; j++) {
+      if (strcmp(input->patterns[j], pattern_w_idx->pattern) == 0 &&
+          (pattern_idx == -1 || !used[j])) {
+        pattern_idx = j;
+        if (!used[j]) {
+          break;
+        }
+      }
+    }
+    if (pattern_idx == -1) {
+      fprintf(stderr, "Ref pattern %s is not a pattern of the test\n",
+              pattern_w_idx->pattern);
+      free(res);
+      free(used);
+      return NULL;
+    }
+    used[pattern_idx] = 1;
+
+    qsort(pattern_w_idx->indexes, pattern_w_idx->len, sizeof(int), cmp_ints);
+
+    pos = put_varint(res, pos, pattern_idx);
+    pos = put_varint(res, pos, pattern_w_idx->len);
+    int previous = 0;
+    for (int j = 0; j < pattern_w_idx->len; j++) {
+      pos = put_varint(res, pos, pattern_w_idx->indexes[j] - previous);
+      previous = pattern_w_idx->indexes[j];
+    }
+  }
+
+  free(used);
+  *size = pos;
+
+  return res;
+}
+
+static void stat_source(const char *root_folder, int test_num,
+                        const char *extension, corpus_source_t *source) {
+  /** @brief Gets the state of a source file of a test (see corpus_source_t),
+   * all zeros if it does not exist.
+   */
+  char path[MAX_FILE_PATH];
+  struct stat st;
+  snprintf(path, MAX_FILE_PATH, "%s/test%d%s", root_folder, test_num,
+           extension);
+
+  source->size = 0;
+  source->mtime = 0;
+  if (stat(path, &st) == 0) {
+    source->size = st.st_size;
+    source->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+                    st.st_mtim.tv_nsec;
+  }
+}
+
+static int is_source_changed(const char *root_folder, int test_num,
+                             const char *extension,
+                             const corpus_source_t *source) {
+  /** @return Whether a source file of a test exists and is not the one it was
+   * converted from (a missing file leaves the corpus as the only source).
+   */
+  corpus_source_t current;
+  stat_source(root_folder, test_num, extension, &current);
+
+  return current.mtime != 0 &&
+         (current.size != source->size || current.mtime != source->mtime);
+}
+
+static int write_padding(FILE *fp, uint64_t *pos, uint64_t target) {
+  for (; *pos < target; (*pos)++) {
+    if (fputc(0, fp) == EOF) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int write_corpus(const char *fname, const char *root_folder, input_t **inputs,
+                 output_t **refs, int num_tests) {
+  /** @brief Writes tests in a corpus file.
+   * @param root_folder The directory of the test files the tests were parsed
+   * from, whose state is recorded (NULL if there is none).
+   * @param refs The refs of the tests (can be NULL).
+   * @return 0 on success, -1 on failure.
+   */
+  corpus_header_t header;
+  memcpy(header.magic, CORPUS_MAGIC, sizeof(header.magic));
+  header.version = CORPUS_VERSION;
+  header.n_tests = num_tests;
+
+  corpus_test_t *tests =
+      (corpus_test_t *)(calloc(num_tests, sizeof(corpus_test_t)));
+  corpus_pattern_t **patterns =
+      (corpus_pattern_t **)(calloc(num_tests, sizeof(corpus_pattern_t *)));
+  unsigned char **encoded_refs =
+      (unsigned char **)(calloc(num_tests, sizeof(unsigned char *)));
+  if (tests == NULL || patterns == NULL || encoded_refs == NULL) {
+    perror("Error allocating memory for corpus");
+    free(tests);
+    free(patterns);
+    free(encoded_refs);
+    return -1;
+  }
+
+  int res = -1;
+  FILE *fp = NULL;
+
+  // Compute the layout of the file: the header, the test table, the pattern
+  // tables, the patterns, the texts and the refs
+  uint64_t offset = ALIGN_UP(sizeof(corpus_header_t), 8);
+  header.tests_offset = offset;
+  offset += num_tests * sizeof(corpus_test_t);
+
+  for (int i = 0; i < num_tests; i++) {
+    if (root_folder != NULL) {
+      stat_source(root_folder, i, ".in", &tests[i].input_file);
+      stat_source(root_folder, i, ".ref", &tests[i].ref_file);
+    }
+    tests[i].n_patterns = inputs[i]->n_patterns;
+    tests[i].patterns_offset = offset;
+    offset += tests[i].n_patterns * sizeof(corpus_pattern_t);
+
+    patterns[i] = (corpus_pattern_t *)(calloc(tests[i].n_patterns + 1,
+                                              sizeof(corpus_pattern_t)));
+    if (patterns[i] == NULL) {
+      perror("Error allocating memory for pattern table");
+      goto cleanup;
+    }
+  }
+
+  for (int i = 0; i < num_tests; i++) {
+    for (uint32_t j = 0; j < tests[i].n_patterns; j++) {
+      patterns[i][j].offset = offset;
+      patterns[i][j].length = strlen(inputs[i]->patterns[j]);
+      patterns[i][j].fingerprint =
+          compute_fingerprint(inputs[i]->patterns[j], patterns[i][j].length);
+      offset += patterns[i][j].length + 1;
+    }
+  }
+
+  for (int i = 0; i < num_tests; i++) {
+    offset = ALIGN_UP(offset, CORPUS_TEXT_ALIGNMENT);
+    tests[i].text_offset = offset;
+    tests[i].text_length = strlen(inputs[i]->text);
+    offset += tests[i].text_length + 1;
+  }
+
+  for (int i = 0; refs != NULL && i < num_tests; i++) {
+    size_t ref_length;
+    encoded_refs[i] = encode_ref(inputs[i], refs[i], &ref_length);
+    if (encoded_refs[i] == NULL) {
+      goto cleanup;
+    }
+    tests[i].ref_offset = offset;
+    tests[i].ref_length = ref_length;
+    offset += ref_length;
+  }
+
+  header.file_size = offset;
+
+  // Write it
+  fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    perror("Error opening corpus file");
+    goto cleanup;
+  }
+
+  uint64_t pos = 0;
+  if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+    goto cleanup;
+  }
+  pos += sizeof(header);
+
+  if (write_padding(fp, &pos, header.tests_offset) != 0 ||
+      fwrite(tests, sizeof(corpus_test_t), num_tests, fp) !=
+          (size_t)num_tests) {
+    goto cleanup;
+  }
+  pos += num_tests * sizeof(corpus_test_t);
+
+  for (int i = 0; i < num_tests; i++) {
+    if (fwrite(patterns[i], sizeof(corpus_pattern_t), tests[i].n_patterns,
+               fp) != tests[i].n_patterns) {
+      goto cleanup;
+    }
+    pos += tests[i].n_patterns * sizeof(corpus_pattern_t);
+  }
+
+  for (int i = 0; i < num_tests; i++) {
+    for (uint32_t j = 0; j < tests[i].n_patterns; j++) {
+      if (fwrite(inputs[i]->patterns[j], patterns[i][j].length + 1, 1, fp) !=
+          1) {
+        goto cleanup;
+      }
+      pos += patterns[i][j].length + 1;
+    }
+  }
+
+  for (int i = 0; i < num_tests; i++) {
+    if (write_padding(fp, &pos, tests[i].text_offset) != 0 ||
+        fwrite(inputs[i]->text, tests[i].text_length + 1, 1, fp) != 1) {
+      goto cleanup;
+    }
+    pos += tests[i].text_length + 1;
+  }
+
+  for (int i = 0; refs != NULL && i < num_tests; i++) {
+    if (fwrite(encoded_refs[i], tests[i].ref_length, 1, fp) != 1) {
+      goto cleanup;
+    }
+    pos += tests[i].ref_length;
+  }
+
+  res = 0;
+
+cleanup:
+  if (fp != NULL && fclose(fp) != 0) {
+    res = -1;
+  }
+  if (res != 0) {
+    perror("Error writing corpus file");
+    if (fp != NULL) {
+      remove(fname);
+    }
+  }
+  for (int i = 0; i < num_tests; i++) {
+    free(patterns[i]);
+    free(encoded_refs[i]);
+  }
+  free(patterns);
+  free(encoded_refs);
+  free(tests);
+
+  return res;
+}
+
+static int is_range_valid(uint64_t offset, uint64_t length, size_t size) {
+  /** @return Whether [offset, offset + length) is in a file of size bytes,
+   * without overflowing.
+   */
+  return offset <= size && length <= size - offset;
+}
+
+static int is_string_valid(const char *data, size_t size, uint64_t offset,
+                           uint64_t length) {
+  /** @return Whether a string of length bytes, followed by its NUL, is at
+   * offset in the data.
+   */
+  return length < size && is_range_valid(offset, length + 1, size) &&
+         data[offset + length] == '\0';
+}
+
+static int is_corpus_valid(const char *data, size_t size) {
+  /** @brief Checks that every offset of a corpus, and every length, fits in
+   * the file, so that none of its tests is read out of the mapping.
+   */
+  corpus_header_t *header = (corpus_header_t *)data;
+  if (memcmp(header->magic, CORPUS_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != CORPUS_VERSION || header->file_size != size ||
+      header->tests_offset % 8 != 0 ||
+      header->n_tests > size / sizeof(corpus_test_t) ||
+      !is_range_valid(header->tests_offset,
+                      header->n_tests * sizeof(corpus_test_t), size)) {
+    return 0;
+  }
+
+  corpus_test_t *tests = (corpus_test_t *)(data + header->tests_offset);
+  for (uint32_t i = 0; i < header->n_tests; i++) {
+    corpus_test_t *test = &tests[i];
+    if (!is_string_valid(data, size, test->text_offset, test->text_length) ||
+        test->text_length > INT_MAX || test->patterns_offset % 8 != 0 ||
+        test->n_patterns > size / sizeof(corpus_pattern_t) ||
+        !is_range_valid(test->patterns_offset,
+                        test->n_patterns * sizeof(corpus_pattern_t), size) ||
+        !is_range_valid(test->ref_offset, test->ref_length, size)) {
+      return 0;
+    }
+
+    corpus_pattern_t *patterns =
+        (corpus_pattern_t *)(data + test->patterns_offset);
+    for (uint32_t j = 0; j < test->n_patterns; j++) {
+      // The patterns are short, and must not hide a NUL from their length
+      if (patterns[j].length >= MAX_PATTERN_LENGTH ||
+          !is_string_valid(data, size, patterns[j].offset,
+                           patterns[j].length) ||
+          memchr(data + patterns[j].offset, '\0', patterns[j].length) !=
+              NULL) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+corpus_t *open_corpus(const char *fname) {
+  /** @brief Maps a corpus file in memory and checks its header, and the
+   * offsets and lengths of all its tests (see is_corpus_valid).
+   * @return The corpus, NULL if the file does not exist or is not a valid
+   * corpus.
+   */
+  size_t size;
+  char *data = map_file(fname, sizeof(corpus_header_t), &size);
+  if (data == NULL) {
+    return NULL;
+  }
+
+  corpus_header_t *header = (corpus_header_t *)data;
+  if (!is_corpus_valid(data, size)) {
+    fprintf(stderr, "%s is not a valid corpus file (version %d)\n", fname,
+            CORPUS_VERSION);
+    munmap(data, size);
+    return NULL;
+  }
+
+  corpus_t *corpus = (corpus_t *)(malloc(sizeof(corpus_t)));
+  if (corpus == NULL) {
+    perror("Error allocating memory for corpus");
+    munmap(data, size);
+    return NULL;
+  }
+
+  corpus->data = data;
+  corpus->size = size;
+  corpus->header = header;
+  corpus->tests = (corpus_test_t *)(data + header->tests_offset);
+
+  return corpus;
+}
+
+void close_corpus(corpus_t *corpus) {
+  munmap(corpus->data, corpus->size);
+  free(corpus);
+}
+
+corpus_pattern_t *corpus_patterns(corpus_t *corpus, int test_num) {
+  /** @return The pattern table of a test.
+   */
+  return (corpus_pattern_t *)(corpus->data +
+                              corpus->tests[test_num].patterns_offset);
+}
+
+input_t *corpus_input(corpus_t *corpus, int test_num) {
+  /** @brief Gets a test of a corpus as an input_t struct, without any copy: the
+   * text and the patterns point in the mapping of the corpus (read only).
+   * @return The input (free it with free_corpus_input), NULL on failure.
+   */
+  corpus_test_t *test = &corpus->tests[test_num];
+  corpus_pattern_t *patterns = corpus_patterns(corpus, test_num);
+
+  input_t *res = (input_t *)(malloc(sizeof(input_t)));
+  if (res == NULL) {
+    perror("malloc failed for input_t alloc");
+    return NULL;
+  }
+
+  res->n_patterns = test->n_patterns;
+  res->text = corpus->data + test->text_offset;
+  res->pattern_data = NULL;
+  res->patterns = (char **)(malloc((test->n_patterns + 1) * sizeof(char *)));
+  res->pattern_lengths =
+      (uint32_t *)(malloc((test->n_patterns + 1) * sizeof(uint32_t)));
+  res->pattern_fingerprints =
+      (uint64_t *)(malloc((test->n_patterns + 1) * sizeof(uint64_t)));
+  if (res->patterns == NULL || res->pattern_lengths == NULL ||
+      res->pattern_fingerprints == NULL) {
+    perror("malloc failed for patterns array");
+    free(res->patterns);
+    free(res->pattern_lengths);
+    free(res->pattern_fingerprints);
+    free(res);
+    return NULL;
+  }
+
+  // The lengths and the fingerprints were computed by the conversion
+  for (uint32_t i = 0; i < test->n_patterns; i++) {
+    res->patterns[i] = corpus->data + patterns[i].offset;
+    res->pattern_lengths[i] = patterns[i].length;
+    res->pattern_fingerprints[i] = patterns[i].fingerprint;
+  }
+
+  return res;
+}
+
+static void free_corpus_input(input_t *input) {
+  free(input->patterns);
+  free(input->pattern_lengths);
+  free(input->pattern_fingerprints);
+  free(input);
+}
+
+output_t *corpus_ref(corpus_t *corpus, int test_num) {
+  /** @brief Decodes the ref of a test of a corpus.
+   * @return The ref, NULL if the test has no ref or on failure.
+   */
+  corpus_test_t *test = &corpus->tests[test_num];
+  corpus_pattern_t *patterns = corpus_patterns(corpus, test_num);
+  if (test->ref_offset == 0) {
+    return NULL;
+  }
+
+  const unsigned char *ref =
+      (const unsigned char *)(corpus->data + test->ref_offset);
+  size_t pos = 0;
+  uint64_t n_patterns;
+
+  pos = get_varint(ref, pos, test->ref_length, &n_patterns);
+  if (pos == 0 || n_patterns > test->n_patterns) {
+    return NULL;
+  }
+
+  output_t *res = alloc_output_struct(n_patterns);
+  if (res == NULL) {
+    return NULL;
+  }
+
+  for (uint64_t i = 0; i < n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = res->identified_patterns[i];
+    uint64_t pattern_idx, len;
+
+    pos = get_varint(ref, pos, test->ref_length, &pattern_idx);
+    if (pos == 0 || pattern_idx >= test->n_patterns) {
+      goto failure_corpus_ref;
+    }
+    pos = get_varint(ref, pos, test->ref_length, &len);
+    if (pos == 0 || len > MAX_FOUND_PATTERNS) {
+      goto failure_corpus_ref;
+    }
+
+    strcpy(pattern_w_idx->pattern,
+           corpus->data + patterns[pattern_idx].offset);
+    pattern_w_idx->len = len;
+
+    uint64_t index = 0;
+    for (uint64_t j = 0; j < len; j++) {
+      uint64_t delta;
+      pos = get_varint(ref, pos, test->ref_length, &delta);
+      if (pos == 0) {
+        goto failure_corpus_ref;
+      }
+      index += delta;
+      pattern_w_idx->indexes[j] = index;
+    }
+  }
+
+  return res;
+
+failure_corpus_ref:
+  fprintf(stderr, "Corrupted ref of test %d in the corpus\n", test_num);
+  free_output_struct(res);
+  return NULL;
+}
+
+corpus_t *load_tests(const char *root_folder, int num_tests, input_t ***inputs,
+                     output_t ***refs) {
+  /** @brief Loads the tests of root_folder: from its corpus file
+   * (CORPUS_FILE_NAME, written by rabin_karp_convert) if there is one, which
+   * is only mapped in memory, or else by parsing its .in and .ref files (see
+   * parse_all_input_files and parse_all_ref_files). The corpus is not used
+   * once a test file was changed after the conversion (see corpus_source_t).
+   * @param inputs The inputs (output).
+   * @param refs The refs (output, can be NULL if the refs are not needed).
+   * @return The corpus, NULL if the tests were parsed; either way, free the
+   * tests with unload_tests.
+   */
+  char path[MAX_FILE_PATH];
+  snprintf(path, MAX_FILE_PATH, "%s/%s", root_folder, CORPUS_FILE_NAME);
+
+  corpus_t *corpus = open_corpus(path);
+  if (corpus != NULL && corpus->header->n_tests < (uint32_t)num_tests) {
+    fprintf(stderr, "%s has only %d tests, parsing the test files\n", path,
+            corpus->header->n_tests);
+    close_corpus(corpus);
+    corpus = NULL;
+  }
+  for (int i = 0; corpus != NULL && i < num_tests; i++) {
+    corpus_test_t *test = &corpus->tests[i];
+    if (is_source_changed(root_folder, i, ".in", &test->input_file) ||
+        (refs != NULL &&
+         is_source_changed(root_folder, i, ".ref", &test->ref_file))) {
+      fprintf(stderr, "test %d changed since %s was written, parsing the test "
+                      "files\n",
+              i, path);
+      close_corpus(corpus);
+      corpus = NULL;
+    }
+  }
+
+  if (corpus == NULL) {
+    *inputs = parse_all_input_files(root_folder, num_tests);
+    if (refs != NULL) {
+      *refs = parse_all_ref_files(root_folder, *inputs, num_tests);
+    }
+    return NULL;
+  }
+
+  *inputs = (input_t **)(malloc(num_tests * sizeof(input_t *)));
+  if (*inputs == NULL) {
+    perror("Failed to load the corpus!");
+    exit(-1);
+  }
+  if (refs != NULL) {
+    *refs = (output_t **)(malloc(num_tests * sizeof(output_t *)));
+    if (*refs == NULL) {
+      perror("Failed to load the corpus!");
+      exit(-1);
+    }
+  }
+
+  for (int i = 0; i < num_tests; i++) {
+    (*inputs)[i] = corpus_input(corpus, i);
+    if ((*inputs)[i] == NULL) {
+      fprintf(stderr, "Failed to load test %d from the corpus!\n", i);
+      exit(-1);
+    }
+
+    if (refs != NULL) {
+      (*refs)[i] = corpus_ref(corpus, i);
+      if ((*refs)[i] == NULL) {
+        fprintf(stderr, "Failed to load ref %d from the corpus!\n", i);
+        exit(-1);
+      }
+    }
+  }
+
+  return corpus;
+}
+
+void unload_tests(corpus_t *corpus, input_t **inputs, output_t **refs,
+                  int num_tests) {
+  /** @brief Frees the tests loaded with load_tests.
+   */
+  for (int i = 0; i < num_tests; i++) {
+    if (corpus != NULL) {
+      free_corpus_input(inputs[i]);
+    } else {
+      free_input_struct(inputs[i]);
+    }
+    if (refs != NULL) {
+      free_output_struct(refs[i]);
+    }
+  }
+
+  free(inputs);
+  free(refs);
+
+  if (corpus != NULL) {
+    close_corpus(corpus);
+  }
+}
@@ -0,0 +1,123 @@
+#ifndef CORPUS_H__
+#define CORPUS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fingerprint.h"
+#include "helpers.h"
+
+/**
+ * @brief A corpus is a tests directory preprocessed into a single binary file
+ * (by rabin_karp_convert), which is mapped in memory instead of being parsed.
+ * All the offsets are from the beginning of the file, all the integers are
+ * stored in the byte order of the machine which wrote the file.
+ */
+#define CORPUS_MAGIC "RKCORPUS"
+#define CORPUS_VERSION 2
+#define CORPUS_FILE_NAME "corpus.rkc"
+
+/**
+ * @brief The texts are aligned to CORPUS_TEXT_ALIGNMENT bytes in the file (and
+ * so in memory, once mapped).
+ */
+#define CORPUS_TEXT_ALIGNMENT 64
+
+/**
+ * @brief The header of a corpus file.
+ * @var magic: CORPUS_MAGIC (not null terminated).
+ * @var version: CORPUS_VERSION.
+ * @var n_tests: The number of tests.
+ * @var tests_offset: The offset of the test table (n_tests corpus_test_t).
+ * @var file_size: The size of the whole file.
+ */
+typedef struct CorpusHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_tests;
+  uint64_t tests_offset;
+  uint64_t file_size;
+} corpus_header_t;
+
+/**
+ * @brief The state of a source file of a corpus, when it was converted: the
+ * corpus is only used while its source files, if they are still there, are
+ * unchanged.
+ * @var size: The size of the file.
+ * @var mtime: The modification time of the file, in nanoseconds since the
+ * epoch (0 if there was no such file).
+ */
+typedef struct CorpusSource {
+  uint64_t size;
+  int64_t mtime;
+} corpus_source_t;
+
+/**
+ * @brief An entry of the test table.
+ * @var text_offset: The offset of the text; the text is null terminated.
+ * @var text_length: The length of the text.
+ * @var patterns_offset: The offset of the pattern table of the test
+ * (n_patterns corpus_pattern_t).
+ * @var ref_offset: The offset of the ref of the test, 0 if there is no ref.
+ * The ref is a sequence of varints (7 bits per byte, the high bit set on all
+ * the bytes but the last one): the number of ref lines and, for each line, the
+ * index of its pattern in the pattern table, its number of occurrences and its
+ * indexes, delta encoded (each index minus the previous one).
+ * @var ref_length: The size of the ref, in bytes.
+ * @var n_patterns: The number of patterns.
+ * @var input_file: The test<i>.in file the test was converted from.
+ * @var ref_file: The test<i>.ref file the ref was converted from.
+ */
+typedef struct CorpusTest {
+  uint64_t text_offset;
+  uint64_t text_length;
+  uint64_t patterns_offset;
+  uint64_t ref_offset;
+  uint64_t ref_length;
+  uint32_t n_patterns;
+  uint32_t reserved;
+  corpus_source_t input_file;
+  corpus_source_t ref_file;
+} corpus_test_t;
+
+/**
+ * @brief An entry of the pattern table of a test.
+ * @var offset: The offset of the pattern; the pattern is null terminated.
+ * @var length: The length of the pattern.
+ * @var fingerprint: The fingerprint of the pattern (see compute_fingerprint).
+ */
+typedef struct CorpusPattern {
+  uint64_t offset;
+  uint32_t length;
+  uint32_t reserved;
+  uint64_t fingerprint;
+} corpus_pattern_t;
+
+/**
+ * @brief Struct for handling a corpus mapped in memory.
+ * @var data: The mapping of the whole file.
+ * @var size: The size of the mapping.
+ * @var header: The header (at the beginning of data).
+ * @var tests: The test table (in data).
+ */
+typedef struct Corpus {
+  char *data;
+  size_t size;
+  corpus_header_t *header;
+  corpus_test_t *tests;
+} corpus_t;
+
+int write_corpus(const char *fname, const char *root_folder, input_t **inputs,
+                 output_t **refs, int num_tests);
+corpus_t *open_corpus(const char *fname);
+void close_corpus(corpus_t *corpus);
+corpus_pattern_t *corpus_patterns(corpus_t *corpus, int test_num);
+input_t *corpus_input(corpus_t *corpus, int test_num);
+output_t *corpus_ref(corpus_t *corpus, int test_num);
+
+corpus_t *load_tests(const char *root_folder, int num_tests, input_t ***inputs,
+                     output_t ***refs);
+void unload_tests(corpus_t *corpus, input_t **inputs, output_t **refs,
+                  int num_tests);
+
+#endif
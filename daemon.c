@@ -0,0 +1,116 @@
+#include "daemon.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+int read_fully(int fd, void *buf, size_t size) {
+  /** @brief Reads exactly size bytes (read can return less).
+   * @return 0 on success, -1 on failure or at the end of the stream.
+   */
+  char *ptr = (char *)buf;
+  while (size > 0) {
+    ssize_t res = read(fd, ptr, size);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return -1;
+    }
+    ptr += res;
+    size -= res;
+  }
+
+  return 0;
+}
+
+int write_fully(int fd, const void *buf, size_t size) {
+  /** @brief Writes exactly size bytes (write can write less).
+   * @return 0 on success, -1 on failure.
+   */
+  const char *ptr = (const char *)buf;
+  while (size > 0) {
+    ssize_t res = send(fd, ptr, size, MSG_NOSIGNAL);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return -1;
+    }
+    ptr += res;
+    size -= res;
+  }
+
+  return 0;
+}
+
+int send_message(int fd, uint32_t type, uint32_t arg, const void *payload,
+                 uint32_t length) {
+  /** @brief Sends a message (the header and the payload with a single
+   * system call, when possible); like write_fully, a closed connection is an
+   * error, not a SIGPIPE.
+   * @return 0 on success, -1 on failure.
+   */
+  daemon_message_t message = {DAEMON_MAGIC, type, arg, length};
+  struct iovec iov[2] = {{&message, sizeof(message)},
+                         {(void *)payload, length}};
+  struct msghdr msg = {0};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = length > 0 ? 2 : 1;
+
+  ssize_t res;
+  do {
+    res = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (res < 0 && errno == EINTR);
+  if (res < 0) {
+    return -1;
+  }
+
+  // Finish a short write
+  size_t written = res;
+  if (written < sizeof(message)) {
+    if (write_fully(fd, (char *)&message + written,
+                    sizeof(message) - written) != 0) {
+      return -1;
+    }
+    written = sizeof(message);
+  }
+
+  return write_fully(fd, (const char *)payload + (written - sizeof(message)),
+                     length - (written - sizeof(message)));
+}
+
+int receive_message(int fd, daemon_message_t *message, char **payload,
+                    uint32_t *capacity) {
+  /** @brief Receives a message; the payload is read in a buffer which is
+   * reused from a message to the next (and grown if needed), with a null byte
+   * after the payload.
+   * @param payload The buffer (input and output, NULL at first).
+   * @param capacity The size of the buffer (input and output, 0 at first).
+   * @return 0 on success, -1 on failure or at the end of the stream.
+   */
+  if (read_fully(fd, message, sizeof(daemon_message_t)) != 0 ||
+      message->magic != DAEMON_MAGIC || message->length > DAEMON_MAX_PAYLOAD) {
+    return -1;
+  }
+
+  if (message->length + 1 > *capacity) {
+    char *buffer = (char *)(realloc(*payload, message->length + 1));
+    if (buffer == NULL) {
+      perror("Error allocating memory for message");
+      return -1;
+    }
+    *payload = buffer;
+    *capacity = message->length + 1;
+  }
+
+  if (read_fully(fd, *payload, message->length) != 0) {
+    return -1;
+  }
+  (*payload)[message->length] = '\0';
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef DAEMON_H__
+#define DAEMON_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief The protocol between rabin_karp_daemon and its clients, over a Unix
+ * domain socket: every message (request or response) is a daemon_message_t
+ * header followed by length bytes of payload. The integers are in the byte
+ * order of the machine (both ends are on the same one).
+ */
+#define DAEMON_MAGIC 0x524b4450 /* "RKDP" */
+
+/**
+ * @brief The maximum payload of a message (the search buffers included).
+ */
+#define DAEMON_MAX_PAYLOAD (256U << 20)
+
+/**
+ * @brief The maximum number of pattern sets kept by a daemon.
+ */
+#define DAEMON_MAX_PATTERN_SETS 4096
+
+/**
+ * @brief The requests:
+ * - DAEMON_COMPILE: arg is the number of patterns, the payload is the
+ * patterns, each null terminated; the response arg is the id of the
+ * compiled pattern set (the same patterns always get the same id).
+ * - DAEMON_SEARCH_BUFFER: arg is the id of a pattern set, the payload is the
+ * text.
+ * - DAEMON_SEARCH_FILE: arg is the id of a pattern set, the payload is the
+ * path of a file (null terminated), whose whole content is the text.
+ * The response of a search has the number of patterns as arg and, as
+ * payload, for each pattern (in the order of the pattern list), its number
+ * of occurrences and their indexes (all uint32_t).
+ */
+#define DAEMON_COMPILE 1
+#define DAEMON_SEARCH_BUFFER 2
+#define DAEMON_SEARCH_FILE 3
+
+/**
+ * @brief The status of a response.
+ */
+#define DAEMON_OK 0
+#define DAEMON_BAD_REQUEST 1
+#define DAEMON_UNKNOWN_PATTERN_SET 2
+#define DAEMON_SERVER_ERROR 3
+
+/**
+ * @brief The header of a message.
+ * @var magic: DAEMON_MAGIC.
+ * @var type: The request type (requests) or the status (responses).
+ * @var arg: See the request types.
+ * @var length: The length of the payload.
+ */
+typedef struct DaemonMessage {
+  uint32_t magic;
+  uint32_t type;
+  uint32_t arg;
+  uint32_t length;
+} daemon_message_t;
+
+int read_fully(int fd, void *buf, size_t size);
+int write_fully(int fd, const void *buf, size_t size);
+int send_message(int fd, uint32_t type, uint32_t arg, const void *payload,
+                 uint32_t length);
+int receive_message(int fd, daemon_message_t *message, char **payload,
+                    uint32_t *capacity);
+
+#endif
@@ -0,0 +1,583 @@
+#include "dynamic_set.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fingerprint.h"
+
+#define DYNAMIC_SET_MIN_TABLE_SIZE 8
+#define DYNAMIC_SET_MIN_CAPACITY 16
+
+static uint32_t slot_index(uint64_t fingerprint, uint32_t table_size) {
+  return (uint32_t)((fingerprint * 0x9E3779B97F4A7C15ULL) >> 32) &
+         (table_size - 1);
+}
+
+static int is_slot_visible(ds_slot_t *slot, uint64_t added,
+                           uint64_t generation) {
+  return added <= generation &&
+         __atomic_load_n(&slot->removed, __ATOMIC_RELAXED) > generation;
+}
+
+static int is_slot_kept(ds_slot_t *slot, uint64_t oldest) {
+  /** @return Whether a slot can still be seen by a scan (oldest is the
+   * generation of the oldest scan in progress).
+   */
+  return slot->added != DYNAMIC_SET_EMPTY_SLOT &&
+         (slot->removed == DYNAMIC_SET_LIVE || slot->removed > oldest);
+}
+
+static uint64_t oldest_scan(dynamic_set_t *set) {
+  /** @return The generation of the oldest scan in progress, UINT64_MAX if
+   * there is none (call it with the lock held).
+   */
+  return set->n_scan_generations > 0 ? set->scans[0].generation : UINT64_MAX;
+}
+
+static void retire(dynamic_set_t *set, void *ptr, uint64_t generation) {
+  /** @brief Frees memory once every scan older than generation has ended
+   * (see reclaim).
+   */
+  ds_retired_t *retired = (ds_retired_t *)(malloc(sizeof(ds_retired_t)));
+  if (retired == NULL) {
+    // Leaked rather than freed under a scan
+    perror("Error allocating memory for retired memory");
+    return;
+  }
+
+  retired->ptr = ptr;
+  retired->generation = generation;
+  retired->next = NULL;
+  if (set->retired_tail == NULL) {
+    set->retired_head = retired;
+  } else {
+    set->retired_tail->next = retired;
+  }
+  set->retired_tail = retired;
+}
+
+static void reclaim(dynamic_set_t *set) {
+  /** @brief Frees the retired memory which no scan can read anymore (call it
+   * with the lock held).
+   */
+  uint64_t oldest = oldest_scan(set);
+  while (set->retired_head != NULL &&
+         set->retired_head->generation <= oldest) {
+    ds_retired_t *retired = set->retired_head;
+    set->retired_head = retired->next;
+    free(retired->ptr);
+    free(retired);
+  }
+  if (set->retired_head == NULL) {
+    set->retired_tail = NULL;
+  }
+}
+
+static ds_table_t *alloc_table(uint32_t size) {
+  // The slots are zeroed, so they are empty (DYNAMIC_SET_EMPTY_SLOT)
+  ds_table_t *table =
+      (ds_table_t *)(calloc(1, sizeof(ds_table_t) + size * sizeof(ds_slot_t)));
+  if (table == NULL) {
+    perror("Error allocating memory for fingerprint table");
+    return NULL;
+  }
+  table->size = size;
+
+  return table;
+}
+
+static void insert_slot(ds_table_t *table, const ds_slot_t *slot) {
+  /** @brief Copies a slot in the first empty slot of its probe sequence; its
+   * added generation is stored last, so that the scans see it complete.
+   */
+  uint32_t index = slot_index(slot->fingerprint, table->size);
+  while (table->slots[index].added != DYNAMIC_SET_EMPTY_SLOT) {
+    index = (index + 1) & (table->size - 1);
+  }
+
+  ds_slot_t *new_slot = &table->slots[index];
+  new_slot->fingerprint = slot->fingerprint;
+  new_slot->pattern = slot->pattern;
+  new_slot->pattern_id = slot->pattern_id;
+  new_slot->removed = slot->removed;
+  __atomic_store_n(&new_slot->added, slot->added, __ATOMIC_RELEASE);
+
+  table->n_used++;
+  if (slot->removed == DYNAMIC_SET_LIVE) {
+    __atomic_store_n(&table->n_live, table->n_live + 1, __ATOMIC_RELAXED);
+  }
+}
+
+static int rebuild_table(dynamic_set_t *set, ds_group_t *group,
+                         uint64_t generation) {
+  /** @brief Replaces the table of a group by a table without the removed
+   * slots which no scan can see anymore, with at most a quarter of its slots
+   * used, so the rebuilds cost O(1) per insertion, amortized.
+   * @return 0 on success, -1 on failure.
+   */
+  ds_table_t *table = group->table;
+  uint64_t oldest = oldest_scan(set);
+
+  uint32_t n_kept = 0;
+  for (uint32_t i = 0; i < table->size; i++) {
+    ds_slot_t *slot = &table->slots[i];
+    if (is_slot_kept(slot, oldest)) {
+      n_kept++;
+    }
+  }
+
+  uint32_t size = DYNAMIC_SET_MIN_TABLE_SIZE;
+  while (size < 4 * (n_kept + 1)) {
+    size *= 2;
+  }
+
+  ds_table_t *new_table = alloc_table(size);
+  if (new_table == NULL) {
+    return -1;
+  }
+  for (uint32_t i = 0; i < table->size; i++) {
+    ds_slot_t *slot = &table->slots[i];
+    if (is_slot_kept(slot, oldest)) {
+      insert_slot(new_table, slot);
+    }
+  }
+
+  // The scans which already read the old table go on with it
+  __atomic_store_n(&group->table, new_table, __ATOMIC_RELEASE);
+  retire(set, table, generation);
+
+  return 0;
+}
+
+static ds_group_t *find_group(dynamic_set_t *set, uint32_t length,
+                              uint64_t generation) {
+  /** @brief Finds the group of a pattern length, adding it if needed.
+   * @return The group, NULL on failure.
+   */
+  ds_groups_t *groups = set->groups;
+  for (uint32_t i = 0; i < groups->n_groups; i++) {
+    if (groups->groups[i]->length == length) {
+      return groups->groups[i];
+    }
+  }
+
+  ds_group_t *group = (ds_group_t *)(malloc(sizeof(ds_group_t)));
+  ds_groups_t *new_groups = (ds_groups_t *)(malloc(
+      sizeof(ds_groups_t) + (groups->n_groups + 1) * sizeof(ds_group_t *)));
+  ds_table_t *table = alloc_table(DYNAMIC_SET_MIN_TABLE_SIZE);
+  if (group == NULL || new_groups == NULL || table == NULL) {
+    perror("Error allocating memory for group");
+    free(group);
+    free(new_groups);
+    free(table);
+    return NULL;
+  }
+
+  group->length = length;
+  group->power = fingerprint_power(length);
+  group->table = table;
+
+  memcpy(new_groups->groups, groups->groups,
+         groups->n_groups * sizeof(ds_group_t *));
+  new_groups->groups[groups->n_groups] = group;
+  new_groups->n_groups = groups->n_groups + 1;
+
+  __atomic_store_n(&set->groups, new_groups, __ATOMIC_RELEASE);
+  retire(set, groups, generation);
+
+  return group;
+}
+
+static int reserve_pattern_ids(dynamic_set_t *set, uint64_t generation) {
+  /** @brief Makes room in the pattern table for one more id, doubling its
+   * capacity if needed.
+   * @return 0 on success, -1 on failure.
+   */
+  ds_patterns_t *patterns = set->patterns;
+  if (set->n_ids < patterns->capacity) {
+    return 0;
+  }
+
+  uint32_t capacity = 2 * patterns->capacity;
+  ds_patterns_t *new_patterns = (ds_patterns_t *)(calloc(
+      1, sizeof(ds_patterns_t) + capacity * sizeof(ds_pattern_t)));
+  if (new_patterns == NULL) {
+    perror("Error allocating memory for pattern table");
+    return -1;
+  }
+
+  new_patterns->capacity = capacity;
+  memcpy(new_patterns->entries, patterns->entries,
+         patterns->capacity * sizeof(ds_pattern_t));
+
+  __atomic_store_n(&set->patterns, new_patterns, __ATOMIC_RELEASE);
+  retire(set, patterns, generation);
+
+  return 0;
+}
+
+dynamic_set_t *create_dynamic_set(char **patterns, int n_patterns) {
+  /** @brief Creates a dynamic pattern set (see add_dynamic_pattern).
+   * @param patterns The first patterns (their ids are 0 to n_patterns - 1).
+   * @return The dynamic pattern set (free it with free_dynamic_set), NULL on
+   * failure.
+   */
+  dynamic_set_t *set = (dynamic_set_t *)(calloc(1, sizeof(dynamic_set_t)));
+  if (set == NULL) {
+    perror("Error allocating memory for dynamic pattern set");
+    return NULL;
+  }
+
+  uint32_t capacity = DYNAMIC_SET_MIN_CAPACITY;
+  while (capacity < (uint32_t)n_patterns) {
+    capacity *= 2;
+  }
+
+  pthread_mutex_init(&set->lock, NULL);
+  set->groups = (ds_groups_t *)(calloc(1, sizeof(ds_groups_t)));
+  set->patterns = (ds_patterns_t *)(calloc(
+      1, sizeof(ds_patterns_t) + capacity * sizeof(ds_pattern_t)));
+  if (set->groups == NULL || set->patterns == NULL) {
+    perror("Error allocating memory for dynamic pattern set");
+    free_dynamic_set(set);
+    return NULL;
+  }
+  set->patterns->capacity = capacity;
+
+  for (int i = 0; i < n_patterns; i++) {
+    if (add_dynamic_pattern(set, patterns[i]) == -1) {
+      free_dynamic_set(set);
+      return NULL;
+    }
+  }
+
+  return set;
+}
+
+void free_dynamic_set(dynamic_set_t *set) {
+  /** @brief Frees a dynamic pattern set (no scan may be in progress).
+   */
+  if (set->patterns != NULL) {
+    for (uint32_t i = 0; i < set->n_ids; i++) {
+      // The removed patterns are retired
+      if (set->patterns->entries[i].removed == DYNAMIC_SET_LIVE) {
+        free(set->patterns->entries[i].pattern);
+      }
+    }
+  }
+
+  free(set->scans);
+  set->n_scan_generations = 0;
+  reclaim(set);
+
+  if (set->groups != NULL) {
+    for (uint32_t i = 0; i < set->groups->n_groups; i++) {
+      free(set->groups->groups[i]->table);
+      free(set->groups->groups[i]);
+    }
+  }
+  free(set->groups);
+  free(set->patterns);
+  pthread_mutex_destroy(&set->lock);
+  free(set);
+}
+
+long add_dynamic_pattern(dynamic_set_t *set, const char *pattern) {
+  /** @brief Adds a pattern, as a new generation: the scans which began before
+   * do not see it. The ids are given in increasing order and never reused.
+   * @return The id of the pattern, -1 on failure.
+   */
+  pthread_mutex_lock(&set->lock);
+
+  uint64_t generation = set->generation + 1;
+  uint32_t length = strlen(pattern);
+  char *copy = (char *)(malloc(length + 1));
+  if (copy == NULL || set->n_ids == UINT32_MAX ||
+      reserve_pattern_ids(set, generation) != 0) {
+    perror("Error adding pattern");
+    free(copy);
+    pthread_mutex_unlock(&set->lock);
+    return -1;
+  }
+  memcpy(copy, pattern, length + 1);
+
+  ds_group_t *group = find_group(set, length, generation);
+  if (group == NULL || ((group->table->n_used + 1) * 2 > group->table->size &&
+                        rebuild_table(set, group, generation) != 0)) {
+    free(copy);
+    pthread_mutex_unlock(&set->lock);
+    return -1;
+  }
+
+  uint32_t pattern_id = set->n_ids;
+  ds_pattern_t *entry = &set->patterns->entries[pattern_id];
+  entry->pattern = copy;
+  entry->length = length;
+  entry->fingerprint = compute_fingerprint(copy, length);
+  entry->group = group;
+  entry->removed = DYNAMIC_SET_LIVE;
+  __atomic_store_n(&entry->added, generation, __ATOMIC_RELEASE);
+
+  ds_slot_t slot = {entry->fingerprint, copy, pattern_id, 0, generation,
+                    DYNAMIC_SET_LIVE};
+  insert_slot(group->table, &slot);
+
+  set->n_ids++;
+  set->n_live++;
+  __atomic_store_n(&set->generation, generation, __ATOMIC_RELEASE);
+  reclaim(set);
+
+  pthread_mutex_unlock(&set->lock);
+
+  return pattern_id;
+}
+
+int remove_dynamic_pattern(dynamic_set_t *set, uint32_t pattern_id) {
+  /** @brief Removes a pattern, as a new generation: the scans which began
+   * before still see it.
+   * @return 0 on success, -1 if there is no such pattern.
+   */
+  pthread_mutex_lock(&set->lock);
+
+  if (pattern_id >= set->n_ids ||
+      set->patterns->entries[pattern_id].removed != DYNAMIC_SET_LIVE) {
+    pthread_mutex_unlock(&set->lock);
+    return -1;
+  }
+
+  uint64_t generation = set->generation + 1;
+  ds_pattern_t *entry = &set->patterns->entries[pattern_id];
+  ds_table_t *table = entry->group->table;
+  uint32_t index = slot_index(entry->fingerprint, table->size);
+  while (table->slots[index].pattern_id != pattern_id ||
+         table->slots[index].removed != DYNAMIC_SET_LIVE) {
+    index = (index + 1) & (table->size - 1);
+  }
+
+  __atomic_store_n(&table->slots[index].removed, generation,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->removed, generation, __ATOMIC_RELAXED);
+  __atomic_store_n(&table->n_live, table->n_live - 1, __ATOMIC_RELAXED);
+  set->n_live--;
+  retire(set, entry->pattern, generation);
+
+  __atomic_store_n(&set->generation, generation, __ATOMIC_RELEASE);
+  reclaim(set);
+
+  pthread_mutex_unlock(&set->lock);
+
+  return 0;
+}
+
+uint64_t dynamic_set_generation(dynamic_set_t *set) {
+  return __atomic_load_n(&set->generation, __ATOMIC_ACQUIRE);
+}
+
+uint64_t begin_dynamic_set_scan(dynamic_set_t *set) {
+  /** @brief Begins a scan, on the snapshot of the current generation: until
+   * end_dynamic_set_scan, nothing it can see is freed.
+   * @return The generation of the snapshot (0, where nothing is visible, on
+   * failure).
+   */
+  pthread_mutex_lock(&set->lock);
+
+  uint64_t generation = set->generation;
+  uint32_t n = set->n_scan_generations;
+
+  // The scans begin in increasing generation order, so the array stays sorted
+  if (n > 0 && set->scans[n - 1].generation == generation) {
+    set->scans[n - 1].n_scans++;
+  } else {
+    if (n == set->scans_capacity) {
+      uint32_t capacity = n > 0 ? 2 * n : DYNAMIC_SET_MIN_CAPACITY;
+      ds_scans_t *scans =
+          (ds_scans_t *)(realloc(set->scans, capacity * sizeof(ds_scans_t)));
+      if (scans == NULL) {
+        perror("Error allocating memory for scans");
+        pthread_mutex_unlock(&set->lock);
+        return 0;
+      }
+      set->scans = scans;
+      set->scans_capacity = capacity;
+    }
+    set->scans[n].generation = generation;
+    set->scans[n].n_scans = 1;
+    set->n_scan_generations++;
+  }
+
+  pthread_mutex_unlock(&set->lock);
+
+  return generation;
+}
+
+void end_dynamic_set_scan(dynamic_set_t *set, uint64_t generation) {
+  /** @brief Ends a scan (see begin_dynamic_set_scan).
+   */
+  pthread_mutex_lock(&set->lock);
+
+  for (uint32_t i = 0; i < set->n_scan_generations; i++) {
+    if (set->scans[i].generation == generation) {
+      if (--set->scans[i].n_scans == 0) {
+        memmove(&set->scans[i], &set->scans[i + 1],
+                (set->n_scan_generations - i - 1) * sizeof(ds_scans_t));
+        set->n_scan_generations--;
+      }
+      break;
+    }
+  }
+  reclaim(set);
+
+  pthread_mutex_unlock(&set->lock);
+}
+
+int is_dynamic_pattern_visible(dynamic_set_t *set, uint32_t pattern_id,
+                               uint64_t generation) {
+  /** @return Whether a pattern is in the snapshot of a generation.
+   */
+  ds_patterns_t *patterns = __atomic_load_n(&set->patterns, __ATOMIC_ACQUIRE);
+  if (pattern_id >= patterns->capacity) {
+    return 0;
+  }
+
+  ds_pattern_t *entry = &patterns->entries[pattern_id];
+  uint64_t added = __atomic_load_n(&entry->added, __ATOMIC_ACQUIRE);
+
+  return added != DYNAMIC_SET_EMPTY_SLOT && added <= generation &&
+         __atomic_load_n(&entry->removed, __ATOMIC_RELAXED) > generation;
+}
+
+const char *dynamic_set_pattern(dynamic_set_t *set, uint32_t pattern_id) {
+  /** @return A pattern, valid during the scans which can see it.
+   */
+  ds_patterns_t *patterns = __atomic_load_n(&set->patterns, __ATOMIC_ACQUIRE);
+
+  return pattern_id < patterns->capacity
+             ? patterns->entries[pattern_id].pattern
+             : NULL;
+}
+
+static int has_visible_slot(ds_table_t *table, uint64_t generation) {
+  for (uint32_t i = 0; i < table->size; i++) {
+    ds_slot_t *slot = &table->slots[i];
+    uint64_t added = __atomic_load_n(&slot->added, __ATOMIC_ACQUIRE);
+    if (added != DYNAMIC_SET_EMPTY_SLOT &&
+        is_slot_visible(slot, added, generation)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+long visit_dynamic_set_matches(dynamic_set_t *set, uint64_t generation,
+                               const char *text, size_t text_length,
+                               size_t batch_size, ps_match_fn visit,
+                               void *arg) {
+  /** @brief Searches the patterns of the snapshot of a generation in a text,
+   * like visit_pattern_set_matches, without the lock: the changes made during
+   * the scan are skipped by their generations.
+   * @param generation The generation of the scan (see
+   * begin_dynamic_set_scan).
+   * @return The number of occurrences passed to visit.
+   */
+  ps_match_t batch[PATTERN_SET_MATCH_BATCH];
+  size_t n_batched = 0;
+  long res = 0;
+  if (batch_size == 0 || batch_size > PATTERN_SET_MATCH_BATCH) {
+    batch_size = PATTERN_SET_MATCH_BATCH;
+  }
+
+  ds_groups_t *groups = __atomic_load_n(&set->groups, __ATOMIC_ACQUIRE);
+  for (uint32_t group = 0; group < groups->n_groups; group++) {
+    ds_group_t *current_group = groups->groups[group];
+    ds_table_t *table =
+        __atomic_load_n(&current_group->table, __ATOMIC_ACQUIRE);
+    size_t length = current_group->length;
+    if (length == 0 || length > text_length ||
+        (__atomic_load_n(&table->n_live, __ATOMIC_RELAXED) == 0 &&
+         !has_visible_slot(table, generation))) {
+      continue;
+    }
+
+    uint64_t fingerprint = compute_fingerprint(text, length);
+    for (size_t text_offset = 0; text_offset <= text_length - length;
+         ++text_offset) {
+      if (text_offset > 0) {
+        unsigned char out = text[text_offset - 1];
+        unsigned char in = text[text_offset + length - 1];
+        fingerprint =
+            roll_fingerprint(fingerprint, out, in, current_group->power);
+      }
+
+      uint32_t index = slot_index(fingerprint, table->size);
+      for (;; index = (index + 1) & (table->size - 1)) {
+        ds_slot_t *slot = &table->slots[index];
+        uint64_t added = __atomic_load_n(&slot->added, __ATOMIC_ACQUIRE);
+        if (added == DYNAMIC_SET_EMPTY_SLOT) {
+          break;
+        }
+        if (slot->fingerprint != fingerprint ||
+            !is_slot_visible(slot, added, generation) ||
+            memcmp(text + text_offset, slot->pattern, length) != 0) {
+          continue;
+        }
+
+        batch[n_batched].offset = text_offset;
+        batch[n_batched].pattern_id = slot->pattern_id;
+        batch[n_batched].set_id = 0;
+        if (++n_batched == batch_size) {
+          res += n_batched;
+          n_batched = 0;
+          if (visit(batch, batch_size, arg) != 0) {
+            return res;
+          }
+        }
+      }
+    }
+  }
+
+  if (n_batched > 0) {
+    res += n_batched;
+    visit(batch, n_batched, arg);
+  }
+
+  return res;
+}
+
+static int record_to_output(const ps_match_t *matches, size_t n_matches,
+                            void *arg) {
+  output_t *output = (output_t *)arg;
+
+  for (size_t i = 0; i < n_matches; i++) {
+    if (matches[i].pattern_id >= (uint32_t)output->n_patterns) {
+      continue;
+    }
+    pattern_w_idx_t *pattern_w_idx =
+        output->identified_patterns[matches[i].pattern_id];
+    if (pattern_w_idx->len < MAX_FOUND_PATTERNS) {
+      pattern_w_idx->indexes[pattern_w_idx->len++] = matches[i].offset;
+    }
+  }
+
+  return 0;
+}
+
+int search_dynamic_set(dynamic_set_t *set, const char *text, int text_length,
+                       output_t *output) {
+  /** @brief Searches the current snapshot of a dynamic pattern set in a text,
+   * into an output indexed by pattern id (the ids past its patterns are
+   * ignored); the patterns of the output are left as they are.
+   * @return The number of occurrences.
+   */
+  for (int i = 0; i < output->n_patterns; i++) {
+    output->identified_patterns[i]->len = 0;
+  }
+
+  uint64_t generation = begin_dynamic_set_scan(set);
+  long res = visit_dynamic_set_matches(set, generation, text, text_length,
+                                       PATTERN_SET_MATCH_BATCH,
+                                       record_to_output, output);
+  end_dynamic_set_scan(set, generation);
+
+  return res;
+}
@@ -0,0 +1,183 @@
+#ifndef DYNAMIC_SET_H__
+#define DYNAMIC_SET_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+#include "pattern_set.h"
+
+/**
+ * @brief A dynamic pattern set is the mutable counterpart of a compiled
+ * pattern set: the patterns are grouped by length in the same way, but they
+ * can be added and removed in place, at an amortized O(1) cost, while other
+ * threads are scanning with it.
+ *
+ * Every change gets a new generation. A scan runs on the snapshot of the
+ * generation current when it began: a slot is visible to it if it was added
+ * at or before that generation and not removed at or before it. The slots are
+ * never reused in place and nothing is freed while an older scan may still
+ * read it: removed slots stay until their table is rebuilt, and the replaced
+ * tables and arrays and the removed patterns are retired and freed once every
+ * scan older than their retirement has ended.
+ */
+
+/**
+ * @brief The generation of an empty slot (the first change is generation 1)
+ * and the removal generation of a slot which was not removed.
+ */
+#define DYNAMIC_SET_EMPTY_SLOT 0
+#define DYNAMIC_SET_LIVE UINT64_MAX
+
+/**
+ * @brief A slot of a fingerprint table (written once, except for removed).
+ * @var fingerprint: The fingerprint of the pattern.
+ * @var pattern: The pattern.
+ * @var pattern_id: The id of the pattern.
+ * @var added: The generation of its insertion, DYNAMIC_SET_EMPTY_SLOT if the
+ * slot is empty (stored last, so a slot is complete once it is visible).
+ * @var removed: The generation of its removal, DYNAMIC_SET_LIVE if it was not
+ * removed.
+ */
+typedef struct DynamicSetSlot {
+  uint64_t fingerprint;
+  const char *pattern;
+  uint32_t pattern_id;
+  uint32_t reserved;
+  uint64_t added;
+  uint64_t removed;
+} ds_slot_t;
+
+/**
+ * @brief A fingerprint table, with linear probing; it is rebuilt (without the
+ * slots no scan can see anymore) when half of its slots are used.
+ * @var size: The number of slots (a power of 2).
+ * @var n_used: The number of slots used (including the removed ones).
+ * @var n_live: The number of slots not removed.
+ */
+typedef struct DynamicSetTable {
+  uint32_t size;
+  uint32_t n_used;
+  uint32_t n_live;
+  uint32_t reserved;
+  ds_slot_t slots[];
+} ds_table_t;
+
+/**
+ * @brief A group of patterns of the same length (never removed, even if all
+ * its patterns are).
+ * @var length: The length of the patterns.
+ * @var power: FINGERPRINT_BASE ^ (length - 1) (see roll_fingerprint).
+ * @var table: The fingerprint table (replaced when it is rebuilt).
+ */
+typedef struct DynamicSetGroup {
+  uint32_t length;
+  uint64_t power;
+  ds_table_t *table;
+} ds_group_t;
+
+/**
+ * @brief The list of the groups (replaced when a group is added).
+ */
+typedef struct DynamicSetGroups {
+  uint32_t n_groups;
+  ds_group_t *groups[];
+} ds_groups_t;
+
+/**
+ * @brief An entry of the pattern table (the ids are never reused).
+ * @var pattern: The pattern (freed once no scan can see it anymore, after
+ * its removal).
+ * @var length: The length of the pattern.
+ * @var fingerprint: The fingerprint of the pattern.
+ * @var group: The group of the pattern.
+ * @var added: The generation of its insertion.
+ * @var removed: The generation of its removal, DYNAMIC_SET_LIVE if it was not
+ * removed.
+ */
+typedef struct DynamicSetPattern {
+  char *pattern;
+  uint32_t length;
+  uint64_t fingerprint;
+  ds_group_t *group;
+  uint64_t added;
+  uint64_t removed;
+} ds_pattern_t;
+
+/**
+ * @brief The pattern table (replaced when it grows).
+ */
+typedef struct DynamicSetPatterns {
+  uint32_t capacity;
+  ds_pattern_t entries[];
+} ds_patterns_t;
+
+/**
+ * @brief The number of scans of a generation in progress.
+ */
+typedef struct DynamicSetScans {
+  uint64_t generation;
+  uint32_t n_scans;
+} ds_scans_t;
+
+/**
+ * @brief Something replaced or removed, freed once no scan can read it.
+ * @var ptr: The memory to free.
+ * @var generation: The generation which replaced or removed it.
+ * @var next: The next one (by increasing generation).
+ */
+typedef struct DynamicSetRetired {
+  void *ptr;
+  uint64_t generation;
+  struct DynamicSetRetired *next;
+} ds_retired_t;
+
+/**
+ * @brief Struct for handling a dynamic pattern set.
+ * @var lock: Serializes the changes, and the beginning and the end of the
+ * scans (the scans themselves run without it).
+ * @var generation: The current generation.
+ * @var groups: The groups.
+ * @var patterns: The pattern table.
+ * @var n_ids: The number of ids given so far.
+ * @var n_live: The number of patterns not removed.
+ * @var scans: The generations of the scans in progress, by increasing
+ * generation (n_scan_generations of them, of scans_capacity).
+ * @var retired_head: The oldest retired memory.
+ * @var retired_tail: The newest retired memory.
+ */
+typedef struct DynamicSet {
+  pthread_mutex_t lock;
+  uint64_t generation;
+  ds_groups_t *groups;
+  ds_patterns_t *patterns;
+  uint32_t n_ids;
+  uint32_t n_live;
+  ds_scans_t *scans;
+  uint32_t n_scan_generations;
+  uint32_t scans_capacity;
+  ds_retired_t *retired_head;
+  ds_retired_t *retired_tail;
+} dynamic_set_t;
+
+dynamic_set_t *create_dynamic_set(char **patterns, int n_patterns);
+void free_dynamic_set(dynamic_set_t *set);
+
+long add_dynamic_pattern(dynamic_set_t *set, const char *pattern);
+int remove_dynamic_pattern(dynamic_set_t *set, uint32_t pattern_id);
+uint64_t dynamic_set_generation(dynamic_set_t *set);
+
+uint64_t begin_dynamic_set_scan(dynamic_set_t *set);
+void end_dynamic_set_scan(dynamic_set_t *set, uint64_t generation);
+int is_dynamic_pattern_visible(dynamic_set_t *set, uint32_t pattern_id,
+                               uint64_t generation);
+const char *dynamic_set_pattern(dynamic_set_t *set, uint32_t pattern_id);
+long visit_dynamic_set_matches(dynamic_set_t *set, uint64_t generation,
+                               const char *text, size_t text_length,
+                               size_t batch_size, ps_match_fn visit,
+                               void *arg);
+int search_dynamic_set(dynamic_set_t *set, const char *text, int text_length,
+                       output_t *output);
+
+#endif
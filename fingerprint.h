@@ -0,0 +1,103 @@
+#ifndef FINGERPRINT_H__
+#define FINGERPRINT_H__
+
+#include <stdint.h>
+
+/**
+ * @brief The fingerprint of a string is its polynomial hash, with base
+ * FINGERPRINT_BASE, modulo FINGERPRINT_PRIME (2^61 - 1); it is used by the
+ * corpus files and by the compiled pattern sets, and it can be rolled over a
+ * text (see roll_fingerprint).
+ */
+#define FINGERPRINT_BASE 256
+#define FINGERPRINT_PRIME ((1ULL << 61) - 1)
+
+static inline uint64_t mul_fingerprint(uint64_t a, uint64_t b) {
+  /** @brief Computes a * b modulo FINGERPRINT_PRIME (a, b < FINGERPRINT_PRIME).
+   */
+  unsigned __int128 product = (unsigned __int128)a * b;
+  uint64_t res = (uint64_t)(product & FINGERPRINT_PRIME) +
+                 (uint64_t)(product >> 61);
+
+  return res >= FINGERPRINT_PRIME ? res - FINGERPRINT_PRIME : res;
+}
+
+static inline uint64_t append_fingerprint(uint64_t fingerprint,
+                                          unsigned char c) {
+  /** @brief Computes the fingerprint of a string followed by c.
+   */
+  uint64_t res = mul_fingerprint(fingerprint, FINGERPRINT_BASE) + c;
+
+  return res >= FINGERPRINT_PRIME ? res - FINGERPRINT_PRIME : res;
+}
+
+static inline uint64_t roll_fingerprint(uint64_t fingerprint, unsigned char out,
+                                        unsigned char in, uint64_t power) {
+  /** @brief Slides a window by one byte: removes out (its first byte) and
+   * appends in.
+   * @param power FINGERPRINT_BASE ^ (window length - 1) (see
+   * fingerprint_power).
+   */
+  uint64_t removed = mul_fingerprint(out, power);
+  fingerprint = fingerprint >= removed
+                    ? fingerprint - removed
+                    : fingerprint + FINGERPRINT_PRIME - removed;
+
+  return append_fingerprint(fingerprint, in);
+}
+
+static inline uint64_t reduce_fingerprint(uint64_t x) {
+  /** @brief Reduces x < 2 * FINGERPRINT_PRIME, without branching.
+   */
+  uint64_t t = x - FINGERPRINT_PRIME;
+
+  return t + (FINGERPRINT_PRIME & -(t >> 63));
+}
+
+static inline uint64_t slide_fingerprint(uint64_t fingerprint, uint64_t removed,
+                                         unsigned char in) {
+  /** @brief Same as roll_fingerprint, with removed = out * power (see
+   * removal_table), without multiplying nor branching (FINGERPRINT_BASE is
+   * 2^8): a slide is a short chain of adds, shifts and masks, so independent
+   * fingerprints slid side by side are independent dependency chains, which
+   * the processor overlaps.
+   */
+  uint64_t x = fingerprint - removed;
+  x += FINGERPRINT_PRIME & -(x >> 63);
+  x = reduce_fingerprint(((x << 8) & FINGERPRINT_PRIME) + (x >> 53));
+
+  return reduce_fingerprint(x + in);
+}
+
+static inline void removal_table(uint64_t power, uint64_t *removed) {
+  /** @brief Computes out * power for every byte out (256 of them), for
+   * slide_fingerprint.
+   */
+  for (int out = 0; out < 256; out++) {
+    removed[out] = mul_fingerprint(out, power);
+  }
+}
+
+static inline uint64_t fingerprint_power(int length) {
+  /** @return FINGERPRINT_BASE ^ (length - 1), modulo FINGERPRINT_PRIME.
+   */
+  uint64_t res = 1;
+  for (int i = 1; i < length; i++) {
+    res = mul_fingerprint(res, FINGERPRINT_BASE);
+  }
+
+  return res;
+}
+
+static inline uint64_t compute_fingerprint(const char *str, int len) {
+  /** @brief Computes the fingerprint of a string.
+   */
+  uint64_t res = 0;
+  for (int i = 0; i < len; i++) {
+    res = append_fingerprint(res, (unsigned char)str[i]);
+  }
+
+  return res;
+}
+
+#endif
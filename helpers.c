@@ -1,8 +1,76 @@
 #include "helpers.h"
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int parse_patterns(FILE *fp, input_t *res) {
+  /** @brief Reads the number of patterns and the patterns of a test input
+   * file; the patterns are stored one after the other in a single block
+   * (pattern_data), so that a list of millions of patterns costs a pointer
+   * and its bytes per pattern.
+   * @return 0 on success, -1 on failure.
+   */
+  char buffer[MAX_PATTERN_LENGTH];
+  if (fgets(buffer, MAX_PATTERN_LENGTH, fp) == NULL) {
+    fprintf(stderr, "Error: missing number of patterns\n");
+    return -1;
+  }
+  long n_patterns = atol(buffer);
+  if (n_patterns < 0 || n_patterns > INT_MAX) {
+    fprintf(stderr, "Error: bad number of patterns %ld\n", n_patterns);
+    return -1;
+  }
+  res->n_patterns = n_patterns;
+  res->pattern_lengths = NULL;
+  res->pattern_fingerprints = NULL;
+
+  res->patterns = (char **)(malloc((n_patterns + 1) * sizeof(char *)));
+  size_t capacity = 4096, size = 0;
+  res->pattern_data = (char *)(malloc(capacity));
+  if (!res->patterns || !res->pattern_data) {
+    perror("malloc failed for patterns");
+    free(res->patterns);
+    free(res->pattern_data);
+    return -1;
+  }
+
+  for (long i = 0; i < n_patterns; i++) {
+    if (fgets(buffer, MAX_PATTERN_LENGTH, fp) == NULL) {
+      buffer[0] = '\0';
+    }
+    REMOVE_NEWLINE(buffer);
+
+    size_t length = strlen(buffer) + 1;
+    if (size + length > capacity) {
+      capacity *= 2;
+      char *pattern_data = (char *)(realloc(res->pattern_data, capacity));
+      if (!pattern_data) {
+        perror("malloc failed for patterns");
+        free(res->patterns);
+        free(res->pattern_data);
+        return -1;
+      }
+      res->pattern_data = pattern_data;
+    }
+    memcpy(res->pattern_data + size, buffer, length);
+    size += length;
+  }
+
+  // The block does not move anymore
+  char *pattern = res->pattern_data;
+  for (long i = 0; i < n_patterns; i++) {
+    res->patterns[i] = pattern;
+    pattern += strlen(pattern) + 1;
+  }
+
+  return 0;
+}
 
 input_t *parse_input_file(const char *fname) {
   /** @brief Parses a test input file with the following format:
@@ -27,27 +95,10 @@ input_t *parse_input_file(const char *fname) {
     goto failure_input_file;
   }
 
-  char buffer[MAX_PATTERN_DIGITS];
-  fgets(buffer, MAX_PATTERN_DIGITS, fp);
-  res->n_patterns = atoi(buffer);
-
-  res->patterns = (char **)(malloc(res->n_patterns * sizeof(char *)));
-  if (!res->patterns) {
-    perror("malloc failed for patterns array");
+  if (parse_patterns(fp, res) != 0) {
     goto failure_input_pattern_array;
   }
 
-  int i;
-  for (i = 0; i < res->n_patterns; i++) {
-    res->patterns[i] = (char *)(malloc(MAX_PATTERN_LENGTH * sizeof(char)));
-    if (!res->patterns[i]) {
-      perror("malloc failed for pattern");
-      goto failure_input_pattern;
-    }
-    fgets(res->patterns[i], MAX_PATTERN_LENGTH, fp);
-    REMOVE_NEWLINE(res->patterns[i]);
-  }
-
   res->text = (char *)(malloc(MAX_TEXT_LENGTH * sizeof(char)));
   if (!res->text) {
     perror("malloc failed for text");
@@ -61,8 +112,8 @@ input_t *parse_input_file(const char *fname) {
   return res;
 
 failure_input_pattern:
-  for (int j = 0; j < i; j++)
-    free(res->patterns[j]);
+  free(res->patterns);
+  free(res->pattern_data);
 failure_input_pattern_array:
   fclose(fp);
 failure_input_file:
@@ -70,6 +121,60 @@ failure_input_file:
   return NULL;
 }
 
+input_t *parse_input_file_header(const char *fname, long *text_offset,
+                                 long *text_length) {
+  /** @brief Parses only the patterns of a test input file (see
+   * parse_input_file), without reading the text; useful when the text is read
+   * by someone else, or in parts.
+   * @param fname The path to the file.
+   * @param text_offset The offset of the text in the file (output, can be
+   * NULL).
+   * @param text_length The length of the text (output, can be NULL).
+   * @return The data parsed in RabinKarpInput struct, with a NULL text.
+   */
+  input_t *res = (input_t *)(malloc(sizeof(input_t)));
+  if (!res) {
+    perror("malloc failed for input_t alloc");
+    return NULL;
+  }
+
+  FILE *fp = fopen(fname, "r");
+  if (!fp) {
+    perror("error opening test input file");
+    free(res);
+    return NULL;
+  }
+
+  res->text = NULL;
+  if (parse_patterns(fp, res) != 0) {
+    fclose(fp);
+    free(res);
+    return NULL;
+  }
+
+  // The text is the rest of the file, without the trailing newline
+  long offset = ftell(fp);
+  fseek(fp, 0, SEEK_END);
+  long length = ftell(fp) - offset;
+  if (length > 0) {
+    fseek(fp, -1, SEEK_END);
+    if (fgetc(fp) == '\n') {
+      length--;
+    }
+  }
+
+  if (text_offset) {
+    *text_offset = offset;
+  }
+  if (text_length) {
+    *text_length = length;
+  }
+
+  fclose(fp);
+
+  return res;
+}
+
 pattern_w_idx_t *alloc_pattern_w_idx() {
   pattern_w_idx_t *res = (pattern_w_idx_t *)(malloc(sizeof(pattern_w_idx_t)));
   if (!res) {
@@ -88,6 +193,7 @@ pattern_w_idx_t *alloc_pattern_w_idx() {
     free(res);
     return NULL;
   }
+  res->mismatches = NULL;
 
   return res;
 }
@@ -95,9 +201,46 @@ pattern_w_idx_t *alloc_pattern_w_idx() {
 void free_pattern_w_idx(pattern_w_idx_t *ptr) {
   free(ptr->pattern);
   free(ptr->indexes);
+  free(ptr->mismatches);
   free(ptr);
 }
 
+output_t *alloc_output_struct(int n_patterns) {
+  /** @brief Allocates an output struct with an (empty) identified pattern for
+   * each of the n_patterns patterns.
+   * @param n_patterns The number of patterns.
+   * @return The allocated output_t struct, NULL on failure.
+   */
+  output_t *res = (output_t *)(malloc(sizeof(output_t)));
+  if (!res) {
+    return NULL;
+  }
+
+  res->n_patterns = n_patterns;
+  res->identified_patterns =
+      (pattern_w_idx_t **)(malloc(n_patterns * sizeof(pattern_w_idx_t *)));
+  if (!res->identified_patterns) {
+    free(res);
+    return NULL;
+  }
+
+  for (int i = 0; i < n_patterns; i++) {
+    res->identified_patterns[i] = alloc_pattern_w_idx();
+    if (!res->identified_patterns[i]) {
+      for (int j = 0; j < i; j++) {
+        free_pattern_w_idx(res->identified_patterns[j]);
+      }
+      free(res->identified_patterns);
+      free(res);
+      return NULL;
+    }
+    res->identified_patterns[i]->pattern[0] = '\0';
+    res->identified_patterns[i]->len = 0;
+  }
+
+  return res;
+}
+
 /** @brief Parses a test output/ref file with the following format:
  *
  * pattern1: idx1, idx2, ...
@@ -176,34 +319,45 @@ failure_output_file:
 }
 
 void free_input_struct(input_t *ptr) {
-  for (int i = 0; i < ptr->n_patterns; i++) {
-    free(ptr->patterns[i]);
+  if (ptr->pattern_data != NULL) {
+    free(ptr->pattern_data);
+  } else {
+    for (int i = 0; i < ptr->n_patterns; i++) {
+      free(ptr->patterns[i]);
+    }
   }
   free(ptr->patterns);
+  free(ptr->pattern_lengths);
+  free(ptr->pattern_fingerprints);
   free(ptr->text);
   free(ptr);
 }
 
+size_t input_pattern_length(input_t *input, int pattern_idx) {
+  /** @return The length of a pattern of an input: the precomputed one if
+   * there is one (see input_t), or else its strlen.
+   */
+  if (input->pattern_lengths != NULL) {
+    return input->pattern_lengths[pattern_idx];
+  }
+
+  return strlen(input->patterns[pattern_idx]);
+}
+
 void free_output_struct(output_t *ptr) {
   for (int i = 0; i < ptr->n_patterns; i++) {
-    free(ptr->identified_patterns[i]->indexes);
-    free(ptr->identified_patterns[i]->pattern);
-    free(ptr->identified_patterns[i]);
+    free_pattern_w_idx(ptr->identified_patterns[i]);
   }
   free(ptr->identified_patterns);
   free(ptr);
 }
 
-// Those can be merged in a single function, with parameters... but I found it
-// quicker to do them like this.
-input_t **parse_all_input_files(const char *root_folder, int num_tests) {
-  /** @brief Parses all the files that end with '.in' in the root_folder, into
-   * input_t structs.
-   * @param root_folder The folder where we find the .in files.
-   * @param num_tests The number of tests (should be read as a command line
-   * argument).
-   * @return An array with input_t structs for each test case.
-   */
+input_t *parse_input_file_no_text(const char *fname) {
+  return parse_input_file_header(fname, NULL, NULL);
+}
+
+input_t **parse_all_input_files_with(const char *root_folder, int num_tests,
+                                     input_t *(*parse_fn)(const char *)) {
   input_t **res = (input_t **)(malloc(num_tests * sizeof(input_t *)));
   if (!res) {
     return NULL;
@@ -226,7 +380,7 @@ input_t **parse_all_input_files(const char *root_folder, int num_tests) {
       // watchout for the separator, if there are errors on your platform
       snprintf(full_path, MAX_FILE_PATH, "%s/%s", root_folder,
                entry->d_name);
-      input_t *input_ptr = parse_input_file(full_path);
+      input_t *input_ptr = parse_fn(full_path);
       if (!input_ptr) {
         free(res);
         perror("Failed to parse input files!");
@@ -241,6 +395,27 @@ input_t **parse_all_input_files(const char *root_folder, int num_tests) {
   return res;
 }
 
+// Those can be merged in a single function, with parameters... but I found it
+// quicker to do them like this.
+input_t **parse_all_input_files(const char *root_folder, int num_tests) {
+  /** @brief Parses all the files that end with '.in' in the root_folder, into
+   * input_t structs.
+   * @param root_folder The folder where we find the .in files.
+   * @param num_tests The number of tests (should be read as a command line
+   * argument).
+   * @return An array with input_t structs for each test case.
+   */
+  return parse_all_input_files_with(root_folder, num_tests, parse_input_file);
+}
+
+input_t **parse_all_input_headers(const char *root_folder, int num_tests) {
+  /** @brief Same as parse_all_input_files, but the texts are not read (they
+   * are NULL); enough for parse_all_ref_files.
+   */
+  return parse_all_input_files_with(root_folder, num_tests,
+                                    parse_input_file_no_text);
+}
+
 output_t **parse_all_ref_files(const char *root_folder, input_t **inputs,
                                int num_tests) {
   /** @brief Parses all the files that end with '.ref' in the root_folder, into
@@ -289,6 +464,20 @@ output_t **parse_all_ref_files(const char *root_folder, input_t **inputs,
   return res;
 }
 
+output_t *parse_ref_file(const char *root_folder, int test_num,
+                         int n_patterns) {
+  /** @brief Parses the ref file of a single test (test<test_num>.ref in the
+   * root_folder).
+   * @param n_patterns The number of patterns of the test.
+   * @return The output_t struct, or NULL on failure.
+   */
+  char full_path[MAX_FILE_PATH];
+  snprintf(full_path, sizeof(full_path), "%s/test%d.ref", root_folder,
+           test_num);
+
+  return parse_output_file(full_path, n_patterns);
+}
+
 void destroy_tests(input_t **inputs, output_t **outputs, int num_tests) {
   for (int i = 0; i < num_tests; i++) {
     free_input_struct(inputs[i]);
@@ -365,3 +554,223 @@ int check_correctness(output_t *output, output_t *gt) {
 
   return 0;
 }
+
+int check_query(output_t *output, output_t *gt, query_t *query) {
+  /** @brief Same as check_correctness, but for the answer to a query: the
+   * counts must be those of the ref (QUERY_COUNT), the occurrences must be the
+   * first k of the ref (QUERY_FIRST), or some occurrence must be found if and
+   * only if the ref has one, and all of those found must be in the ref
+   * (QUERY_EXISTS).
+   * @return 0 if the answer is right, 1 otherwise, and also prints the diff.
+   */
+  if (query->mode == QUERY_ALL) {
+    return check_correctness(output, gt);
+  }
+
+  if (output->n_patterns != gt->n_patterns) {
+    printf("Different num of patterns: %d (output) vs %d (gt)\n",
+           output->n_patterns, gt->n_patterns);
+    return 1;
+  }
+
+  qsort(output->identified_patterns, output->n_patterns,
+        sizeof(pattern_w_idx_t *), cmp_patterns);
+  qsort(gt->identified_patterns, gt->n_patterns, sizeof(pattern_w_idx_t *),
+        cmp_patterns);
+
+  int is_output_found = 0, is_gt_found = 0;
+  for (int i = 0; i < output->n_patterns; i++) {
+    pattern_w_idx_t *output_pattern = output->identified_patterns[i];
+    pattern_w_idx_t *gt_pattern = gt->identified_patterns[i];
+
+    if (strcmp(output_pattern->pattern, gt_pattern->pattern) != 0) {
+      printf("Different patterns found at index (after sorting) %d: %s "
+             "(output) vs %s (gt)\n",
+             i, output_pattern->pattern, gt_pattern->pattern);
+      return 1;
+    }
+
+    if (query->mode == QUERY_COUNT) {
+      if (output_pattern->len != gt_pattern->len) {
+        printf("Different count for pattern %s: %d (output) vs %d (gt)\n",
+               output_pattern->pattern, output_pattern->len, gt_pattern->len);
+        return 1;
+      }
+      continue;
+    }
+
+    qsort(output_pattern->indexes, output_pattern->len, sizeof(int),
+          cmp_indexes);
+    qsort(gt_pattern->indexes, gt_pattern->len, sizeof(int), cmp_indexes);
+
+    if (query->mode == QUERY_FIRST) {
+      int expected_len = MIN(gt_pattern->len, query->k);
+      if (output_pattern->len != expected_len) {
+        printf("Different length for pattern %s: %d (output) vs %d (gt)\n",
+               output_pattern->pattern, output_pattern->len, expected_len);
+        return 1;
+      }
+      for (int j = 0; j < expected_len; j++) {
+        if (output_pattern->indexes[j] != gt_pattern->indexes[j]) {
+          printf("Indexes differ at position %d: %d (output) vs %d gt for "
+                 "pattern %s\n",
+                 j, output_pattern->indexes[j], gt_pattern->indexes[j],
+                 gt_pattern->pattern);
+          return 1;
+        }
+      }
+      continue;
+    }
+
+    for (int j = 0; j < output_pattern->len; j++) {
+      if (bsearch(&output_pattern->indexes[j], gt_pattern->indexes,
+                  gt_pattern->len, sizeof(int), cmp_indexes) == NULL) {
+        printf("Index %d not in gt for pattern %s\n",
+               output_pattern->indexes[j], gt_pattern->pattern);
+        return 1;
+      }
+    }
+    is_output_found |= output_pattern->len > 0;
+    is_gt_found |= gt_pattern->len > 0;
+  }
+
+  if (is_output_found != is_gt_found) {
+    printf("Different answers: %s (output) vs %s (gt)\n",
+           is_output_found ? "found" : "not found",
+           is_gt_found ? "found" : "not found");
+    return 1;
+  }
+
+  return 0;
+}
+
+int parse_query_option(int argc, char *argv[], int *i, query_t *query) {
+  /** @brief Parses argv[*i] if it is a query option (COUNT_FLAG, EXISTS_FLAG
+   * or FIRST_FLAG <k>); *i is moved to the last argument of the option.
+   * @return 1 if it is a query option, 0 if it is not, -1 if it is invalid.
+   */
+  if (strcmp(argv[*i], COUNT_FLAG) == 0) {
+    query->mode = QUERY_COUNT;
+  } else if (strcmp(argv[*i], EXISTS_FLAG) == 0) {
+    query->mode = QUERY_EXISTS;
+  } else if (strcmp(argv[*i], FIRST_FLAG) == 0) {
+    if (*i + 1 >= argc) {
+      return -1;
+    }
+    query->mode = QUERY_FIRST;
+    query->k = atoi(argv[++*i]);
+    if (query->k <= 0 || query->k > MAX_FOUND_PATTERNS) {
+      return -1;
+    }
+  } else {
+    return 0;
+  }
+
+  return 1;
+}
+
+void record_match(pattern_w_idx_t *pattern_w_idx, int text_offset,
+                  query_t *query) {
+  /** @brief Records an occurrence of a pattern, as needed by the query: it is
+   * stored (up to MAX_FOUND_PATTERNS of them), only counted (QUERY_COUNT), or
+   * kept only if it is one of the k first found so far (QUERY_FIRST, the
+   * indexes are then kept sorted). The occurrences can come in any order.
+   */
+  int *indexes = pattern_w_idx->indexes;
+
+  if (query->mode == QUERY_COUNT) {
+    pattern_w_idx->len++;
+  } else if (query->mode == QUERY_FIRST) {
+    if (pattern_w_idx->len == query->k) {
+      if (text_offset >= indexes[query->k - 1]) {
+        return;
+      }
+      pattern_w_idx->len--;
+    }
+
+    int position = pattern_w_idx->len++;
+    for (; position > 0 && indexes[position - 1] > text_offset; position--) {
+      indexes[position] = indexes[position - 1];
+    }
+    indexes[position] = text_offset;
+  } else if (pattern_w_idx->len < MAX_FOUND_PATTERNS) {
+    indexes[pattern_w_idx->len++] = text_offset;
+  }
+}
+
+int query_limit(pattern_w_idx_t *pattern_w_idx, query_t *query) {
+  /** @return The offset past which the occurrences of a pattern can no longer
+   * change the answer to the query (INT_MAX while they all can): a search can
+   * stop there.
+   */
+  if (query->mode == QUERY_EXISTS && pattern_w_idx->len > 0) {
+    return -1;
+  }
+  if (query->mode == QUERY_FIRST && pattern_w_idx->len == query->k) {
+    return pattern_w_idx->indexes[query->k - 1];
+  }
+
+  return INT_MAX;
+}
+
+int count_stored_indexes(pattern_w_idx_t *pattern_w_idx, query_t *query) {
+  /** @return The number of indexes stored for a pattern (len is a count
+   * without any index for QUERY_COUNT).
+   */
+  return query->mode == QUERY_COUNT ? 0 : pattern_w_idx->len;
+}
+
+char *map_file(const char *fname, size_t min_size, size_t *size) {
+  /** @brief Maps a whole file in memory (read only, free it with munmap).
+   * @param min_size The minimum size of the file (e.g. the size of its header).
+   * @param size The size of the file (output).
+   * @return The mapping, NULL if the file does not exist or is too small.
+   */
+  int fd = open(fname, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < min_size ||
+      st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  char *res = (char *)(mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+  close(fd);
+  if (res == MAP_FAILED) {
+    perror("Error mapping file");
+    return NULL;
+  }
+
+  *size = st.st_size;
+
+  return res;
+}
+
+int write_file_atomically(const char *fname, const void *data, size_t size) {
+  /** @brief Writes a whole file; the file is written under a temporary name
+   * first and then renamed, so that concurrent readers never see a partial
+   * file.
+   * @return 0 on success, -1 on failure.
+   */
+  char tmp_fname[MAX_FILE_PATH];
+  snprintf(tmp_fname, MAX_FILE_PATH, "%s.%d.tmp", fname, (int)getpid());
+
+  FILE *fp = fopen(tmp_fname, "wb");
+  if (fp == NULL) {
+    perror("Error opening file");
+    return -1;
+  }
+
+  size_t written = fwrite(data, size, 1, fp);
+  if (fclose(fp) != 0 || written != 1 || rename(tmp_fname, fname) != 0) {
+    perror("Error writing file");
+    remove(tmp_fname);
+    return -1;
+  }
+
+  return 0;
+}
@@ -1,6 +1,7 @@
 #ifndef HELPERS_H__
 #define HELPERS_H__
 
+#include <stdint.h>
 #include <string.h>
 
 #define MAX_TEXT_LENGTH 100005
@@ -27,16 +28,44 @@
 
 #define MIN(x, y) x < y ? x : y;
 
+/**
+ * @brief The query modes: QUERY_ALL finds all the occurrences of every
+ * pattern; QUERY_COUNT only counts them (len is the count, no index is
+ * stored); QUERY_EXISTS only tells whether any pattern occurs (the search
+ * stops at the first occurrence found); QUERY_FIRST finds the first k
+ * occurrences of every pattern (the search of a pattern stops once they are
+ * known).
+ */
+#define QUERY_ALL 0
+#define QUERY_COUNT 1
+#define QUERY_EXISTS 2
+#define QUERY_FIRST 3
+
+#define COUNT_FLAG "--count"
+#define EXISTS_FLAG "--exists"
+#define FIRST_FLAG "--first"
+#define QUERY_USAGE                                                            \
+  "[" COUNT_FLAG " | " EXISTS_FLAG " | " FIRST_FLAG " <k>]"
+
 /**
  * @brief Struct for handling the input.
  * @var n_patterns: The number of patterns.
  * @var patterns: An array of strings (of patterns of course)
  * @var text: The text where to search the patterns.
+ * @var pattern_data: The block holding all the patterns, if they were
+ * allocated together (NULL if each pattern was allocated on its own).
+ * @var pattern_lengths: The length of each pattern, if it was precomputed
+ * (e.g. stored in a corpus), else NULL.
+ * @var pattern_fingerprints: The fingerprint of each pattern (see
+ * compute_fingerprint), if it was precomputed, else NULL.
  */
 typedef struct RabinKarpInput {
   int n_patterns;
   char **patterns;
   char *text;
+  char *pattern_data;
+  uint32_t *pattern_lengths;
+  uint64_t *pattern_fingerprints;
 } input_t;
 
 /**
@@ -45,11 +74,14 @@ typedef struct RabinKarpInput {
  * @var len: The number of times the pattern has been identified.
  * @var indexes: An array containing the indexes where the pattern has been
  * identified.
+ * @var mismatches: The number of mismatches of the occurrence at each index,
+ * for the approximate searches (NULL for the exact ones, see mismatch.h).
  */
 typedef struct IdentifiedPattern {
   char *pattern;
   int len;
   int *indexes;
+  int *mismatches;
 } pattern_w_idx_t;
 
 /**
@@ -62,13 +94,42 @@ typedef struct RabinKarpOutput {
   pattern_w_idx_t **identified_patterns;
 } output_t;
 
+/**
+ * @brief Struct for handling the query of a search.
+ * @var mode: The query mode (QUERY_*).
+ * @var k: The number of occurrences wanted per pattern (QUERY_FIRST only).
+ */
+typedef struct Query {
+  int mode;
+  int k;
+} query_t;
+
+input_t *parse_input_file(const char *fname);
+input_t *parse_input_file_header(const char *fname, long *text_offset,
+                                 long *text_length);
 input_t **parse_all_input_files(const char *root_folder, int num_tests);
+input_t **parse_all_input_headers(const char *root_folder, int num_tests);
 output_t **parse_all_ref_files(const char *root_folder, input_t **inputs,
                                int num_tests);
+output_t *parse_ref_file(const char *root_folder, int test_num,
+                         int n_patterns);
+void free_input_struct(input_t *ptr);
+size_t input_pattern_length(input_t *input, int pattern_idx);
 void destroy_tests(input_t **inputs, output_t **outputs, int num_tests);
 int check_correctness(output_t *output, output_t *gt);
+int check_query(output_t *output, output_t *gt, query_t *query);
+
+int parse_query_option(int argc, char *argv[], int *i, query_t *query);
+void record_match(pattern_w_idx_t *pattern_w_idx, int text_offset,
+                  query_t *query);
+int query_limit(pattern_w_idx_t *pattern_w_idx, query_t *query);
+int count_stored_indexes(pattern_w_idx_t *pattern_w_idx, query_t *query);
 
 pattern_w_idx_t *alloc_pattern_w_idx();
+output_t *alloc_output_struct(int n_patterns);
 void free_output_struct(output_t *ptr);
 
+char *map_file(const char *fname, size_t min_size, size_t *size);
+int write_file_atomically(const char *fname, const void *data, size_t size);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "incremental.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+static uint32_t max_tail_length(pattern_set_t *set) {
+  /** @return The length of the longest pattern of a pattern set, minus one
+   * (the groups are sorted by length).
+   */
+  uint32_t n_groups = set->header->n_groups;
+
+  return n_groups > 0 && set->groups[n_groups - 1].length > 0
+             ? set->groups[n_groups - 1].length - 1
+             : 0;
+}
+
+static search_state_t *alloc_search_state(uint32_t n_groups,
+                                          uint32_t tail_capacity) {
+  search_state_t *res = (search_state_t *)(calloc(1, sizeof(search_state_t)));
+  if (res == NULL) {
+    perror("Error allocating memory for search state");
+    return NULL;
+  }
+
+  res->fingerprints = (uint64_t *)(calloc(n_groups + 1, sizeof(uint64_t)));
+  res->tail = (char *)(malloc(tail_capacity + 1));
+  if (res->fingerprints == NULL || res->tail == NULL) {
+    perror("Error allocating memory for search state");
+    free_search_state(res);
+    return NULL;
+  }
+
+  return res;
+}
+
+search_state_t *load_search_state(const char *fname, pattern_set_t *set,
+                                  long text_offset, long text_length) {
+  /** @brief Gets the search state of a pattern set over an input file: it is
+   * read from fname if it was saved by a previous run of the same patterns
+   * over the same file, or else the search starts from the beginning of the
+   * text. The file is assumed to only grow: if the text is shorter than
+   * what was scanned before (e.g. the file was rotated), the state is
+   * dropped as well.
+   * @return The state (free it with free_search_state), NULL on failure.
+   */
+  uint32_t n_groups = set->header->n_groups;
+  uint32_t tail_capacity = max_tail_length(set);
+
+  search_state_t *res = alloc_search_state(n_groups, tail_capacity);
+  if (res == NULL) {
+    return NULL;
+  }
+
+  memcpy(res->header.magic, SEARCH_STATE_MAGIC, sizeof(res->header.magic));
+  res->header.version = SEARCH_STATE_VERSION;
+  res->header.n_groups = n_groups;
+  res->header.patterns_hash = set->header->content_hash;
+  res->header.text_offset = text_offset;
+
+  size_t size;
+  char *data = map_file(fname, sizeof(ss_header_t), &size);
+  if (data == NULL) {
+    return res;
+  }
+
+  ss_header_t *header = (ss_header_t *)data;
+  if (memcmp(header->magic, SEARCH_STATE_MAGIC, sizeof(header->magic)) == 0 &&
+      header->version == SEARCH_STATE_VERSION &&
+      header->n_groups == n_groups &&
+      header->patterns_hash == set->header->content_hash &&
+      header->text_offset == (uint64_t)text_offset &&
+      header->scanned_length <= (uint64_t)text_length &&
+      header->tail_length ==
+          (header->scanned_length < tail_capacity ? header->scanned_length
+                                                  : tail_capacity) &&
+      sizeof(ss_header_t) + n_groups * sizeof(uint64_t) +
+              header->tail_length ==
+          size) {
+    res->header = *header;
+    memcpy(res->fingerprints, data + sizeof(ss_header_t),
+           n_groups * sizeof(uint64_t));
+    memcpy(res->tail, data + sizeof(ss_header_t) + n_groups * sizeof(uint64_t),
+           header->tail_length);
+  }
+  munmap(data, size);
+
+  return res;
+}
+
+int save_search_state(search_state_t *state, const char *fname) {
+  /** @brief Writes a search state to a file (atomically, see
+   * write_file_atomically).
+   * @return 0 on success, -1 on failure.
+   */
+  size_t fingerprints_size = state->header.n_groups * sizeof(uint64_t);
+  size_t size =
+      sizeof(ss_header_t) + fingerprints_size + state->header.tail_length;
+
+  char *data = (char *)(malloc(size));
+  if (data == NULL) {
+    perror("Error allocating memory for search state");
+    return -1;
+  }
+
+  memcpy(data, &state->header, sizeof(ss_header_t));
+  memcpy(data + sizeof(ss_header_t), state->fingerprints, fingerprints_size);
+  memcpy(data + sizeof(ss_header_t) + fingerprints_size, state->tail,
+         state->header.tail_length);
+
+  int res = write_file_atomically(fname, data, size);
+  free(data);
+
+  return res;
+}
+
+void free_search_state(search_state_t *state) {
+  free(state->fingerprints);
+  free(state->tail);
+  free(state);
+}
+
+int search_appended_text(pattern_set_t *set, search_state_t *state, FILE *fp,
+                         long text_length, output_t *output) {
+  /** @brief Searches the bytes appended to the text since the state was saved:
+   * they are read after the tail, and only the occurrences ending in them are
+   * reported; the state is then moved to the end of the text.
+   * @param fp The input file.
+   * @param text_length The current length of the text.
+   * @param output The output, with the n_patterns identified patterns of the
+   * set allocated (and emptied).
+   * @return The number of new occurrences, -1 on failure.
+   */
+  long scanned_length = state->header.scanned_length;
+  long new_length = text_length - scanned_length;
+  int tail_length = state->header.tail_length;
+  if (new_length <= 0) {
+    return 0;
+  }
+  if (new_length > INT32_MAX - tail_length) {
+    fprintf(stderr, "Error searching appended text: too many new bytes\n");
+    return -1;
+  }
+
+  int buffer_length = tail_length + new_length;
+  char *buffer = (char *)(malloc(buffer_length));
+  if (buffer == NULL) {
+    perror("Error allocating memory for appended text");
+    return -1;
+  }
+
+  memcpy(buffer, state->tail, tail_length);
+  if (fseek(fp, state->header.text_offset + scanned_length, SEEK_SET) != 0 ||
+      fread(buffer + tail_length, 1, new_length, fp) != (size_t)new_length) {
+    perror("Error reading appended text");
+    free(buffer);
+    return -1;
+  }
+
+  int res = resume_pattern_set_search(set, buffer, buffer_length, tail_length,
+                                      scanned_length - tail_length,
+                                      state->fingerprints, output);
+
+  // Keep the last bytes for the occurrences which straddle the next append
+  int next_tail_length = MIN((int)max_tail_length(set), buffer_length);
+  memcpy(state->tail, buffer + buffer_length - next_tail_length,
+         next_tail_length);
+  state->header.tail_length = next_tail_length;
+  state->header.scanned_length = text_length;
+
+  free(buffer);
+
+  return res;
+}
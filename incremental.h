@@ -0,0 +1,64 @@
+#ifndef INCREMENTAL_H__
+#define INCREMENTAL_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "helpers.h"
+#include "pattern_set.h"
+
+/**
+ * @brief The state of an incremental search, saved at the end of each run, so
+ * that the next run of the same patterns over the same (grown) input file only
+ * scans the bytes appended since. The state file is the header, followed by
+ * the fingerprints (n_groups uint64_t) and by the tail.
+ */
+#define SEARCH_STATE_MAGIC "RKINCSTA"
+#define SEARCH_STATE_VERSION 1
+
+/**
+ * @brief The header of a search state.
+ * @var magic: SEARCH_STATE_MAGIC (not null terminated).
+ * @var version: SEARCH_STATE_VERSION.
+ * @var n_groups: The number of groups of the pattern set.
+ * @var tail_length: The length of the tail.
+ * @var patterns_hash: The content hash of the pattern set (see
+ * hash_patterns).
+ * @var text_offset: The offset of the text in the input file.
+ * @var scanned_length: The number of bytes of the text scanned so far.
+ */
+typedef struct SearchStateHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_groups;
+  uint32_t tail_length;
+  uint32_t reserved;
+  uint64_t patterns_hash;
+  uint64_t text_offset;
+  uint64_t scanned_length;
+} ss_header_t;
+
+/**
+ * @brief Struct for handling a search state.
+ * @var header: The header.
+ * @var fingerprints: The rolling fingerprint of each group of the pattern
+ * set, over the last (group length - 1) scanned bytes (see
+ * resume_pattern_set_search).
+ * @var tail: The last scanned bytes (as many as the longest pattern, minus
+ * one), needed to verify the occurrences which start before the new bytes.
+ */
+typedef struct SearchState {
+  ss_header_t header;
+  uint64_t *fingerprints;
+  char *tail;
+} search_state_t;
+
+search_state_t *load_search_state(const char *fname, pattern_set_t *set,
+                                  long text_offset, long text_length);
+int save_search_state(search_state_t *state, const char *fname);
+void free_search_state(search_state_t *state);
+
+int search_appended_text(pattern_set_t *set, search_state_t *state, FILE *fp,
+                         long text_length, output_t *output);
+
+#endif
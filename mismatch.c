@@ -0,0 +1,422 @@
+#include "mismatch.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOW_BITS 0x7F7F7F7F7F7F7F7FULL
+#define HIGH_BITS 0x8080808080808080ULL
+
+int count_mismatches(const char *text, const char *pattern, int length,
+                     int max_mismatches) {
+  /** @brief Counts the bytes which differ between a window of the text and a
+   * pattern, 8 at a time: the differing bytes of two words are the non zero
+   * bytes of their xor, whose high bits are set by adding LOW_BITS to their
+   * low bits (no carry crosses a byte), then counted with a popcount.
+   * @return The number of mismatches, or any number above max_mismatches once
+   * there are more of them.
+   */
+  int n_mismatches = 0;
+  int i = 0;
+
+  for (; i + 8 <= length; i += 8) {
+    uint64_t text_word, pattern_word;
+    memcpy(&text_word, text + i, sizeof(uint64_t));
+    memcpy(&pattern_word, pattern + i, sizeof(uint64_t));
+    uint64_t diff = text_word ^ pattern_word;
+    diff = (diff | ((diff & LOW_BITS) + LOW_BITS)) & HIGH_BITS;
+    n_mismatches += __builtin_popcountll(diff);
+    if (n_mismatches > max_mismatches) {
+      return n_mismatches;
+    }
+  }
+  for (; i < length; i++) {
+    n_mismatches += text[i] != pattern[i];
+  }
+
+  return n_mismatches;
+}
+
+mismatch_set_t *compile_mismatch_set(char **patterns, int n_patterns, int k) {
+  /** @brief Splits patterns into k + 1 pieces of (almost) equal lengths, and
+   * compiles the set of the pieces (see mismatch.h).
+   * @return The mismatch set (free it with free_mismatch_set), NULL on
+   * failure.
+   */
+  mismatch_set_t *set = (mismatch_set_t *)(calloc(1, sizeof(mismatch_set_t)));
+  if (set == NULL) {
+    perror("Error allocating memory for mismatch set");
+    return NULL;
+  }
+
+  size_t n_pieces = (size_t)n_patterns * (k + 1);
+  set->n_patterns = n_patterns;
+  set->k = k;
+  set->patterns = patterns;
+  set->lengths = (int *)(malloc((n_patterns + 1) * sizeof(int)));
+  set->piece_offsets =
+      (int *)(malloc(((size_t)n_patterns * (k + 2) + 1) * sizeof(int)));
+  char **pieces = (char **)(calloc(n_pieces + 1, sizeof(char *)));
+  if (set->lengths == NULL || set->piece_offsets == NULL || pieces == NULL) {
+    perror("Error allocating memory for mismatch set");
+    free(pieces);
+    free_mismatch_set(set);
+    return NULL;
+  }
+
+  // The pieces are copied out of their patterns by the compilation
+  int res = 0;
+  for (int i = 0; i < n_patterns && res == 0; i++) {
+    int length = strlen(patterns[i]);
+    int *piece_offsets = set->piece_offsets + (size_t)i * (k + 2);
+    set->lengths[i] = length;
+    for (int j = 0; j <= k + 1; j++) {
+      piece_offsets[j] = length > k ? (int)((long)j * length / (k + 1)) : 0;
+    }
+
+    for (int j = 0; j <= k && res == 0; j++) {
+      char **piece = &pieces[(size_t)i * (k + 1) + j];
+      *piece = strndup(patterns[i] + piece_offsets[j],
+                       piece_offsets[j + 1] - piece_offsets[j]);
+      res = *piece == NULL ? -1 : 0;
+    }
+  }
+  if (res == 0) {
+    set->piece_set = compile_pattern_set(pieces, n_pieces);
+  } else {
+    perror("Error allocating memory for mismatch set");
+  }
+
+  for (size_t i = 0; i < n_pieces; i++) {
+    free(pieces[i]);
+  }
+  free(pieces);
+  if (set->piece_set == NULL) {
+    free_mismatch_set(set);
+    return NULL;
+  }
+
+  return set;
+}
+
+void free_mismatch_set(mismatch_set_t *set) {
+  if (set == NULL) {
+    return;
+  }
+
+  free(set->lengths);
+  free(set->piece_offsets);
+  if (set->piece_set != NULL) {
+    free_pattern_set(set->piece_set);
+  }
+  free(set);
+}
+
+/**
+ * @brief Struct for verifying the occurrences of the pieces of a search.
+ * @var set: The mismatch set.
+ * @var text: The text.
+ * @var text_length: The length of the text.
+ * @var is_exists: Whether the search stops at the first occurrence.
+ * @var output: The output, whose identified patterns keep the first
+ * occurrences found so far (QUERY_FIRST), so that the positions past them
+ * are not verified (see query_limit).
+ * @var query: The query.
+ * @var matches: The occurrences (n_matches of capacity).
+ * @var n_candidates: The number of positions verified.
+ * @var res: 0, or -1 once an allocation failed.
+ */
+typedef struct MismatchSearch {
+  mismatch_set_t *set;
+  const char *text;
+  int text_length;
+  int is_exists;
+  output_t *output;
+  query_t *query;
+  mismatch_match_t *matches;
+  size_t n_matches;
+  size_t capacity;
+  long n_candidates;
+  int res;
+} mismatch_search_t;
+
+static int append_mismatch_match(mismatch_search_t *search, int pattern_id,
+                                 int text_offset, int n_mismatches) {
+  if (search->n_matches == search->capacity) {
+    size_t capacity = search->capacity > 0 ? 2 * search->capacity : 64;
+    mismatch_match_t *matches = (mismatch_match_t *)(realloc(
+        search->matches, capacity * sizeof(mismatch_match_t)));
+    if (matches == NULL) {
+      perror("Error allocating memory for matches");
+      search->res = -1;
+      return -1;
+    }
+    search->matches = matches;
+    search->capacity = capacity;
+  }
+
+  mismatch_match_t *match = &search->matches[search->n_matches++];
+  match->offset = text_offset;
+  match->pattern_id = pattern_id;
+  match->mismatches = n_mismatches;
+
+  return 0;
+}
+
+static int verify_piece_matches(const ps_match_t *matches, size_t n_matches,
+                                void *arg) {
+  mismatch_search_t *search = (mismatch_search_t *)arg;
+  mismatch_set_t *set = search->set;
+  int k = set->k;
+
+  for (size_t i = 0; i < n_matches; i++) {
+    int pattern_id = matches[i].pattern_id / (k + 1);
+    int piece = matches[i].pattern_id % (k + 1);
+    const char *pattern = set->patterns[pattern_id];
+    int length = set->lengths[pattern_id];
+    int *piece_offsets = set->piece_offsets + (size_t)pattern_id * (k + 2);
+    int text_offset = (int)matches[i].offset - piece_offsets[piece];
+    pattern_w_idx_t *pattern_w_idx =
+        search->output->identified_patterns[pattern_id];
+    if (text_offset < 0 || text_offset > search->text_length - length ||
+        text_offset > query_limit(pattern_w_idx, search->query)) {
+      continue;
+    }
+
+    // A position with several intact pieces is only verified from the first
+    // one
+    const char *window = search->text + text_offset;
+    int is_first_piece = 1;
+    for (int j = 0; j < piece && is_first_piece; j++) {
+      is_first_piece =
+          memcmp(window + piece_offsets[j], pattern + piece_offsets[j],
+                 piece_offsets[j + 1] - piece_offsets[j]) != 0;
+    }
+    if (!is_first_piece) {
+      continue;
+    }
+
+    search->n_candidates++;
+    int n_mismatches = count_mismatches(window, pattern, length, k);
+    if (n_mismatches > k) {
+      continue;
+    }
+    if (append_mismatch_match(search, pattern_id, text_offset, n_mismatches) !=
+        0) {
+      return -1;
+    }
+    if (search->query->mode == QUERY_FIRST) {
+      record_match(pattern_w_idx, text_offset, search->query);
+    }
+  }
+
+  return search->is_exists && search->n_matches > 0;
+}
+
+static int cmp_mismatch_matches(const void *a, const void *b) {
+  const mismatch_match_t *matchA = (const mismatch_match_t *)a;
+  const mismatch_match_t *matchB = (const mismatch_match_t *)b;
+
+  if (matchA->pattern_id != matchB->pattern_id) {
+    return matchA->pattern_id < matchB->pattern_id ? -1 : 1;
+  }
+
+  return matchA->offset < matchB->offset ? -1 : 1;
+}
+
+long search_mismatch_set(mismatch_set_t *set, const char *text,
+                         int text_length, output_t *output, query_t *query,
+                         long *n_candidates) {
+  /** @brief Searches patterns with up to k mismatches in a text, into an
+   * output, as needed by the query: the pieces are searched with a single
+   * scan of the compiled set (see visit_pattern_set_matches), their
+   * occurrences are verified, then sorted and recorded pattern by pattern,
+   * each with its number of mismatches. The patterns of at most k bytes are
+   * verified at every position. With QUERY_FIRST, a pattern is no longer
+   * verified past its first k occurrences found so far.
+   * @param output The output, with the n_patterns identified patterns
+   * allocated; their mismatches are allocated as needed.
+   * @param n_candidates The number of positions verified (output).
+   * @return The number of occurrences found, -1 on failure.
+   */
+  for (int i = 0; i < set->n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    strcpy(pattern_w_idx->pattern, set->patterns[i]);
+    pattern_w_idx->len = 0;
+    if (pattern_w_idx->mismatches == NULL) {
+      pattern_w_idx->mismatches =
+          (int *)(malloc(MAX_FOUND_PATTERNS * sizeof(int)));
+      if (pattern_w_idx->mismatches == NULL) {
+        perror("Error allocating memory for mismatches");
+        return -1;
+      }
+    }
+  }
+
+  int is_exists = query->mode == QUERY_EXISTS;
+  mismatch_search_t search = {set,   text, text_length, is_exists, output,
+                              query, NULL, 0, 0, 0, 0};
+  for (int i = 0; i < set->n_patterns && search.res == 0; i++) {
+    int length = set->lengths[i];
+    if (length > set->k) {
+      continue;
+    }
+
+    // Only the first k occurrences of a pattern can be kept
+    size_t first_match = search.n_matches;
+    for (int text_offset = 0; text_offset <= text_length - length &&
+                              !(is_exists && search.n_matches > 0) &&
+                              !(query->mode == QUERY_FIRST &&
+                                search.n_matches - first_match ==
+                                    (size_t)query->k);
+         text_offset++) {
+      search.n_candidates++;
+      if (append_mismatch_match(&search, i, text_offset,
+                                count_mismatches(text + text_offset,
+                                                 set->patterns[i], length,
+                                                 length)) != 0) {
+        break;
+      }
+    }
+  }
+
+  if (search.res == 0 && !(is_exists && search.n_matches > 0)) {
+    visit_pattern_set_matches(set->piece_set, text, text_length,
+                              is_exists ? 1 : PATTERN_SET_MATCH_BATCH,
+                              verify_piece_matches, &search);
+  }
+  *n_candidates = search.n_candidates;
+
+  // The occurrences recorded by the verification are recorded again, in order
+  for (int i = 0; i < set->n_patterns; i++) {
+    output->identified_patterns[i]->len = 0;
+  }
+  qsort(search.matches, search.n_matches, sizeof(mismatch_match_t),
+        cmp_mismatch_matches);
+  for (size_t i = 0; i < search.n_matches; i++) {
+    mismatch_match_t *match = &search.matches[i];
+    pattern_w_idx_t *pattern_w_idx =
+        output->identified_patterns[match->pattern_id];
+    record_match(pattern_w_idx, match->offset, query);
+
+    // The offsets of a pattern come in increasing order, so an occurrence
+    // which is stored is the last one
+    int n_stored = count_stored_indexes(pattern_w_idx, query);
+    if (n_stored > 0 &&
+        pattern_w_idx->indexes[n_stored - 1] == (int)match->offset) {
+      pattern_w_idx->mismatches[n_stored - 1] = match->mismatches;
+    }
+  }
+  free(search.matches);
+
+  return search.res == 0 ? (long)search.n_matches : -1;
+}
+
+static int cmp_identified_patterns(const void *a, const void *b) {
+  const pattern_w_idx_t *patternA = *(const pattern_w_idx_t **)a;
+  const pattern_w_idx_t *patternB = *(const pattern_w_idx_t **)b;
+
+  return strcmp(patternA->pattern, patternB->pattern);
+}
+
+static int cmp_offsets(const void *a, const void *b) {
+  return *((int *)a) - *((int *)b);
+}
+
+int check_mismatch_query(output_t *output, output_t *gt, const char *text,
+                         int k, query_t *query) {
+  /** @brief Same as check_query, for a k-mismatch search against the ref of
+   * the exact search: every occurrence of the ref must be in the output (up to
+   * the last one stored, once a pattern stored all it can), or be counted
+   * (QUERY_COUNT), and every occurrence stored must have at most k
+   * mismatches, as many as recounted against the text; with QUERY_EXISTS,
+   * some occurrence must be found if the ref has one.
+   * @return 0 if the answer is right, 1 otherwise, and also prints the diff.
+   */
+  if (output->n_patterns != gt->n_patterns) {
+    printf("Different num of patterns: %d (output) vs %d (gt)\n",
+           output->n_patterns, gt->n_patterns);
+    return 1;
+  }
+
+  qsort(output->identified_patterns, output->n_patterns,
+        sizeof(pattern_w_idx_t *), cmp_identified_patterns);
+  qsort(gt->identified_patterns, gt->n_patterns, sizeof(pattern_w_idx_t *),
+        cmp_identified_patterns);
+
+  int text_length = strlen(text);
+  int is_output_found = 0, is_gt_found = 0;
+  for (int i = 0; i < output->n_patterns; i++) {
+    pattern_w_idx_t *output_pattern = output->identified_patterns[i];
+    pattern_w_idx_t *gt_pattern = gt->identified_patterns[i];
+    const char *pattern = output_pattern->pattern;
+
+    if (strcmp(pattern, gt_pattern->pattern) != 0) {
+      printf("Different patterns found at index (after sorting) %d: %s "
+             "(output) vs %s (gt)\n",
+             i, pattern, gt_pattern->pattern);
+      return 1;
+    }
+    is_output_found |= output_pattern->len > 0;
+    is_gt_found |= gt_pattern->len > 0;
+
+    if (query->mode == QUERY_COUNT) {
+      if (output_pattern->len < gt_pattern->len) {
+        printf("Count for pattern %s below the exact one: %d (output) vs %d "
+               "(gt)\n",
+               pattern, output_pattern->len, gt_pattern->len);
+        return 1;
+      }
+      continue;
+    }
+
+    // The occurrences are stored by increasing offset, next to their
+    // mismatches, so they are not sorted here
+    int length = strlen(pattern);
+    int *indexes = output_pattern->indexes;
+    int n_stored = count_stored_indexes(output_pattern, query);
+    for (int j = 0; j < n_stored; j++) {
+      if (indexes[j] < 0 || indexes[j] > text_length - length ||
+          (j > 0 && indexes[j] <= indexes[j - 1])) {
+        printf("Bad index %d for pattern %s\n", indexes[j], pattern);
+        return 1;
+      }
+
+      int n_mismatches =
+          count_mismatches(text + indexes[j], pattern, length, length);
+      if (output_pattern->mismatches[j] != n_mismatches || n_mismatches > k) {
+        printf("Mismatches differ at index %d: %d (output) vs %d in the text, "
+               "at most %d for pattern %s\n",
+               indexes[j], output_pattern->mismatches[j], n_mismatches, k,
+               pattern);
+        return 1;
+      }
+    }
+    if (query->mode == QUERY_EXISTS) {
+      continue;
+    }
+
+    // Past the last occurrence stored by a full pattern, the occurrences of
+    // the ref were dropped
+    int n_max = query->mode == QUERY_FIRST ? query->k : MAX_FOUND_PATTERNS;
+    int last = n_stored == n_max ? indexes[n_stored - 1] : INT_MAX;
+    qsort(gt_pattern->indexes, gt_pattern->len, sizeof(int), cmp_offsets);
+    for (int j = 0; j < gt_pattern->len && gt_pattern->indexes[j] <= last;
+         j++) {
+      if (bsearch(&gt_pattern->indexes[j], indexes, n_stored, sizeof(int),
+                  cmp_offsets) == NULL) {
+        printf("Index %d of gt not in output for pattern %s\n",
+               gt_pattern->indexes[j], pattern);
+        return 1;
+      }
+    }
+  }
+
+  if (is_gt_found && !is_output_found) {
+    printf("Different answers: not found (output) vs found (gt)\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef MISMATCH_H__
+#define MISMATCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+#include "pattern_set.h"
+
+/**
+ * @brief A k-mismatch search finds the occurrences of the patterns with up to
+ * k substituted bytes (a Hamming distance of at most k). A pattern is split
+ * into k + 1 pieces: k substitutions leave at least one of them intact, so
+ * the pieces of all the patterns are searched exactly, together, with a
+ * compiled pattern set, and each occurrence of a piece places its pattern in
+ * the text, where its mismatches are counted a word at a time.
+ */
+
+/**
+ * @brief The command line option selecting the k-mismatch search, followed by
+ * k.
+ */
+#define MISMATCH_FLAG "--mismatches"
+
+/**
+ * @brief The largest k: past it, every pattern would occur everywhere.
+ */
+#define MISMATCH_MAX_K (MAX_PATTERN_LENGTH - 1)
+
+/**
+ * @brief Struct for handling a set of patterns searched with up to k
+ * mismatches.
+ * @var n_patterns: The number of patterns.
+ * @var k: The number of mismatches allowed.
+ * @var patterns: The patterns (not copied).
+ * @var lengths: The length of each pattern.
+ * @var piece_offsets: The offset of each piece in its pattern (k + 2 per
+ * pattern, the last one being the length of the pattern): piece j of pattern
+ * i is pattern i of the piece set, at i * (k + 1) + j.
+ * @var piece_set: The compiled set of the pieces; the patterns of at most k
+ * bytes occur everywhere, and have empty pieces, which are not searched.
+ */
+typedef struct MismatchSet {
+  int n_patterns;
+  int k;
+  char **patterns;
+  int *lengths;
+  int *piece_offsets;
+  pattern_set_t *piece_set;
+} mismatch_set_t;
+
+/**
+ * @brief An occurrence of a k-mismatch search.
+ * @var offset: The position of the occurrence in the text.
+ * @var pattern_id: The index of the pattern.
+ * @var mismatches: The number of bytes which differ from the pattern.
+ */
+typedef struct MismatchMatch {
+  uint64_t offset;
+  uint32_t pattern_id;
+  uint32_t mismatches;
+} mismatch_match_t;
+
+int count_mismatches(const char *text, const char *pattern, int length,
+                     int max_mismatches);
+mismatch_set_t *compile_mismatch_set(char **patterns, int n_patterns, int k);
+void free_mismatch_set(mismatch_set_t *set);
+long search_mismatch_set(mismatch_set_t *set, const char *text,
+                         int text_length, output_t *output, query_t *query,
+                         long *n_candidates);
+int check_mismatch_query(output_t *output, output_t *gt, const char *text,
+                         int k, query_t *query);
+
+#endif
@@ -0,0 +1,1414 @@
+#include "mpi_helpers.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "compression.h"
+
+int max_pattern_length(char **patterns, int n_patterns) {
+  int res = 0;
+  for (int i = 0; i < n_patterns; i++) {
+    int pattern_length = strlen(patterns[i]);
+    if (pattern_length > res) {
+      res = pattern_length;
+    }
+  }
+
+  return res;
+}
+
+void free_patterns(char **patterns, int n_patterns) {
+  for (int i = 0; i < n_patterns; i++) {
+    free(patterns[i]);
+  }
+  free(patterns);
+}
+
+int parse_mpi_options(int argc, char *argv[], mpi_options_t *options) {
+  /** @brief Parses the optional command line arguments (from argv[3] on).
+   * @return 0 on success, -1 if there is an unknown argument.
+   */
+  options->split_mode = 0;
+  options->local_io = 0;
+  options->query.mode = QUERY_ALL;
+  options->query.k = 0;
+
+  for (int i = 3; i < argc; i++) {
+    int is_query_option = parse_query_option(argc, argv, &i, &options->query);
+    if (is_query_option == -1) {
+      return -1;
+    } else if (is_query_option == 1) {
+      continue;
+    } else if (strcmp(argv[i], SPLIT_MODE_FLAG) == 0) {
+      options->split_mode = 1;
+    } else if (strcmp(argv[i], LOCAL_IO_FLAG) == 0) {
+      options->local_io = 1;
+    } else {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int translate_rank(int rank, MPI_Comm from, MPI_Comm to) {
+  /** @brief Translates a rank of a communicator to the rank of the same process
+   * in another communicator.
+   * @return The rank in to, MPI_UNDEFINED if the process is not part of it.
+   */
+  MPI_Group from_group, to_group;
+  int res;
+
+  MPI_Comm_group(from, &from_group);
+  MPI_Comm_group(to, &to_group);
+  MPI_Group_translate_ranks(from_group, 1, &rank, to_group, &res);
+  MPI_Group_free(&from_group);
+  MPI_Group_free(&to_group);
+
+  return res;
+}
+
+node_comm_t *create_node_comm(MPI_Comm comm) {
+  /** @brief Groups the ranks of comm by node (collective over comm). The first
+   * rank of each node (the one with the lowest rank in comm) is the node
+   * leader.
+   * @return The node communicators.
+   */
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  node_comm_t *res = (node_comm_t *)(malloc(sizeof(node_comm_t)));
+  if (res == NULL) {
+    perror("Error allocating memory for node communicator");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                      &res->node);
+  MPI_Comm_rank(res->node, &res->node_rank);
+  MPI_Comm_size(res->node, &res->node_size);
+
+  MPI_Comm_split(comm, res->node_rank == 0 ? 0 : MPI_UNDEFINED, rank,
+                 &res->leaders);
+
+  return res;
+}
+
+void destroy_node_comm(node_comm_t *node_comm) {
+  if (node_comm->leaders != MPI_COMM_NULL) {
+    MPI_Comm_free(&node_comm->leaders);
+  }
+  MPI_Comm_free(&node_comm->node);
+  free(node_comm);
+}
+
+int count_reducers(int n_ranks) {
+  /** @brief Computes the number of reducers in task mode, one for every
+   * REDUCER_FANIN workers (at least one).
+   * @param n_ranks The number of ranks, including the mapper.
+   * @return The number of reducers.
+   */
+  return (n_ranks - 1 + REDUCER_FANIN) / (REDUCER_FANIN + 1);
+}
+
+int count_reducer_tasks(int n_tasks, int reducer_idx, int n_reducers) {
+  /** @brief Computes the number of tasks whose results are collected by a
+   * reducer; task task_id belongs to reducer task_id % n_reducers.
+   * @param reducer_idx The index of the reducer (0 for the first reducer).
+   * @return The number of tasks.
+   */
+  if (reducer_idx >= n_tasks) {
+    return 0;
+  }
+
+  return (n_tasks - reducer_idx + n_reducers - 1) / n_reducers;
+}
+
+void compute_split_ranges(int text_length, int halo, int n_ranks,
+                          split_range_t *ranges) {
+  /** @brief Splits a text into n_ranks contiguous ranges of (almost) equal
+   * size; each range is extended with halo bytes taken from the next range.
+   * @param text_length The length of the whole text.
+   * @param halo The number of bytes overlapping the next range (should be
+   * max_pattern_length - 1).
+   * @param n_ranks The number of ranges.
+   * @param ranges The output array, with n_ranks elements.
+   */
+  for (int i = 0; i < n_ranks; i++) {
+    int start = (long long)i * text_length / n_ranks;
+    int end = (long long)(i + 1) * text_length / n_ranks;
+
+    ranges[i].start = start;
+    ranges[i].owned = end - start;
+    ranges[i].length = 0;
+    if (ranges[i].owned > 0) {
+      ranges[i].length =
+          end + halo < text_length ? end + halo - start : text_length - start;
+    }
+  }
+}
+
+char **bcast_patterns(char **patterns, int *n_patterns, int root,
+                      MPI_Comm comm) {
+  /** @brief Broadcasts the patterns of root to all the ranks of comm. The
+   * patterns are packed in a single buffer, so only three broadcasts are done
+   * regardless of the number of patterns.
+   * @param patterns The patterns (only significant at root).
+   * @param n_patterns The number of patterns (set on all the ranks).
+   * @return A freshly allocated copy of the patterns, on every rank (free it
+   * with free_patterns).
+   */
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  MPI_Bcast(n_patterns, 1, MPI_INT, root, comm);
+
+  // The number of patterns is unbounded, so the lengths are not on the stack
+  int *pattern_lengths = (int *)(malloc((*n_patterns + 1) * sizeof(int)));
+  if (pattern_lengths == NULL) {
+    perror("Error allocating memory for the pattern lengths");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+  int total_length = 0;
+  if (rank == root) {
+    for (int i = 0; i < *n_patterns; i++) {
+      pattern_lengths[i] = strlen(patterns[i]);
+    }
+  }
+  MPI_Bcast(pattern_lengths, *n_patterns, MPI_INT, root, comm);
+
+  for (int i = 0; i < *n_patterns; i++) {
+    total_length += pattern_lengths[i];
+  }
+
+  char *packed = (char *)(malloc((total_length + 1) * sizeof(char)));
+  char **res = (char **)(malloc(*n_patterns * sizeof(char *)));
+  if (packed == NULL || res == NULL) {
+    perror("Error allocating memory for the broadcast patterns");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+
+  if (rank == root) {
+    int offset = 0;
+    for (int i = 0; i < *n_patterns; i++) {
+      memcpy(packed + offset, patterns[i], pattern_lengths[i]);
+      offset += pattern_lengths[i];
+    }
+  }
+  MPI_Bcast(packed, total_length, MPI_CHAR, root, comm);
+
+  int offset = 0;
+  for (int i = 0; i < *n_patterns; i++) {
+    res[i] = (char *)(malloc((pattern_lengths[i] + 1) * sizeof(char)));
+    if (res[i] == NULL) {
+      perror("Error allocating memory for pattern");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+    memcpy(res[i], packed + offset, pattern_lengths[i]);
+    res[i][pattern_lengths[i]] = '\0';
+    offset += pattern_lengths[i];
+  }
+
+  free(packed);
+  free(pattern_lengths);
+
+  return res;
+}
+
+static split_range_t compute_node_range(int text_length, int halo,
+                                        node_comm_t *node_comm) {
+  /** @brief Splits a text between the nodes (see compute_split_ranges).
+   * @return The range of the current node.
+   */
+  split_range_t node_range;
+  if (node_comm->leaders != MPI_COMM_NULL) {
+    int n_nodes, leader_rank;
+    MPI_Comm_size(node_comm->leaders, &n_nodes);
+    MPI_Comm_rank(node_comm->leaders, &leader_rank);
+
+    split_range_t node_ranges[n_nodes];
+    compute_split_ranges(text_length, halo, n_nodes, node_ranges);
+    node_range = node_ranges[leader_rank];
+  }
+  MPI_Bcast(&node_range, sizeof(split_range_t), MPI_BYTE, 0, node_comm->node);
+
+  return node_range;
+}
+
+static char *alloc_node_text(split_range_t *node_range, node_comm_t *node_comm,
+                             MPI_Win *win) {
+  /** @brief Allocates the range of the current node in a shared memory window
+   * of the node leader.
+   * @return The base of the range, as seen by the current rank.
+   */
+  char *base;
+  MPI_Aint size;
+  int disp_unit;
+  MPI_Win_allocate_shared(node_comm->node_rank == 0 ? node_range->length + 1
+                                                    : 0,
+                          1, MPI_INFO_NULL, node_comm->node, &base, win);
+  MPI_Win_shared_query(*win, 0, &size, &disp_unit, &base);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+
+  return base;
+}
+
+static char *share_node_text(char *base, split_range_t *node_range, int halo,
+                             node_comm_t *node_comm, MPI_Win win,
+                             split_range_t *range) {
+  /** @brief Makes the range of the current node (filled by the node leader)
+   * visible to all the ranks of the node and splits it between them; the
+   * halos are already part of the node range.
+   * @return A pointer to the range of the current rank.
+   */
+  MPI_Win_sync(win);
+  MPI_Barrier(node_comm->node);
+  MPI_Win_sync(win);
+
+  split_range_t local_ranges[node_comm->node_size];
+  compute_split_ranges(node_range->owned, halo, node_comm->node_size,
+                       local_ranges);
+
+  split_range_t *local_range = &local_ranges[node_comm->node_rank];
+  range->start = node_range->start + local_range->start;
+  range->owned = local_range->owned;
+  range->length = 0;
+  if (range->owned > 0) {
+    int end = local_range->start + local_range->owned + halo;
+    range->length = (end < node_range->length ? end : node_range->length) -
+                    local_range->start;
+  }
+
+  return base + local_range->start;
+}
+
+char *scatter_text(char *text, int text_length, int halo, int root,
+                   MPI_Comm comm, node_comm_t *node_comm, split_range_t *range,
+                   MPI_Win *win) {
+  /** @brief Scatters the text of root to all the ranks of comm, each rank
+   * getting its own range plus the halo (see compute_split_ranges). The text is
+   * first split between the nodes and each node range is received only once,
+   * by the node leader, in a shared memory window; the ranks of the node then
+   * search their own part of it in place. So every byte crosses the network
+   * once per node and the halos of the ranks of the same node are not
+   * duplicated.
+   * @param text The whole text (only significant at root).
+   * @param text_length The length of the text (only significant at root).
+   * @param halo The number of overlapping bytes between consecutive ranges.
+   * @param node_comm The ranks of comm grouped by node (root must be a node
+   * leader).
+   * @param range The range of the current rank (output).
+   * @param win The shared memory window (output, free it with
+   * free_shared_text).
+   * @return A pointer to the range of the current rank, inside the window (it
+   * is not null terminated, only range->length bytes are valid).
+   */
+  MPI_Bcast(&text_length, 1, MPI_INT, root, comm);
+
+  split_range_t node_range = compute_node_range(text_length, halo, node_comm);
+  char *base = alloc_node_text(&node_range, node_comm, win);
+
+  if (node_comm->leaders != MPI_COMM_NULL) {
+    int n_nodes;
+    MPI_Comm_size(node_comm->leaders, &n_nodes);
+
+    int leaders_root = translate_rank(root, comm, node_comm->leaders);
+    if (leaders_root == MPI_UNDEFINED) {
+      fprintf(stderr, "Error: the root of the scatter must be a node leader\n");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    int send_counts[n_nodes];
+    int displacements[n_nodes];
+    split_range_t node_ranges[n_nodes];
+    compute_split_ranges(text_length, halo, n_nodes, node_ranges);
+    for (int i = 0; i < n_nodes; i++) {
+      send_counts[i] = node_ranges[i].length;
+      displacements[i] = node_ranges[i].start;
+    }
+
+    MPI_Scatterv(text, send_counts, displacements, MPI_CHAR, base,
+                 node_range.length, MPI_CHAR, leaders_root,
+                 node_comm->leaders);
+  }
+
+  return share_node_text(base, &node_range, halo, node_comm, *win, range);
+}
+
+char *read_text(const char *fname, long text_offset, int text_length, int halo,
+                node_comm_t *node_comm, split_range_t *range, MPI_Win *win) {
+  /** @brief Same as scatter_text, but nobody sends the text: each node leader
+   * reads the range of its node straight from the file (collective MPI-IO
+   * read), so the reading is spread over all the nodes.
+   * @param fname The path to the test input file (on a shared filesystem).
+   * @param text_offset The offset of the text in the file.
+   * @param text_length The length of the text.
+   * @return A pointer to the range of the current rank, inside the window.
+   */
+  split_range_t node_range = compute_node_range(text_length, halo, node_comm);
+  char *base = alloc_node_text(&node_range, node_comm, win);
+
+  if (node_comm->leaders != MPI_COMM_NULL) {
+    MPI_File fh;
+    if (MPI_File_open(node_comm->leaders, fname, MPI_MODE_RDONLY,
+                      MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+      fprintf(stderr, "Error opening test input file %s\n", fname);
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    MPI_File_read_at_all(fh, text_offset + node_range.start, base,
+                         node_range.length, MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+  }
+
+  return share_node_text(base, &node_range, halo, node_comm, *win, range);
+}
+
+void free_shared_text(MPI_Win *win) {
+  /** @brief Frees the shared memory window of a text scattered with
+   * scatter_text (collective over the node).
+   */
+  MPI_Win_unlock_all(*win);
+  MPI_Win_free(win);
+}
+
+void gather_split_results(output_t *local, split_range_t *range,
+                          output_t *merged, query_t *query, int root,
+                          MPI_Comm comm) {
+  /** @brief Gathers the per range results of all the ranks of comm at root.
+   * The indexes are rebased to whole text offsets; the ranges are gathered in
+   * rank order, so the merged indexes of every pattern are sorted as long as
+   * the ranks are placed on the nodes in blocks.
+   * @param local The results found by the current rank, with indexes relative
+   * to its range (they are rebased in place).
+   * @param range The range searched by the current rank.
+   * @param merged The merged results (only significant at root, must have
+   * local->n_patterns identified patterns allocated).
+   * @param query The query: only the counts are gathered for QUERY_COUNT, and
+   * only the first k of the merged indexes are kept for QUERY_FIRST (the first
+   * MAX_FOUND_PATTERNS for QUERY_ALL).
+   */
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  int n_patterns = local->n_patterns;
+
+  // Rebase the indexes and pack them in a single buffer
+  int *counts = (int *)(malloc((n_patterns + 1) * sizeof(int)));
+  if (counts == NULL) {
+    perror("Error allocating memory for occurrence counts");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+  int local_total = 0;
+  for (int i = 0; i < n_patterns; i++) {
+    counts[i] = local->identified_patterns[i]->len;
+    local_total += count_stored_indexes(local->identified_patterns[i], query);
+  }
+
+  int *packed = (int *)(malloc((local_total + 1) * sizeof(int)));
+  if (packed == NULL) {
+    perror("Error allocating memory for packed indexes");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+
+  int offset = 0;
+  for (int i = 0; i < n_patterns && query->mode != QUERY_COUNT; i++) {
+    for (int j = 0; j < counts[i]; j++) {
+      packed[offset++] =
+          local->identified_patterns[i]->indexes[j] + range->start;
+    }
+  }
+
+  // Gather the number of occurrences of every pattern found by every rank
+  int *all_counts = NULL;
+  if (rank == root) {
+    all_counts = (int *)(malloc(size * n_patterns * sizeof(int)));
+    if (all_counts == NULL) {
+      perror("Error allocating memory for occurrence counts");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+  }
+  MPI_Gather(counts, n_patterns, MPI_INT, all_counts, n_patterns, MPI_INT, root,
+             comm);
+
+  // Gather the indexes themselves
+  int *recv_counts = NULL;
+  int *displacements = NULL;
+  int *all_indexes = NULL;
+  if (rank == root) {
+    recv_counts = (int *)(malloc(size * sizeof(int)));
+    displacements = (int *)(malloc(size * sizeof(int)));
+    if (recv_counts == NULL || displacements == NULL) {
+      perror("Error allocating memory for gather counts");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    int total = 0;
+    for (int r = 0; r < size; r++) {
+      recv_counts[r] = 0;
+      for (int i = 0; i < n_patterns && query->mode != QUERY_COUNT; i++) {
+        recv_counts[r] += all_counts[r * n_patterns + i];
+      }
+      displacements[r] = total;
+      total += recv_counts[r];
+    }
+
+    all_indexes = (int *)(malloc((total + 1) * sizeof(int)));
+    if (all_indexes == NULL) {
+      perror("Error allocating memory for gathered indexes");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+  }
+  MPI_Gatherv(packed, local_total, MPI_INT, all_indexes, recv_counts,
+              displacements, MPI_INT, root, comm);
+
+  if (rank == root) {
+    // Merge the results; the patterns are the same on every rank
+    for (int i = 0; i < n_patterns; i++) {
+      strcpy(merged->identified_patterns[i]->pattern,
+             local->identified_patterns[i]->pattern);
+      merged->identified_patterns[i]->len = 0;
+    }
+
+    for (int r = 0; r < size; r++) {
+      int *rank_indexes = all_indexes + displacements[r];
+      for (int i = 0; i < n_patterns; i++) {
+        pattern_w_idx_t *pattern_w_idx = merged->identified_patterns[i];
+        int count = all_counts[r * n_patterns + i];
+        if (query->mode == QUERY_COUNT) {
+          pattern_w_idx->len += count;
+          continue;
+        }
+        if (query->mode == QUERY_FIRST) {
+          // Every rank found up to k occurrences in its own range: keep the
+          // first k of the whole text, whatever the order of the ranges
+          for (int j = 0; j < count; j++) {
+            record_match(pattern_w_idx, rank_indexes[j], query);
+          }
+        } else {
+          // Every rank stored up to MAX_FOUND_PATTERNS occurrences: keep the
+          // first ones of the whole text, as a single search would
+          int n_kept = MAX_FOUND_PATTERNS - pattern_w_idx->len;
+          n_kept = count < n_kept ? count : n_kept;
+          memcpy(pattern_w_idx->indexes + pattern_w_idx->len, rank_indexes,
+                 n_kept * sizeof(int));
+          pattern_w_idx->len += n_kept;
+        }
+        rank_indexes += count;
+      }
+    }
+
+    free(all_counts);
+    free(recv_counts);
+    free(displacements);
+    free(all_indexes);
+  }
+
+  free(packed);
+  free(counts);
+}
+
+cancel_flag_t *create_cancel_flag(int root, MPI_Comm comm) {
+  /** @brief Creates the cancel flag of root (collective over comm); it stays
+   * locked (passive target) until it is destroyed.
+   */
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  cancel_flag_t *cancel = (cancel_flag_t *)(malloc(sizeof(cancel_flag_t)));
+  if (cancel == NULL) {
+    perror("Error allocating memory for cancel flag");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+
+  MPI_Aint size = rank == root ? sizeof(int) : 0;
+  MPI_Win_allocate(size, sizeof(int), MPI_INFO_NULL, comm, &cancel->flag,
+                   &cancel->win);
+  if (rank == root) {
+    *cancel->flag = 0;
+  }
+  cancel->search = 0;
+  cancel->root = root;
+
+  // The flag must be initialized before anyone raises it
+  MPI_Barrier(comm);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, cancel->win);
+
+  return cancel;
+}
+
+void start_cancellable_search(cancel_flag_t *cancel) {
+  /** @brief Starts a new search (every rank of the flag must start it).
+   */
+  cancel->search++;
+}
+
+void raise_cancel_flag(cancel_flag_t *cancel) {
+  /** @brief Lets the other ranks know that the answer of the current search is
+   * known.
+   */
+  MPI_Accumulate(&cancel->search, 1, MPI_INT, cancel->root, 0, 1, MPI_INT,
+                 MPI_MAX, cancel->win);
+  MPI_Win_flush(cancel->root, cancel->win);
+}
+
+int is_cancel_flag_raised(cancel_flag_t *cancel) {
+  /** @return Whether a rank knows the answer of the current search.
+   */
+  int flag;
+  MPI_Fetch_and_op(NULL, &flag, MPI_INT, cancel->root, 0, MPI_NO_OP,
+                   cancel->win);
+  MPI_Win_flush(cancel->root, cancel->win);
+
+  return flag >= cancel->search;
+}
+
+void destroy_cancel_flag(cancel_flag_t *cancel) {
+  /** @brief Frees a cancel flag (collective over its communicator).
+   */
+  MPI_Win_unlock_all(cancel->win);
+  MPI_Win_free(&cancel->win);
+  free(cancel);
+}
+
+void create_task_counter(task_queue_t *queue, MPI_Comm comm) {
+  /** @brief Creates the task counter of root (collective over comm).
+   */
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  MPI_Win_allocate(rank == queue->root ? sizeof(int) : 0, sizeof(int),
+                   MPI_INFO_NULL, comm, &queue->counter, &queue->counter_win);
+
+  if (rank == queue->root) {
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, queue->root, 0, queue->counter_win);
+    *queue->counter = 0;
+    MPI_Win_unlock(queue->root, queue->counter_win);
+  }
+
+  // Nobody grabs a task before the counter is initialized
+  MPI_Barrier(comm);
+
+  // The counter is only accessed in passive target mode, so a single access
+  // epoch is opened for the whole lifetime of the queue
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, queue->counter_win);
+}
+
+double estimate_task_cost(char **patterns, int n_patterns, long text_length) {
+  /** @brief Estimates the cost of searching the patterns in a text: the hash
+   * of every window is computed from scratch, so a pattern costs one hash of
+   * its length for every window of the text.
+   * @return The cost (in processed bytes).
+   */
+  double res = 0;
+  for (int i = 0; i < n_patterns; i++) {
+    long pattern_length = strlen(patterns[i]);
+    if (pattern_length <= text_length) {
+      res += (double)(text_length - pattern_length + 1) * pattern_length;
+    }
+  }
+
+  return res;
+}
+
+static int cmp_task_costs(const void *a, const void *b) {
+  const task_cost_t *costA = (const task_cost_t *)a;
+  const task_cost_t *costB = (const task_cost_t *)b;
+
+  if (costA->cost != costB->cost) {
+    return costA->cost < costB->cost ? 1 : -1;
+  }
+
+  return costA->task_id - costB->task_id;
+}
+
+static void compute_task_order(task_queue_t *queue, input_t **inputs,
+                               MPI_Comm comm) {
+  /** @brief Computes the order in which the tasks are handed out (collective
+   * over comm): the most expensive first (longest processing time first), so
+   * that the last tasks grabbed are short and no worker is left with a large
+   * one while the others idle.
+   */
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  queue->order = (int *)(malloc(queue->n_tasks * sizeof(int)));
+  if (queue->order == NULL) {
+    perror("Error allocating memory for task order");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+
+  if (rank == queue->root) {
+    task_cost_t *costs =
+        (task_cost_t *)(malloc(queue->n_tasks * sizeof(task_cost_t)));
+    if (costs == NULL) {
+      perror("Error allocating memory for task costs");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < queue->n_tasks; i++) {
+      costs[i].task_id = i;
+
+      if (queue->local_dir != NULL) {
+        // The texts are not read by root, only their lengths are needed
+        char path[MAX_FILE_PATH];
+        long text_offset, text_length;
+        snprintf(path, MAX_FILE_PATH, "%s/test%d.in", queue->local_dir, i);
+
+        input_t *header =
+            parse_input_file_header(path, &text_offset, &text_length);
+        if (header == NULL) {
+          MPI_Abort(comm, EXIT_FAILURE);
+        }
+        costs[i].cost = estimate_task_cost(header->patterns,
+                                           header->n_patterns, text_length);
+        free_input_struct(header);
+      } else {
+        costs[i].cost =
+            estimate_task_cost(inputs[i]->patterns, inputs[i]->n_patterns,
+                               strlen(inputs[i]->text));
+      }
+    }
+
+    qsort(costs, queue->n_tasks, sizeof(task_cost_t), cmp_task_costs);
+    for (int i = 0; i < queue->n_tasks; i++) {
+      queue->order[i] = costs[i].task_id;
+    }
+
+    free(costs);
+  }
+
+  MPI_Bcast(queue->order, queue->n_tasks, MPI_INT, queue->root, comm);
+}
+
+static char *compress_text(const char *text, int text_length,
+                           int *compressed_length) {
+  /** @brief Compresses a text, if it is worth it (see COMPRESSION_MAX_RATIO);
+   * the ratio is first estimated on a sample, so that incompressible texts
+   * are given up quickly.
+   * @param compressed_length The length of the compressed text (output).
+   * @return The compressed text (free it with free), NULL if the text is not
+   * worth compressing.
+   */
+  int sample_length = text_length < COMPRESSION_SAMPLE_LENGTH
+                          ? text_length
+                          : COMPRESSION_SAMPLE_LENGTH;
+  int capacity = (int)(text_length * COMPRESSION_MAX_RATIO);
+  if (sample_length == 0 || capacity <= 0) {
+    return NULL;
+  }
+
+  char *res = (char *)(malloc(capacity));
+  if (res == NULL) {
+    return NULL;
+  }
+
+  if (lz_compress(text, sample_length, res,
+                  (int)(sample_length * COMPRESSION_MAX_RATIO)) == -1) {
+    free(res);
+    return NULL;
+  }
+
+  *compressed_length = lz_compress(text, text_length, res, capacity);
+  if (*compressed_length == -1) {
+    free(res);
+    return NULL;
+  }
+
+  return res;
+}
+
+task_queue_t *create_task_queue(input_t **inputs, const char *local_dir,
+                                int n_tasks, int root, MPI_Comm comm) {
+  /** @brief Creates the task queue (collective over comm). The root packs all
+   * the tasks in a blob and exposes it, together with the task counter, in
+   * RMA windows; the descriptors are broadcasted to every rank. The blob is
+   * allocated in shared memory, so the ranks co-located with root read the
+   * tasks in place instead of receiving a private copy.
+   * @param inputs The tasks (only significant at root, unused if local_dir is
+   * not NULL).
+   * @param local_dir The directory where every rank reads the tasks from
+   * (NULL if the tasks are exposed by root).
+   * @param n_tasks The number of tasks.
+   * @return The task queue.
+   */
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  task_queue_t *queue = (task_queue_t *)(malloc(sizeof(task_queue_t)));
+  if (queue == NULL) {
+    perror("Error allocating memory for task queue");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+
+  queue->n_tasks = n_tasks;
+  queue->root = root;
+  queue->local_dir = local_dir;
+  queue->node_comm = create_node_comm(comm);
+  queue->blob = NULL;
+  queue->shared_blob = NULL;
+  queue->tasks = (task_desc_t *)(malloc((n_tasks + 1) * sizeof(task_desc_t)));
+  if (queue->tasks == NULL) {
+    perror("Error allocating memory for task descriptors");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+
+  compute_task_order(queue, inputs, comm);
+
+  // Only the task counter is needed when the tasks are read locally
+  if (local_dir != NULL) {
+    create_task_counter(queue, comm);
+    return queue;
+  }
+
+  // The texts are only compressed for the ranks on other nodes, if any
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+  int compress = queue->node_comm->node_size < comm_size;
+
+  MPI_Aint blob_size = 0;
+  char **compressed_texts = NULL;
+  if (rank == root) {
+    compressed_texts = (char **)(calloc(n_tasks, sizeof(char *)));
+    if (compressed_texts == NULL) {
+      perror("Error allocating memory for compressed texts");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    // Compute the layout of the blob...
+    for (int i = 0; i < n_tasks; i++) {
+      task_desc_t *task = &queue->tasks[i];
+
+      task->text_offset = blob_size;
+      task->text_length = strlen(inputs[i]->text);
+      blob_size += task->text_length + 1;
+
+      task->patterns_offset = blob_size;
+      task->patterns_length = 0;
+      task->n_patterns = inputs[i]->n_patterns;
+      for (int j = 0; j < task->n_patterns; j++) {
+        task->patterns_length += strlen(inputs[i]->patterns[j]) + 1;
+      }
+      blob_size += task->patterns_length;
+
+      task->compressed_offset = blob_size;
+      task->compressed_length = 0;
+      if (compress) {
+        compressed_texts[i] = compress_text(
+            inputs[i]->text, task->text_length, &task->compressed_length);
+      }
+      blob_size += task->compressed_length;
+    }
+  }
+
+  MPI_Bcast(queue->tasks, n_tasks * sizeof(task_desc_t), MPI_BYTE, root, comm);
+
+  // The blob lives in shared memory, so the ranks on the same node as root
+  // read the tasks in place, without any copy
+  char *blob;
+  MPI_Win_allocate_shared(rank == root ? blob_size : 0, 1, MPI_INFO_NULL,
+                          queue->node_comm->node, &blob, &queue->shared_win);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, queue->shared_win);
+
+  int node_root = translate_rank(root, comm, queue->node_comm->node);
+  if (node_root != MPI_UNDEFINED) {
+    MPI_Aint size;
+    int disp_unit;
+    MPI_Win_shared_query(queue->shared_win, node_root, &size, &disp_unit,
+                         &queue->shared_blob);
+  }
+
+  if (rank == root) {
+    // ...and fill it
+    queue->blob = blob;
+    for (int i = 0; i < n_tasks; i++) {
+      task_desc_t *task = &queue->tasks[i];
+      memcpy(queue->blob + task->text_offset, inputs[i]->text,
+             task->text_length + 1);
+
+      char *patterns = queue->blob + task->patterns_offset;
+      for (int j = 0; j < task->n_patterns; j++) {
+        int pattern_length = strlen(inputs[i]->patterns[j]) + 1;
+        memcpy(patterns, inputs[i]->patterns[j], pattern_length);
+        patterns += pattern_length;
+      }
+
+      if (compressed_texts[i] != NULL) {
+        memcpy(queue->blob + task->compressed_offset, compressed_texts[i],
+               task->compressed_length);
+        free(compressed_texts[i]);
+      }
+    }
+
+    free(compressed_texts);
+  }
+
+  MPI_Win_sync(queue->shared_win);
+
+  // The ranks on the other nodes read the tasks through a regular window
+  MPI_Win_create(queue->blob, rank == root ? blob_size : 0, 1, MPI_INFO_NULL,
+                 comm, &queue->blob_win);
+  create_task_counter(queue, comm);
+
+  // Nobody reads a task before the blob is initialized
+  MPI_Win_sync(queue->shared_win);
+
+  // The blob window is only accessed in passive target mode too, which allows
+  // request-based reads (MPI_Rget) of the tasks
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, queue->blob_win);
+
+  return queue;
+}
+
+int next_task(task_queue_t *queue) {
+  /** @brief Grabs the next task, by atomically incrementing the task counter
+   * of the root; no message is exchanged with the root process itself. The
+   * counter indexes the task order, so the most expensive tasks go first.
+   * @return The id of the task, -1 if there are no more tasks.
+   */
+  const int one = 1;
+  int task_idx;
+
+  MPI_Fetch_and_op(&one, &task_idx, MPI_INT, queue->root, 0, MPI_SUM,
+                   queue->counter_win);
+  MPI_Win_flush(queue->root, queue->counter_win);
+
+  return task_idx < queue->n_tasks ? queue->order[task_idx] : -1;
+}
+
+void prefetch_task(task_queue_t *queue, int task_id, pending_task_t *pending) {
+  /** @brief Starts reading the text and the patterns of a task from the blob
+   * of the root, without waiting for them (see wait_task).
+   * @param task_id The id of the task (as returned by next_task).
+   * @param pending The in flight task (output).
+   */
+  task_desc_t *task = &queue->tasks[task_id];
+
+  pending->task_id = task_id;
+
+  if (queue->local_dir != NULL) {
+    // The file is read by wait_task; just let the kernel read it ahead
+    char path[MAX_FILE_PATH];
+    snprintf(path, MAX_FILE_PATH, "%s/test%d.in", queue->local_dir, task_id);
+
+    int fd = open(path, O_RDONLY);
+    if (fd != -1) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+      close(fd);
+    }
+    return;
+  }
+
+  // Nothing to read, the task is read in place from shared memory
+  if (queue->shared_blob != NULL) {
+    pending->requests[0] = pending->requests[1] = MPI_REQUEST_NULL;
+    return;
+  }
+
+  // Read the compressed text instead of the text, if there is one
+  int text_length = task->compressed_length > 0 ? task->compressed_length
+                                                : task->text_length;
+  MPI_Aint text_offset = task->compressed_length > 0 ? task->compressed_offset
+                                                     : task->text_offset;
+
+  pending->text = (char *)(malloc(text_length + 1));
+  pending->patterns = (char *)(malloc(task->patterns_length + 1));
+  if (pending->text == NULL || pending->patterns == NULL) {
+    perror("Error allocating memory for task");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  MPI_Rget(pending->text, text_length, MPI_CHAR, queue->root, text_offset,
+           text_length, MPI_CHAR, queue->blob_win, &pending->requests[0]);
+  MPI_Rget(pending->patterns, task->patterns_length, MPI_CHAR, queue->root,
+           task->patterns_offset, task->patterns_length, MPI_CHAR,
+           queue->blob_win, &pending->requests[1]);
+}
+
+input_t *wait_task(task_queue_t *queue, pending_task_t *pending) {
+  /** @brief Waits for an in flight task to be read.
+   * @param pending The in flight task (see prefetch_task).
+   * @return The task, as an input_t struct (free it with release_task).
+   */
+  if (queue->local_dir != NULL) {
+    char path[MAX_FILE_PATH];
+    snprintf(path, MAX_FILE_PATH, "%s/test%d.in", queue->local_dir,
+             pending->task_id);
+
+    input_t *res = parse_input_file(path);
+    if (res == NULL) {
+      fprintf(stderr, "Error reading task %s\n", path);
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    return res;
+  }
+
+  task_desc_t *task = &queue->tasks[pending->task_id];
+
+  MPI_Waitall(2, pending->requests, MPI_STATUSES_IGNORE);
+
+  input_t *res = (input_t *)(malloc(sizeof(input_t)));
+  if (res == NULL) {
+    perror("Error allocating memory for task");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  res->pattern_lengths = NULL;
+  res->pattern_fingerprints = NULL;
+
+  if (queue->shared_blob != NULL) {
+    // Point straight into the shared blob
+    res->text = queue->shared_blob + task->text_offset;
+    res->pattern_data = NULL;
+    res->n_patterns = task->n_patterns;
+    res->patterns = (char **)(malloc(task->n_patterns * sizeof(char *)));
+    if (res->patterns == NULL) {
+      perror("Error allocating memory for patterns array");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    char *pattern = queue->shared_blob + task->patterns_offset;
+    for (int i = 0; i < task->n_patterns; i++) {
+      res->patterns[i] = pattern;
+      pattern += strlen(pattern) + 1;
+    }
+
+    return res;
+  }
+
+  if (task->compressed_length > 0) {
+    char *text = (char *)(malloc(task->text_length + 1));
+    if (text == NULL) {
+      perror("Error allocating memory for text");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    if (lz_decompress(pending->text, task->compressed_length, text,
+                      task->text_length) == -1) {
+      fprintf(stderr, "Error decompressing task %d\n", pending->task_id);
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    free(pending->text);
+    pending->text = text;
+  }
+
+  // Place the null terminator at the end of the text
+  pending->text[task->text_length] = '\0';
+  res->text = pending->text;
+
+  res->n_patterns = task->n_patterns;
+  res->patterns = (char **)(malloc(task->n_patterns * sizeof(char *)));
+  if (res->patterns == NULL) {
+    perror("Error allocating memory for patterns array");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  // The patterns stay in the block they were received in
+  res->pattern_data = pending->patterns;
+  char *pattern = pending->patterns;
+  for (int i = 0; i < task->n_patterns; i++) {
+    res->patterns[i] = pattern;
+    pattern += strlen(pattern) + 1;
+  }
+
+  return res;
+}
+
+void release_task(task_queue_t *queue, input_t *input) {
+  /** @brief Frees a task returned by wait_task.
+   */
+  if (queue->local_dir == NULL && queue->shared_blob != NULL) {
+    // The text and the patterns belong to the shared blob
+    free(input->patterns);
+    free(input);
+  } else {
+    free_input_struct(input);
+  }
+}
+
+void destroy_task_queue(task_queue_t *queue) {
+  /** @brief Frees the task queue (collective, so it also waits for all the
+   * ranks to be done with it).
+   */
+  MPI_Win_unlock_all(queue->counter_win);
+  MPI_Win_free(&queue->counter_win);
+
+  if (queue->local_dir == NULL) {
+    MPI_Win_unlock_all(queue->blob_win);
+    MPI_Win_unlock_all(queue->shared_win);
+    MPI_Win_free(&queue->blob_win);
+    MPI_Win_free(&queue->shared_win);
+  }
+
+  destroy_node_comm(queue->node_comm);
+  free(queue->order);
+  free(queue->tasks);
+  free(queue);
+}
+
+char *pack_output(int task_id, output_t *output, query_t *query, int *size) {
+  /** @brief Packs the results of a task in a single buffer, so that they can be
+   * sent with a single (nonblocking) message. The layout is: task_id,
+   * n_patterns and, for each pattern, its length, its number of occurrences,
+   * its number of indexes (none for QUERY_COUNT), the pattern itself and its
+   * indexes.
+   * @param size The size of the buffer, in bytes (output).
+   * @return The buffer (free it with free).
+   */
+  int n_patterns = output->n_patterns;
+
+  *size = 2 * sizeof(int);
+  for (int i = 0; i < n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    *size += 3 * sizeof(int) + strlen(pattern_w_idx->pattern) +
+             count_stored_indexes(pattern_w_idx, query) * sizeof(int);
+  }
+
+  char *res = (char *)(malloc(*size));
+  if (res == NULL) {
+    perror("Error allocating memory for packed output");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  char *ptr = res;
+  memcpy(ptr, &task_id, sizeof(int));
+  ptr += sizeof(int);
+  memcpy(ptr, &n_patterns, sizeof(int));
+  ptr += sizeof(int);
+
+  for (int i = 0; i < n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    int pattern_length = strlen(pattern_w_idx->pattern);
+    int n_indexes = count_stored_indexes(pattern_w_idx, query);
+
+    memcpy(ptr, &pattern_length, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(ptr, &pattern_w_idx->len, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(ptr, &n_indexes, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(ptr, pattern_w_idx->pattern, pattern_length);
+    ptr += pattern_length;
+    memcpy(ptr, pattern_w_idx->indexes, n_indexes * sizeof(int));
+    ptr += n_indexes * sizeof(int);
+  }
+
+  return res;
+}
+
+output_t *unpack_output(char *buffer, int *task_id, int *size) {
+  /** @brief Unpacks the results of a task packed with pack_output.
+   * @param task_id The id of the task (output).
+   * @param size The number of bytes unpacked from buffer (output).
+   * @return The results, as an output_t struct.
+   */
+  int n_patterns;
+
+  char *ptr = buffer;
+  memcpy(task_id, ptr, sizeof(int));
+  ptr += sizeof(int);
+  memcpy(&n_patterns, ptr, sizeof(int));
+  ptr += sizeof(int);
+
+  output_t *res = alloc_output_struct(n_patterns);
+  if (res == NULL) {
+    perror("Error allocating memory for output");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = res->identified_patterns[i];
+    int pattern_length, n_indexes;
+
+    memcpy(&pattern_length, ptr, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(&pattern_w_idx->len, ptr, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(&n_indexes, ptr, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(pattern_w_idx->pattern, ptr, pattern_length);
+    pattern_w_idx->pattern[pattern_length] = '\0';
+    ptr += pattern_length;
+    memcpy(pattern_w_idx->indexes, ptr, n_indexes * sizeof(int));
+    ptr += n_indexes * sizeof(int);
+  }
+
+  *size = ptr - buffer;
+
+  return res;
+}
+
+output_t **scatter_refs(output_t **refs, int n_tasks, int first_reducer,
+                        int n_reducers, int root, MPI_Comm comm) {
+  /** @brief Sends the ref of every task from root to the reducer which checks
+   * it (see count_reducer_tasks), so that only root reads the refs (e.g. from
+   * its corpus); collective over comm. The refs of a reducer are packed with
+   * pack_output, one after the other, and all the refs are sent with a single
+   * scatter.
+   * @param refs The refs of all the tasks (only significant at root).
+   * @param first_reducer The rank of the first reducer (reducer i is rank
+   * first_reducer + i).
+   * @return At a reducer, its refs by task id (NULL for the tasks of the other
+   * reducers; free it with free, and the refs with free_output_struct); NULL
+   * at the other ranks.
+   */
+  int rank, n_ranks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &n_ranks);
+
+  int *counts = NULL, *displacements = NULL;
+  char *packed = NULL;
+  query_t query = {QUERY_ALL, 0};
+  if (rank == root) {
+    counts = (int *)(calloc(n_ranks, sizeof(int)));
+    displacements = (int *)(calloc(n_ranks, sizeof(int)));
+    char **packed_refs = (char **)(malloc((n_tasks + 1) * sizeof(char *)));
+    int *sizes = (int *)(malloc((n_tasks + 1) * sizeof(int)));
+    if (counts == NULL || displacements == NULL || packed_refs == NULL ||
+        sizes == NULL) {
+      perror("Error allocating memory for refs");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    int total = 0;
+    for (int i = 0; i < n_tasks; i++) {
+      packed_refs[i] = pack_output(i, refs[i], &query, &sizes[i]);
+      counts[first_reducer + i % n_reducers] += sizes[i];
+      total += sizes[i];
+    }
+    for (int r = 1; r < n_ranks; r++) {
+      displacements[r] = displacements[r - 1] + counts[r - 1];
+    }
+
+    packed = (char *)(malloc(total + 1));
+    if (packed == NULL) {
+      perror("Error allocating memory for refs");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+    int *fill = (int *)(calloc(n_ranks, sizeof(int)));
+    if (fill == NULL) {
+      perror("Error allocating memory for refs");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+    for (int i = 0; i < n_tasks; i++) {
+      int reducer = first_reducer + i % n_reducers;
+      memcpy(packed + displacements[reducer] + fill[reducer], packed_refs[i],
+             sizes[i]);
+      fill[reducer] += sizes[i];
+      free(packed_refs[i]);
+    }
+    free(fill);
+    free(packed_refs);
+    free(sizes);
+  }
+
+  int count;
+  MPI_Scatter(counts, 1, MPI_INT, &count, 1, MPI_INT, root, comm);
+  char *local = (char *)(malloc(count + 1));
+  if (local == NULL) {
+    perror("Error allocating memory for refs");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+  MPI_Scatterv(packed, counts, displacements, MPI_BYTE, local, count,
+               MPI_BYTE, root, comm);
+  free(packed);
+  free(counts);
+  free(displacements);
+
+  int reducer_idx = rank - first_reducer;
+  output_t **res = NULL;
+  if (reducer_idx >= 0 && reducer_idx < n_reducers) {
+    res = (output_t **)(calloc(n_tasks + 1, sizeof(output_t *)));
+    if (res == NULL) {
+      perror("Error allocating memory for refs");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+    for (int offset = 0; offset < count;) {
+      int task_id, size;
+      output_t *ref = unpack_output(local + offset, &task_id, &size);
+      res[task_id] = ref;
+      offset += size;
+    }
+  }
+  free(local);
+
+  return res;
+}
+
+MPI_Aint max_packed_output_size(char **patterns, int n_patterns,
+                                int text_length) {
+  /** @brief Computes an upper bound of the size of the results of a task, as
+   * packed by pack_output.
+   * @return The size, in bytes.
+   */
+  MPI_Aint res = 2 * sizeof(int);
+  for (int i = 0; i < n_patterns; i++) {
+    int pattern_length = strlen(patterns[i]);
+    int max_occurrences = text_length - pattern_length + 1;
+    if (max_occurrences < 0) {
+      max_occurrences = 0;
+    }
+    if (max_occurrences > MAX_FOUND_PATTERNS) {
+      max_occurrences = MAX_FOUND_PATTERNS;
+    }
+
+    res += 3 * sizeof(int) + pattern_length + max_occurrences * sizeof(int);
+  }
+
+  return res;
+}
+
+MPI_Aint scatter_result_capacities(input_t **inputs, const char *local_dir,
+                                   int n_tasks, int first_reducer,
+                                   int n_reducers, int root, MPI_Comm comm) {
+  /** @brief Sizes the result store of every reducer for the results of all
+   * its tasks (see count_reducer_tasks), at root, which has the inputs, and
+   * sends each rank its size with a single scatter (collective over comm).
+   * @param inputs The tasks (only significant at root); with local_dir, only
+   * root reads the headers of the test files, for the lengths of the texts.
+   * @param first_reducer The rank of the first reducer (reducer i is rank
+   * first_reducer + i).
+   * @return The size of the result store of the current rank, in bytes (0
+   * for the ranks which are not reducers).
+   */
+  int rank, n_ranks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &n_ranks);
+
+  MPI_Aint *capacities = NULL;
+  if (rank == root) {
+    capacities = (MPI_Aint *)(calloc(n_ranks, sizeof(MPI_Aint)));
+    if (capacities == NULL) {
+      perror("Error allocating memory for result capacities");
+      MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n_tasks; i++) {
+      MPI_Aint size;
+      if (local_dir != NULL) {
+        char path[MAX_FILE_PATH];
+        long text_offset, text_length;
+        snprintf(path, MAX_FILE_PATH, "%s/test%d.in", local_dir, i);
+
+        input_t *header =
+            parse_input_file_header(path, &text_offset, &text_length);
+        if (header == NULL) {
+          MPI_Abort(comm, EXIT_FAILURE);
+        }
+        size = max_packed_output_size(header->patterns, header->n_patterns,
+                                      text_length);
+        free_input_struct(header);
+      } else {
+        size = max_packed_output_size(inputs[i]->patterns,
+                                      inputs[i]->n_patterns,
+                                      strlen(inputs[i]->text));
+      }
+      capacities[first_reducer + i % n_reducers] += size;
+    }
+  }
+
+  MPI_Aint res;
+  MPI_Scatter(capacities, 1, MPI_AINT, &res, 1, MPI_AINT, root, comm);
+  free(capacities);
+
+  return res;
+}
+
+result_store_t *create_result_store(MPI_Aint capacity, MPI_Comm comm) {
+  /** @brief Creates the result stores (collective over comm). Each rank
+   * exposes a window with a fill offset, followed by capacity bytes of packed
+   * results.
+   * @param capacity The size of the store of the current rank (0 if the rank
+   * does not collect results).
+   * @return The result store.
+   */
+  int rank, n_ranks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &n_ranks);
+
+  result_store_t *store = (result_store_t *)(malloc(sizeof(result_store_t)));
+  if (store == NULL) {
+    perror("Error allocating memory for result store");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+
+  store->capacities = (MPI_Aint *)(malloc(n_ranks * sizeof(MPI_Aint)));
+  if (store->capacities == NULL) {
+    perror("Error allocating memory for result store capacities");
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+  MPI_Allgather(&capacity, 1, MPI_AINT, store->capacities, 1, MPI_AINT, comm);
+
+  MPI_Aint size = capacity > 0 ? RESULT_STORE_HEADER + capacity : 0;
+  MPI_Win_allocate(size, 1, MPI_INFO_NULL, comm, &store->base, &store->win);
+
+  if (capacity > 0) {
+    MPI_Aint offset = 0;
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, store->win);
+    memcpy(store->base, &offset, sizeof(MPI_Aint));
+    MPI_Win_unlock(rank, store->win);
+  }
+
+  // Nobody deposits a result before the fill offsets are initialized
+  MPI_Barrier(comm);
+
+  // The stores are only accessed in passive target mode, so a single access
+  // epoch is opened for their whole lifetime
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, store->win);
+
+  return store;
+}
+
+void put_result(result_store_t *store, int target, char *result, int size,
+                MPI_Request *request) {
+  /** @brief Deposits packed results in the store of target: a slot is
+   * reserved by atomically advancing the fill offset of target, then the
+   * results are written there with MPI_Rput. No receive is needed at target.
+   * @param request The request of the put; result must not be freed before it
+   * completes.
+   */
+  MPI_Aint offset, increment = size;
+
+  MPI_Fetch_and_op(&increment, &offset, MPI_AINT, target, 0, MPI_SUM,
+                   store->win);
+  MPI_Win_flush(target, store->win);
+
+  // The stores are sized for the results of all their tasks, so this only
+  // happens if the bound of max_packed_output_size is wrong
+  if (offset + size > store->capacities[target]) {
+    fprintf(stderr, "Error: The result store of rank %d is full\n", target);
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  MPI_Rput(result, size, MPI_BYTE, target, RESULT_STORE_HEADER + offset, size,
+           MPI_BYTE, store->win, request);
+}
+
+char *collect_results(result_store_t *store, MPI_Comm comm) {
+  /** @brief Waits until all the results are deposited (collective over comm,
+   * to be called once every rank is done putting results).
+   * @return The packed results deposited in the store of the current rank,
+   * one after the other.
+   */
+  // Complete the puts of the current rank at their targets...
+  MPI_Win_flush_all(store->win);
+
+  // ...wait for the puts of all the other ranks...
+  MPI_Barrier(comm);
+
+  // ...and make them visible to the loads of the current rank
+  MPI_Win_sync(store->win);
+
+  return store->base + RESULT_STORE_HEADER;
+}
+
+void destroy_result_store(result_store_t *store) {
+  MPI_Win_unlock_all(store->win);
+  MPI_Win_free(&store->win);
+  free(store->capacities);
+  free(store);
+}
@@ -0,0 +1,266 @@
+#ifndef MPI_HELPERS_H__
+#define MPI_HELPERS_H__
+
+#include <mpi.h>
+
+#include "helpers.h"
+
+#define SPLIT_MODE_FLAG "--split"
+#define LOCAL_IO_FLAG "--local-io"
+#define MPI_OPTIONS_USAGE                                                      \
+  "[" SPLIT_MODE_FLAG "] [" LOCAL_IO_FLAG "] " QUERY_USAGE
+
+/**
+ * @brief The number of workers served by one reducer: the results are sharded
+ * by task id across the reducers, so that no single rank receives them all.
+ */
+#ifndef REDUCER_FANIN
+#define REDUCER_FANIN 16
+#endif
+
+/**
+ * @brief A text is only sent compressed if compressing it saves enough: the
+ * compressed size must be at most COMPRESSION_MAX_RATIO of the text, which is
+ * first estimated on its first COMPRESSION_SAMPLE_LENGTH bytes.
+ */
+#ifndef COMPRESSION_MAX_RATIO
+#define COMPRESSION_MAX_RATIO 0.8
+#endif
+#define COMPRESSION_SAMPLE_LENGTH 65536
+
+/**
+ * @brief In split mode, the ranks check whether another rank answered the
+ * query (see cancel_flag_t) every CANCEL_POLL_INTERVAL windows.
+ */
+#ifndef CANCEL_POLL_INTERVAL
+#define CANCEL_POLL_INTERVAL 4096
+#endif
+
+/**
+ * @brief Struct for handling the optional command line arguments of the MPI
+ * implementations (given after the tests directory and the number of tests).
+ * @var split_mode: Split every text across all the ranks (SPLIT_MODE_FLAG).
+ * @var local_io: Every rank reads the test files it needs on its own, instead
+ * of receiving them from the mapper (LOCAL_IO_FLAG); the tests directory must
+ * be on a filesystem shared by all the nodes.
+ * @var query: The query (see parse_query_option).
+ */
+typedef struct MpiOptions {
+  int split_mode;
+  int local_io;
+  query_t query;
+} mpi_options_t;
+
+/**
+ * @brief Struct for handling the byte range of a text searched by one rank
+ * when a single text is split across all the ranks (split mode).
+ * @var start: The offset (in the whole text) of the first byte of the range.
+ * @var owned: The number of window start positions owned by the rank.
+ * @var length: The number of bytes received by the rank; the owned bytes plus
+ * a halo of max_pattern_length - 1 bytes (clipped at the end of the text), so
+ * that windows starting near the end of the range can still be matched.
+ */
+typedef struct SplitRange {
+  int start;
+  int owned;
+  int length;
+} split_range_t;
+
+/**
+ * @brief Struct for handling the ranks sharing the same node (same memory).
+ * @var node: The communicator of the ranks on the current node.
+ * @var leaders: The communicator of the node leaders (the first rank of each
+ * node), MPI_COMM_NULL on the other ranks.
+ * @var node_rank: The rank in node.
+ * @var node_size: The number of ranks on the current node.
+ */
+typedef struct NodeComm {
+  MPI_Comm node;
+  MPI_Comm leaders;
+  int node_rank;
+  int node_size;
+} node_comm_t;
+
+/**
+ * @brief Struct for describing where a task (one test) lives in the task blob
+ * exposed by the mapper.
+ * @var text_offset: The offset of the text in the blob; the text is null
+ * terminated.
+ * @var text_length: The length of the text.
+ * @var patterns_offset: The offset of the patterns in the blob; the patterns
+ * are stored one after the other, each one null terminated.
+ * @var patterns_length: The number of bytes used by the patterns.
+ * @var n_patterns: The number of patterns.
+ * @var compressed_offset: The offset of the compressed text in the blob (see
+ * lz_compress); the ranks on other nodes read it instead of the text.
+ * @var compressed_length: The length of the compressed text, 0 if the text is
+ * not compressed.
+ */
+typedef struct TaskDescriptor {
+  MPI_Aint text_offset;
+  int text_length;
+  MPI_Aint patterns_offset;
+  int patterns_length;
+  int n_patterns;
+  MPI_Aint compressed_offset;
+  int compressed_length;
+} task_desc_t;
+
+/**
+ * @brief Struct for handling the estimated cost of a task, used for ordering
+ * the tasks.
+ * @var cost: The estimated cost (see estimate_task_cost).
+ * @var task_id: The id of the task.
+ */
+typedef struct TaskCost {
+  double cost;
+  int task_id;
+} task_cost_t;
+
+/**
+ * @brief Struct for handling the pull-based task queue: the tasks are exposed
+ * by the root in an RMA window and the workers grab the next one by atomically
+ * incrementing a counter, also exposed by the root.
+ * @var n_tasks: The number of tasks.
+ * @var tasks: The task descriptors (known by every rank).
+ * @var order: The order in which the tasks are handed out, most expensive
+ * first (known by every rank).
+ * @var root: The rank exposing the tasks.
+ * @var local_dir: If not NULL, the tasks are not exposed by root at all: only
+ * the counter is, and every rank reads the test<task_id>.in files it grabs
+ * from this directory on its own (shared filesystem).
+ * @var node_comm: The ranks on the current node.
+ * @var blob: The tasks, packed (only at root); it lives in a shared memory
+ * window, so the ranks on the same node as root read the tasks in place.
+ * @var shared_blob: The blob, as seen by a rank on the same node as root (NULL
+ * on the other nodes).
+ * @var counter: The index of the next task to be processed (only at root).
+ * @var shared_win: The shared memory window of blob (over node_comm).
+ * @var blob_win: The window exposing blob to the other nodes.
+ * @var counter_win: The window exposing counter.
+ */
+typedef struct TaskQueue {
+  int n_tasks;
+  task_desc_t *tasks;
+  int *order;
+  int root;
+  const char *local_dir;
+  node_comm_t *node_comm;
+
+  char *blob;
+  char *shared_blob;
+  int *counter;
+
+  MPI_Win shared_win;
+  MPI_Win blob_win;
+  MPI_Win counter_win;
+} task_queue_t;
+
+/**
+ * @brief Struct for handling a task whose payload is still in flight.
+ * @var task_id: The id of the task.
+ * @var text: The buffer receiving the text (compressed, if the task has a
+ * compressed text).
+ * @var patterns: The buffer receiving the (packed) patterns.
+ * @var requests: The requests of the two reads.
+ */
+typedef struct PendingTask {
+  int task_id;
+  char *text;
+  char *patterns;
+  MPI_Request requests[2];
+} pending_task_t;
+
+/**
+ * @brief Struct for handling the one-sided result collection: every collecting
+ * rank exposes a store (an RMA window) where the other ranks deposit packed
+ * results, without any matching receive.
+ * @var base: The store of the current rank: a fill offset (an MPI_Aint),
+ * followed by the packed results (RESULT_STORE_HEADER bytes in).
+ * @var capacities: The capacity of the store of every rank, in bytes.
+ * @var win: The window exposing the stores.
+ */
+typedef struct ResultStore {
+  char *base;
+  MPI_Aint *capacities;
+  MPI_Win win;
+} result_store_t;
+
+#define RESULT_STORE_HEADER ((MPI_Aint)(sizeof(MPI_Aint)))
+
+/**
+ * @brief Struct for the cooperative cancellation of the searches of split
+ * mode: the first rank which answers the query raises a flag exposed by root,
+ * and the other ranks poll it while they search.
+ * @var flag: The flag (only at root): the number of the last search whose
+ * answer is known, so that it never needs to be reset.
+ * @var search: The number of the current search.
+ * @var root: The rank exposing the flag.
+ * @var win: The window exposing the flag.
+ */
+typedef struct CancelFlag {
+  int *flag;
+  int search;
+  int root;
+  MPI_Win win;
+} cancel_flag_t;
+
+int max_pattern_length(char **patterns, int n_patterns);
+void free_patterns(char **patterns, int n_patterns);
+
+int parse_mpi_options(int argc, char *argv[], mpi_options_t *options);
+
+int translate_rank(int rank, MPI_Comm from, MPI_Comm to);
+node_comm_t *create_node_comm(MPI_Comm comm);
+void destroy_node_comm(node_comm_t *node_comm);
+
+int count_reducers(int n_ranks);
+int count_reducer_tasks(int n_tasks, int reducer_idx, int n_reducers);
+
+void compute_split_ranges(int text_length, int halo, int n_ranks,
+                          split_range_t *ranges);
+char **bcast_patterns(char **patterns, int *n_patterns, int root,
+                      MPI_Comm comm);
+char *scatter_text(char *text, int text_length, int halo, int root,
+                   MPI_Comm comm, node_comm_t *node_comm, split_range_t *range,
+                   MPI_Win *win);
+char *read_text(const char *fname, long text_offset, int text_length, int halo,
+                node_comm_t *node_comm, split_range_t *range, MPI_Win *win);
+void free_shared_text(MPI_Win *win);
+void gather_split_results(output_t *local, split_range_t *range,
+                          output_t *merged, query_t *query, int root,
+                          MPI_Comm comm);
+
+cancel_flag_t *create_cancel_flag(int root, MPI_Comm comm);
+void start_cancellable_search(cancel_flag_t *cancel);
+void raise_cancel_flag(cancel_flag_t *cancel);
+int is_cancel_flag_raised(cancel_flag_t *cancel);
+void destroy_cancel_flag(cancel_flag_t *cancel);
+
+double estimate_task_cost(char **patterns, int n_patterns, long text_length);
+void create_task_counter(task_queue_t *queue, MPI_Comm comm);
+task_queue_t *create_task_queue(input_t **inputs, const char *local_dir,
+                                int n_tasks, int root, MPI_Comm comm);
+int next_task(task_queue_t *queue);
+void prefetch_task(task_queue_t *queue, int task_id, pending_task_t *pending);
+input_t *wait_task(task_queue_t *queue, pending_task_t *pending);
+void release_task(task_queue_t *queue, input_t *input);
+void destroy_task_queue(task_queue_t *queue);
+
+char *pack_output(int task_id, output_t *output, query_t *query, int *size);
+output_t *unpack_output(char *buffer, int *task_id, int *size);
+output_t **scatter_refs(output_t **refs, int n_tasks, int first_reducer,
+                        int n_reducers, int root, MPI_Comm comm);
+MPI_Aint max_packed_output_size(char **patterns, int n_patterns,
+                                int text_length);
+
+MPI_Aint scatter_result_capacities(input_t **inputs, const char *local_dir,
+                                   int n_tasks, int first_reducer,
+                                   int n_reducers, int root, MPI_Comm comm);
+result_store_t *create_result_store(MPI_Aint capacity, MPI_Comm comm);
+void put_result(result_store_t *store, int target, char *result, int size,
+                MPI_Request *request);
+char *collect_results(result_store_t *store, MPI_Comm comm);
+void destroy_result_store(result_store_t *store);
+
+#endif
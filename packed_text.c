@@ -0,0 +1,406 @@
+#include "packed_text.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief The patterns searched together: the key of a window is its first
+ * key_length symbols (a single word), looked up in a table of the keys of the
+ * patterns; the rest of the patterns, if any, is compared word by word.
+ * @var key_length: The number of symbols of a key.
+ * @var table_size: The number of slots of the table (a power of 2).
+ * @var keys: The key of each slot.
+ * @var first_patterns: The first pattern of each slot, -1 if it is empty.
+ * @var bitmap: A bit per possible key, set for the keys of the patterns (NULL
+ * for the groups of short patterns).
+ */
+typedef struct PackedGroup {
+  size_t key_length;
+  uint32_t table_size;
+  uint64_t *keys;
+  int *first_patterns;
+  uint64_t *bitmap;
+} packed_group_t;
+
+/**
+ * @brief The encoded patterns.
+ * @var lengths: The length of each pattern, -1 if it cannot occur (it has a
+ * byte which is not in the text, or it is empty).
+ * @var words_offsets: The offset of the words of each pattern in words.
+ * @var words: The packed symbols of the patterns (each padded with a word).
+ * @var next_patterns: The next pattern with the same key, -1 at the end.
+ */
+typedef struct PackedPatterns {
+  int *lengths;
+  size_t *words_offsets;
+  uint64_t *words;
+  int *next_patterns;
+} packed_patterns_t;
+
+static uint32_t slot_index(uint64_t key, uint32_t table_size) {
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (table_size - 1);
+}
+
+static inline uint64_t symbol_mask(size_t n_symbols, int bits) {
+  return n_symbols * bits >= 64 ? UINT64_MAX
+                                : (1ULL << (n_symbols * bits)) - 1;
+}
+
+static inline uint64_t extract_symbols(const uint64_t *words, size_t start,
+                                       size_t n_symbols, int bits) {
+  /** @brief Gets the n_symbols (at most 64 / bits) symbols from start, as a
+   * word (the first one in the lowest bits).
+   */
+  int log_per_word = bits == 2 ? 5 : 4;
+  size_t word = start >> log_per_word;
+  int shift = (start & ((1 << log_per_word) - 1)) * bits;
+
+  uint64_t res = words[word] >> shift;
+  if (shift > 0) {
+    res |= words[word + 1] << (64 - shift);
+  }
+
+  return res & symbol_mask(n_symbols, bits);
+}
+
+static void pack_symbols(const uint8_t *codes, const char *str, size_t length,
+                         int bits, uint64_t *words) {
+  /** @brief Packs a string whose bytes all have a code into words (zeroed
+   * before).
+   */
+  size_t per_word = 64 / bits;
+
+  for (size_t i = 0; i < length; i++) {
+    uint64_t code = codes[(unsigned char)str[i]];
+    words[i / per_word] |= code << ((i % per_word) * bits);
+  }
+}
+
+packed_text_t *pack_text(const char *text, size_t text_length) {
+  /** @brief Packs a text, if its alphabet is small enough.
+   * @return The packed text (free it with free_packed_text), NULL if the text
+   * has more than PACKED_TEXT_MAX_SYMBOLS distinct bytes, or on failure.
+   */
+  int is_present[256] = {0};
+  for (size_t i = 0; i < text_length; i++) {
+    is_present[(unsigned char)text[i]] = 1;
+  }
+
+  packed_text_t *packed = (packed_text_t *)(malloc(sizeof(packed_text_t)));
+  if (packed == NULL) {
+    perror("Error allocating memory for packed text");
+    return NULL;
+  }
+
+  packed->n_symbols = 0;
+  for (int c = 0; c < 256; c++) {
+    packed->codes[c] =
+        is_present[c] ? packed->n_symbols++ : PACKED_TEXT_NO_CODE;
+  }
+  if (packed->n_symbols > PACKED_TEXT_MAX_SYMBOLS) {
+    free(packed);
+    return NULL;
+  }
+
+  packed->bits = packed->n_symbols <= 4 ? 2 : 4;
+  packed->length = text_length;
+  packed->n_words = (text_length + 64 / packed->bits - 1) / (64 / packed->bits);
+  packed->words = (uint64_t *)(calloc(packed->n_words + 1, sizeof(uint64_t)));
+  if (packed->words == NULL) {
+    perror("Error allocating memory for packed text");
+    free(packed);
+    return NULL;
+  }
+
+  pack_symbols(packed->codes, text, text_length, packed->bits, packed->words);
+
+  return packed;
+}
+
+void free_packed_text(packed_text_t *packed) {
+  free(packed->words);
+  free(packed);
+}
+
+static void free_packed_group(packed_group_t *group) {
+  free(group->keys);
+  free(group->first_patterns);
+  free(group->bitmap);
+}
+
+static void free_packed_patterns(packed_patterns_t *encoded) {
+  free(encoded->lengths);
+  free(encoded->words_offsets);
+  free(encoded->words);
+  free(encoded->next_patterns);
+}
+
+static int encode_patterns(packed_text_t *packed, char **patterns,
+                           int n_patterns, packed_patterns_t *encoded) {
+  /** @brief Packs the patterns the way the text is packed.
+   * @return 0 on success, -1 on failure.
+   */
+  size_t per_word = 64 / packed->bits;
+  encoded->lengths = (int *)(malloc((n_patterns + 1) * sizeof(int)));
+  encoded->words_offsets =
+      (size_t *)(malloc((n_patterns + 1) * sizeof(size_t)));
+  encoded->next_patterns = (int *)(malloc((n_patterns + 1) * sizeof(int)));
+  encoded->words = NULL;
+  if (encoded->lengths == NULL || encoded->words_offsets == NULL ||
+      encoded->next_patterns == NULL) {
+    perror("Error allocating memory for packed patterns");
+    free_packed_patterns(encoded);
+    return -1;
+  }
+
+  size_t n_words = 0;
+  for (int i = 0; i < n_patterns; i++) {
+    size_t length = strlen(patterns[i]);
+    int can_occur = length > 0 && length <= packed->length;
+    for (size_t j = 0; j < length && can_occur; j++) {
+      can_occur = packed->codes[(unsigned char)patterns[i][j]] !=
+                  PACKED_TEXT_NO_CODE;
+    }
+
+    encoded->lengths[i] = can_occur ? (int)length : -1;
+    encoded->words_offsets[i] = n_words;
+    if (can_occur) {
+      n_words += (length + per_word - 1) / per_word + 1;
+    }
+  }
+
+  encoded->words = (uint64_t *)(calloc(n_words + 1, sizeof(uint64_t)));
+  if (encoded->words == NULL) {
+    perror("Error allocating memory for packed patterns");
+    free_packed_patterns(encoded);
+    return -1;
+  }
+
+  for (int i = 0; i < n_patterns; i++) {
+    if (encoded->lengths[i] != -1) {
+      pack_symbols(packed->codes, patterns[i], encoded->lengths[i],
+                   packed->bits, encoded->words + encoded->words_offsets[i]);
+    }
+  }
+
+  return 0;
+}
+
+static int build_packed_group(packed_text_t *packed,
+                              packed_patterns_t *encoded, int *order,
+                              int n_group, size_t key_length,
+                              packed_group_t *group) {
+  /** @brief Builds the table of the keys (the first key_length symbols) of a
+   * group of patterns (order[0] to order[n_group - 1]); the patterns with the
+   * same key share a slot. The group of the long patterns also gets a bitmap
+   * of its keys.
+   * @return 0 on success, -1 on failure.
+   */
+  group->key_length = key_length;
+  group->table_size = 8;
+  while (group->table_size < 2 * (uint32_t)n_group) {
+    group->table_size *= 2;
+  }
+
+  int is_long = key_length * packed->bits == PACKED_TEXT_PREFIX_BITS;
+  group->keys = (uint64_t *)(malloc(group->table_size * sizeof(uint64_t)));
+  group->first_patterns = (int *)(malloc(group->table_size * sizeof(int)));
+  group->bitmap = is_long ? (uint64_t *)(calloc(
+                                (1 << PACKED_TEXT_PREFIX_BITS) / 64,
+                                sizeof(uint64_t)))
+                          : NULL;
+  if (group->keys == NULL || group->first_patterns == NULL ||
+      (is_long && group->bitmap == NULL)) {
+    perror("Error allocating memory for packed group");
+    free_packed_group(group);
+    return -1;
+  }
+  for (uint32_t slot = 0; slot < group->table_size; slot++) {
+    group->first_patterns[slot] = -1;
+  }
+
+  for (int i = 0; i < n_group; i++) {
+    int pattern = order[i];
+    uint64_t key =
+        extract_symbols(encoded->words + encoded->words_offsets[pattern], 0,
+                        key_length, packed->bits);
+    uint32_t slot = slot_index(key, group->table_size);
+    while (group->first_patterns[slot] != -1 && group->keys[slot] != key) {
+      slot = (slot + 1) & (group->table_size - 1);
+    }
+
+    group->keys[slot] = key;
+    encoded->next_patterns[pattern] = group->first_patterns[slot];
+    group->first_patterns[slot] = pattern;
+    if (is_long) {
+      group->bitmap[key / 64] |= 1ULL << (key % 64);
+    }
+  }
+
+  return 0;
+}
+
+static int is_packed_match(packed_text_t *packed, size_t key_length,
+                           size_t length, const uint64_t *pattern_words,
+                           size_t offset) {
+  /** @brief Compares the symbols of a pattern after its key with the text at
+   * an offset, a word at a time.
+   */
+  size_t per_word = 64 / packed->bits;
+
+  for (size_t i = key_length; i < length; i += per_word) {
+    size_t n_symbols = length - i < per_word ? length - i : per_word;
+    if (extract_symbols(packed->words, offset + i, n_symbols, packed->bits) !=
+        extract_symbols(pattern_words, i, n_symbols, packed->bits)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int search_packed_group(packed_text_t *packed,
+                               packed_patterns_t *encoded,
+                               packed_group_t *group, output_t *output,
+                               query_t *query) {
+  /** @brief Searches the patterns of a group: the key of every window is
+   * taken from the packed words (tested against the bitmap of the group, if
+   * it has one) and looked up in the table of the group.
+   * @return The number of occurrences found.
+   */
+  int n_found = 0;
+  size_t n_windows = packed->length - group->key_length + 1;
+
+  for (size_t offset = 0; offset < n_windows; offset++) {
+    uint64_t key = extract_symbols(packed->words, offset, group->key_length,
+                                   packed->bits);
+    if (group->bitmap != NULL &&
+        !(group->bitmap[key / 64] & (1ULL << (key % 64)))) {
+      continue;
+    }
+
+    uint32_t slot = slot_index(key, group->table_size);
+    while (group->first_patterns[slot] != -1 && group->keys[slot] != key) {
+      slot = (slot + 1) & (group->table_size - 1);
+    }
+
+    for (int pattern = group->first_patterns[slot]; pattern != -1;
+         pattern = encoded->next_patterns[pattern]) {
+      pattern_w_idx_t *pattern_w_idx = output->identified_patterns[pattern];
+      size_t length = encoded->lengths[pattern];
+      if (offset + length > packed->length ||
+          (int)offset > query_limit(pattern_w_idx, query) ||
+          !is_packed_match(packed, group->key_length, length,
+                           encoded->words + encoded->words_offsets[pattern],
+                           offset)) {
+        continue;
+      }
+
+      record_match(pattern_w_idx, offset, query);
+      n_found++;
+      if (query->mode == QUERY_EXISTS) {
+        return n_found;
+      }
+    }
+  }
+
+  return n_found;
+}
+
+/**
+ * @brief Struct for sorting the patterns by length.
+ */
+typedef struct PackedLength {
+  int length;
+  int pattern;
+} packed_length_t;
+
+static int cmp_packed_lengths(const void *a, const void *b) {
+  const packed_length_t *lengthA = (const packed_length_t *)a;
+  const packed_length_t *lengthB = (const packed_length_t *)b;
+
+  if (lengthA->length != lengthB->length) {
+    return lengthA->length < lengthB->length ? -1 : 1;
+  }
+
+  return lengthA->pattern < lengthB->pattern ? -1 : 1;
+}
+
+int search_packed_text(packed_text_t *packed, char **patterns, int n_patterns,
+                       output_t *output, query_t *query) {
+  /** @brief Searches patterns in a packed text, with the patterns packed the
+   * same way: the patterns shorter than a prefix (PACKED_TEXT_PREFIX_BITS
+   * bits) are grouped by length, and the key of a group is a whole pattern;
+   * all the others are searched together, with their prefix as their key,
+   * behind a bitmap of the prefixes (which stays in the caches), so the text
+   * is scanned once for all of them. The patterns with a byte which is not in
+   * the text cannot occur, and are not searched.
+   * @param output The output, with the n_patterns identified patterns
+   * allocated, filled as needed by the query.
+   * @return The number of occurrences found, -1 on failure.
+   */
+  for (int i = 0; i < n_patterns; i++) {
+    strcpy(output->identified_patterns[i]->pattern, patterns[i]);
+    output->identified_patterns[i]->len = 0;
+  }
+
+  packed_patterns_t encoded;
+  if (encode_patterns(packed, patterns, n_patterns, &encoded) != 0) {
+    return -1;
+  }
+
+  int n_searched = 0;
+  packed_length_t *lengths =
+      (packed_length_t *)(malloc((n_patterns + 1) * sizeof(packed_length_t)));
+  int *order = (int *)(malloc((n_patterns + 1) * sizeof(int)));
+  if (lengths == NULL || order == NULL) {
+    perror("Error allocating memory for packed patterns");
+    free(lengths);
+    free(order);
+    free_packed_patterns(&encoded);
+    return -1;
+  }
+  for (int i = 0; i < n_patterns; i++) {
+    if (encoded.lengths[i] != -1) {
+      lengths[n_searched].length = encoded.lengths[i];
+      lengths[n_searched++].pattern = i;
+    }
+  }
+  qsort(lengths, n_searched, sizeof(packed_length_t), cmp_packed_lengths);
+  for (int i = 0; i < n_searched; i++) {
+    order[i] = lengths[i].pattern;
+  }
+
+  int prefix_length = PACKED_TEXT_PREFIX_BITS / packed->bits;
+  int res = 0;
+  for (int start = 0, end = 0; start < n_searched && res != -1;
+       start = end) {
+    // A group per length below the prefix length, then the rest together
+    size_t key_length = lengths[start].length < prefix_length
+                            ? (size_t)lengths[start].length
+                            : (size_t)prefix_length;
+    while (end < n_searched && (lengths[end].length == lengths[start].length ||
+                                (int)key_length == prefix_length)) {
+      end++;
+    }
+
+    packed_group_t group;
+    if (build_packed_group(packed, &encoded, order + start, end - start,
+                           key_length, &group) != 0) {
+      res = -1;
+      break;
+    }
+    res += search_packed_group(packed, &encoded, &group, output, query);
+    free_packed_group(&group);
+
+    if (query->mode == QUERY_EXISTS && res > 0) {
+      break;
+    }
+  }
+
+  free(lengths);
+  free(order);
+  free_packed_patterns(&encoded);
+
+  return res;
+}
@@ -0,0 +1,61 @@
+#ifndef PACKED_TEXT_H__
+#define PACKED_TEXT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+/**
+ * @brief A packed text stores a text of a small alphabet (e.g. DNA) with 2 or
+ * 4 bits per symbol instead of a byte: symbol i is in the bits
+ * (i % n) * bits.. of word i / n, with n = 64 / bits symbols per word. The
+ * patterns are encoded the same way and searched on the packed words, so a
+ * scan reads 2 or 4 times fewer bytes; a window of up to n symbols is a
+ * single word, which is both its key in the tables and its exact comparison.
+ */
+
+/**
+ * @brief The command line option selecting the packed texts.
+ */
+#define PACKED_TEXT_FLAG "--packed"
+
+/**
+ * @brief The largest alphabet which is packed, and the code of the bytes
+ * which are not in the alphabet of a text.
+ */
+#define PACKED_TEXT_MAX_SYMBOLS 16
+#define PACKED_TEXT_NO_CODE 0xFF
+
+/**
+ * @brief The number of bits of the prefixes of the long patterns (10 symbols
+ * of 2 bits, or 5 of 4 bits), whose bitmap takes 128 KB.
+ */
+#define PACKED_TEXT_PREFIX_BITS 20
+
+/**
+ * @brief Struct for handling a packed text.
+ * @var bits: The number of bits per symbol (2 for up to 4 symbols, 4 for up
+ * to PACKED_TEXT_MAX_SYMBOLS).
+ * @var n_symbols: The number of distinct bytes of the text.
+ * @var codes: The code of each byte, PACKED_TEXT_NO_CODE if it is not in the
+ * text (the codes follow the order of the bytes).
+ * @var length: The number of symbols.
+ * @var n_words: The number of words (followed by a word of padding).
+ * @var words: The packed symbols.
+ */
+typedef struct PackedText {
+  int bits;
+  int n_symbols;
+  uint8_t codes[256];
+  size_t length;
+  size_t n_words;
+  uint64_t *words;
+} packed_text_t;
+
+packed_text_t *pack_text(const char *text, size_t text_length);
+void free_packed_text(packed_text_t *packed);
+int search_packed_text(packed_text_t *packed, char **patterns, int n_patterns,
+                       output_t *output, query_t *query);
+
+#endif
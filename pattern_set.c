@@ -0,0 +1,1183 @@
+#include "pattern_set.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "fingerprint.h"
+
+#define ALIGN_UP(x, alignment)                                                 \
+  (((x) + (alignment)-1) / (alignment) * (alignment))
+
+typedef struct PatternLength {
+  uint32_t length;
+  uint32_t pattern_id;
+  const char *pattern;
+} pattern_length_t;
+
+static uint32_t slot_index(uint64_t fingerprint, uint32_t table_size) {
+  return (uint32_t)((fingerprint * 0x9E3779B97F4A7C15ULL) >> 32) &
+         (table_size - 1);
+}
+
+static uint64_t filter_hash(uint64_t fingerprint) {
+  // Independent of the bits used by slot_index
+  fingerprint = (fingerprint ^ (fingerprint >> 29)) * 0xBF58476D1CE4E5B9ULL;
+
+  return fingerprint ^ (fingerprint >> 32);
+}
+
+static uint32_t filter_word(uint64_t fingerprint, uint32_t filter_mask) {
+  return (uint32_t)(filter_hash(fingerprint) >> 40) & filter_mask;
+}
+
+static uint64_t filter_bits(uint64_t fingerprint) {
+  /** @brief The filter is blocked: the 3 bits of a fingerprint are in the same
+   * word, so a lookup reads a single cache line.
+   */
+  uint64_t hash = filter_hash(fingerprint);
+
+  return (1ULL << (hash & 63)) | (1ULL << ((hash >> 6) & 63)) |
+         (1ULL << ((hash >> 12) & 63));
+}
+
+static int is_in_filter(const uint64_t *filter, uint32_t filter_mask,
+                        uint64_t fingerprint) {
+  uint64_t bits = filter_bits(fingerprint);
+
+  return (filter[filter_word(fingerprint, filter_mask)] & bits) == bits;
+}
+
+static uint32_t table_size_of(uint32_t n_unique) {
+  uint32_t table_size = 8;
+  while (table_size < 2 * n_unique) {
+    table_size *= 2;
+  }
+
+  return table_size;
+}
+
+static uint32_t filter_words_of(uint32_t n_unique) {
+  /** @return The number of words of the filter of a group, 0 if it has none.
+   */
+  if (n_unique < PATTERN_SET_FILTER_MIN_PATTERNS) {
+    return 0;
+  }
+
+  uint32_t n_words = 1;
+  while (n_words * 64 < n_unique * PATTERN_SET_FILTER_BITS_PER_PATTERN) {
+    n_words *= 2;
+  }
+
+  return n_words;
+}
+
+static int cmp_pattern_lengths(const void *a, const void *b) {
+  const pattern_length_t *lengthA = (const pattern_length_t *)a;
+  const pattern_length_t *lengthB = (const pattern_length_t *)b;
+
+  if (lengthA->length != lengthB->length) {
+    return lengthA->length < lengthB->length ? -1 : 1;
+  }
+
+  int res = memcmp(lengthA->pattern, lengthB->pattern, lengthA->length);
+  if (res != 0) {
+    return res;
+  }
+
+  return lengthA->pattern_id < lengthB->pattern_id ? -1 : 1;
+}
+
+static int is_first_duplicate(pattern_length_t *lengths, int i,
+                              int group_start) {
+  /** @return Whether a pattern of the sorted pattern lengths is the first of
+   * the patterns equal to it.
+   */
+  return i == group_start || memcmp(lengths[i].pattern, lengths[i - 1].pattern,
+                                    lengths[i].length) != 0;
+}
+
+static pattern_set_t *wrap_pattern_set(char *data, int mapped) {
+  pattern_set_t *set = (pattern_set_t *)(malloc(sizeof(pattern_set_t)));
+  if (set == NULL) {
+    perror("Error allocating memory for pattern set");
+    return NULL;
+  }
+
+  set->data = data;
+  set->mapped = mapped;
+  set->header = (ps_header_t *)data;
+  set->patterns = (ps_pattern_t *)(data + set->header->patterns_offset);
+  set->groups = (ps_group_t *)(data + set->header->groups_offset);
+  set->sets = (ps_set_t *)(data + set->header->sets_offset);
+
+  return set;
+}
+
+uint64_t hash_patterns(char **patterns, int n_patterns) {
+  /** @brief Hashes a pattern list (64-bit FNV-1a over the number of patterns
+   * and, for each pattern, its length and its bytes); two pattern lists with
+   * the same hash are assumed to have the same compiled pattern set.
+   * @return The hash.
+   */
+  uint64_t res = 0xcbf29ce484222325ULL;
+  const uint64_t prime = 0x100000001b3ULL;
+
+  res = (res ^ (uint32_t)n_patterns) * prime;
+  for (int i = 0; i < n_patterns; i++) {
+    uint32_t length = strlen(patterns[i]);
+    res = (res ^ length) * prime;
+    for (uint32_t j = 0; j < length; j++) {
+      res = (res ^ (unsigned char)patterns[i][j]) * prime;
+    }
+  }
+
+  return res;
+}
+
+uint64_t hash_pattern_sets(char ***pattern_lists, int *n_patterns,
+                           int n_sets) {
+  /** @brief Hashes several pattern lists: a single list has the hash of
+   * hash_patterns, and several lists are hashed together with their
+   * boundaries (64-bit FNV-1a over the number of lists and the hash of each
+   * list).
+   * @return The hash.
+   */
+  if (n_sets == 1) {
+    return hash_patterns(pattern_lists[0], n_patterns[0]);
+  }
+
+  uint64_t res = 0xcbf29ce484222325ULL;
+  const uint64_t prime = 0x100000001b3ULL;
+
+  res = (res ^ (uint32_t)n_sets) * prime;
+  for (int i = 0; i < n_sets; i++) {
+    uint64_t list_hash = hash_patterns(pattern_lists[i], n_patterns[i]);
+    for (int j = 0; j < 8; j++) {
+      res = (res ^ ((list_hash >> (8 * j)) & 0xff)) * prime;
+    }
+  }
+
+  return res;
+}
+
+pattern_set_t *compile_pattern_set(char **patterns, int n_patterns) {
+  /** @brief Compiles a pattern list: the patterns are grouped by length and the
+   * fingerprints of each group are stored in a hash table.
+   * @return The pattern set (free it with free_pattern_set), NULL on failure.
+   */
+  return compile_pattern_sets(&patterns, &n_patterns, 1);
+}
+
+static pattern_set_t *compile_pattern_lists(char ***pattern_lists,
+                                            int *n_patterns, int n_sets,
+                                            uint32_t **length_lists,
+                                            uint64_t **fingerprint_lists) {
+  /** @brief Same as compile_pattern_sets, with the lengths and the
+   * fingerprints of the patterns of each list, when they were precomputed.
+   * @param length_lists The lengths of each list (NULL, or NULL for a list,
+   * to compute them).
+   * @param fingerprint_lists The fingerprints of each list (see
+   * compute_fingerprint; NULL, or NULL for a list, to compute them).
+   */
+  int n_all_patterns = 0;
+  for (int i = 0; i < n_sets; i++) {
+    n_all_patterns += n_patterns[i];
+  }
+
+  char **patterns = (char **)(malloc((n_all_patterns + 1) * sizeof(char *)));
+  uint32_t *set_ids =
+      (uint32_t *)(malloc((n_all_patterns + 1) * sizeof(uint32_t)));
+  pattern_length_t *lengths = (pattern_length_t *)(malloc(
+      (n_all_patterns + 1) * sizeof(pattern_length_t)));
+  uint64_t *fingerprints = (uint64_t *)(malloc(
+      (n_all_patterns + 1) * sizeof(uint64_t)));
+  if (patterns == NULL || set_ids == NULL || lengths == NULL ||
+      fingerprints == NULL) {
+    perror("Error allocating memory for pattern lengths");
+    free(patterns);
+    free(set_ids);
+    free(lengths);
+    free(fingerprints);
+    return NULL;
+  }
+
+  for (int i = 0, pattern_id = 0; i < n_sets; i++) {
+    uint32_t *list_lengths = length_lists != NULL ? length_lists[i] : NULL;
+    uint64_t *list_fingerprints =
+        fingerprint_lists != NULL ? fingerprint_lists[i] : NULL;
+    for (int j = 0; j < n_patterns[i]; j++, pattern_id++) {
+      char *pattern = pattern_lists[i][j];
+      uint32_t length =
+          list_lengths != NULL ? list_lengths[j] : strlen(pattern);
+      patterns[pattern_id] = pattern;
+      set_ids[pattern_id] = i;
+      lengths[pattern_id].length = length;
+      lengths[pattern_id].pattern_id = pattern_id;
+      lengths[pattern_id].pattern = pattern;
+      fingerprints[pattern_id] = list_fingerprints != NULL
+                                     ? list_fingerprints[j]
+                                     : compute_fingerprint(pattern, length);
+    }
+  }
+
+  // Equal patterns end up next to each other, the first one first
+  qsort(lengths, n_all_patterns, sizeof(pattern_length_t), cmp_pattern_lengths);
+
+  uint32_t n_groups = 0;
+  for (int i = 0; i < n_all_patterns; i++) {
+    if (i == 0 || lengths[i].length != lengths[i - 1].length) {
+      n_groups++;
+    }
+  }
+
+  // Compute the layout: the header, the pattern table, the group table, the
+  // set table, the fingerprint tables, the filters and the patterns
+  uint64_t size = ALIGN_UP(sizeof(ps_header_t), 8);
+  uint64_t patterns_offset = size;
+  size += n_all_patterns * sizeof(ps_pattern_t);
+  uint64_t groups_offset = size;
+  size += n_groups * sizeof(ps_group_t);
+  uint64_t sets_offset = size;
+  size += n_sets * sizeof(ps_set_t);
+
+  // Two passes over the groups: the first one only computes the table and
+  // filter sizes, and the size of the distinct patterns
+  uint64_t tables_offset = size;
+  uint64_t filters_size = 0, strings_size = 0;
+  for (int i = 0, group_start = 0, n_unique = 0; i <= n_all_patterns; i++) {
+    if (i > 0 &&
+        (i == n_all_patterns || lengths[i].length != lengths[i - 1].length)) {
+      size += table_size_of(n_unique) * sizeof(ps_slot_t);
+      filters_size += filter_words_of(n_unique) * sizeof(uint64_t);
+      group_start = i;
+      n_unique = 0;
+    }
+    if (i < n_all_patterns && is_first_duplicate(lengths, i, group_start)) {
+      n_unique++;
+      strings_size += lengths[i].length + 1;
+    }
+  }
+
+  uint64_t filters_offset = size;
+  size += filters_size;
+  uint64_t strings_offset = size;
+  size += strings_size;
+  size = ALIGN_UP(size, 8);
+
+  char *data = (char *)(calloc(size, 1));
+  if (data == NULL) {
+    perror("Error allocating memory for pattern set");
+    free(patterns);
+    free(set_ids);
+    free(lengths);
+    free(fingerprints);
+    return NULL;
+  }
+
+  ps_header_t *header = (ps_header_t *)data;
+  memcpy(header->magic, PATTERN_SET_MAGIC, sizeof(header->magic));
+  header->version = PATTERN_SET_VERSION;
+  header->n_patterns = n_all_patterns;
+  header->n_groups = n_groups;
+  header->n_sets = n_sets;
+  header->content_hash = hash_pattern_sets(pattern_lists, n_patterns, n_sets);
+  header->size = size;
+  header->patterns_offset = patterns_offset;
+  header->groups_offset = groups_offset;
+  header->sets_offset = sets_offset;
+
+  pattern_set_t *set = wrap_pattern_set(data, 0);
+  if (set == NULL) {
+    free(data);
+    free(patterns);
+    free(set_ids);
+    free(lengths);
+    free(fingerprints);
+    return NULL;
+  }
+
+  // Fill the set table
+  for (int i = 0, first_pattern = 0; i < n_sets; i++) {
+    set->sets[i].first_pattern = first_pattern;
+    set->sets[i].n_patterns = n_patterns[i];
+    first_pattern += n_patterns[i];
+  }
+
+  // Fill the groups, their tables and their filters, and the pattern table;
+  // the duplicates are chained after the first one, which has the slot
+  uint64_t table_offset = tables_offset;
+  uint64_t filter_offset = filters_offset;
+  uint64_t string_offset = strings_offset;
+  for (int i = 0, group = -1, group_start = 0; i < n_all_patterns; i++) {
+    if (i == 0 || lengths[i].length != lengths[i - 1].length) {
+      ps_group_t *new_group = &set->groups[++group];
+      group_start = i;
+      new_group->length = lengths[i].length;
+      new_group->power = fingerprint_power(lengths[i].length);
+      new_group->table_offset = table_offset;
+
+      int group_end = i;
+      new_group->n_unique = 0;
+      while (group_end < n_all_patterns &&
+             lengths[group_end].length == lengths[i].length) {
+        new_group->n_unique += is_first_duplicate(lengths, group_end, i);
+        group_end++;
+      }
+      new_group->n_patterns = group_end - i;
+      new_group->table_size = table_size_of(new_group->n_unique);
+      table_offset += new_group->table_size * sizeof(ps_slot_t);
+
+      uint32_t filter_words = filter_words_of(new_group->n_unique);
+      if (filter_words > 0) {
+        new_group->filter_offset = filter_offset;
+        new_group->filter_mask = filter_words - 1;
+        filter_offset += filter_words * sizeof(uint64_t);
+      }
+
+      ps_slot_t *table = pattern_set_table(set, group);
+      for (uint32_t j = 0; j < new_group->table_size; j++) {
+        table[j].pattern_id = PATTERN_SET_EMPTY_SLOT;
+      }
+    }
+
+    uint32_t pattern_id = lengths[i].pattern_id;
+    ps_pattern_t *pattern = &set->patterns[pattern_id];
+    pattern->length = lengths[i].length;
+    pattern->group = group;
+    pattern->next_duplicate = PATTERN_SET_EMPTY_SLOT;
+    pattern->set_id = set_ids[pattern_id];
+
+    if (!is_first_duplicate(lengths, i, group_start)) {
+      // Share the pattern and the slot of the previous equal pattern
+      ps_pattern_t *previous = &set->patterns[lengths[i - 1].pattern_id];
+      previous->next_duplicate = pattern_id;
+      pattern->offset = previous->offset;
+      pattern->fingerprint = previous->fingerprint;
+      continue;
+    }
+
+    pattern->offset = string_offset;
+    pattern->fingerprint = fingerprints[pattern_id];
+    memcpy(data + string_offset, patterns[pattern_id], pattern->length + 1);
+    string_offset += pattern->length + 1;
+
+    ps_group_t *current_group = &set->groups[group];
+    ps_slot_t *table = pattern_set_table(set, group);
+    uint32_t slot = slot_index(pattern->fingerprint, current_group->table_size);
+    while (table[slot].pattern_id != PATTERN_SET_EMPTY_SLOT) {
+      slot = (slot + 1) & (current_group->table_size - 1);
+    }
+    table[slot].fingerprint = pattern->fingerprint;
+    table[slot].pattern_id = pattern_id;
+    table[slot].set_id = set_ids[pattern_id];
+
+    uint64_t *filter = pattern_set_filter(set, group);
+    if (filter != NULL) {
+      filter[filter_word(pattern->fingerprint, current_group->filter_mask)] |=
+          filter_bits(pattern->fingerprint);
+    }
+  }
+
+  free(patterns);
+  free(set_ids);
+  free(lengths);
+  free(fingerprints);
+
+  return set;
+}
+
+pattern_set_t *compile_pattern_sets(char ***pattern_lists, int *n_patterns,
+                                    int n_sets) {
+  /** @brief Compiles several pattern lists (e.g. of different users) into a
+   * single pattern set, so that a text is scanned once for all of them: the
+   * patterns are numbered list after list, and every slot of the fingerprint
+   * tables is tagged with the list of its pattern.
+   * @param n_patterns The number of patterns of each list.
+   * @return The pattern set (free it with free_pattern_set), NULL on failure.
+   */
+  return compile_pattern_lists(pattern_lists, n_patterns, n_sets, NULL, NULL);
+}
+
+int save_pattern_set(pattern_set_t *set, const char *fname) {
+  /** @brief Writes a compiled pattern set to a file (atomically, see
+   * write_file_atomically).
+   * @return 0 on success, -1 on failure.
+   */
+  return write_file_atomically(fname, set->data, set->header->size);
+}
+
+pattern_set_t *map_pattern_set(const char *fname) {
+  /** @brief Maps a compiled pattern set file in memory and checks its header.
+   * @return The pattern set (free it with free_pattern_set), NULL if the file
+   * does not exist or is not a valid pattern set.
+   */
+  size_t size;
+  char *data = map_file(fname, sizeof(ps_header_t), &size);
+  if (data == NULL) {
+    return NULL;
+  }
+
+  ps_header_t *header = (ps_header_t *)data;
+  if (memcmp(header->magic, PATTERN_SET_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != PATTERN_SET_VERSION || header->size != size ||
+      header->patterns_offset + header->n_patterns * sizeof(ps_pattern_t) >
+          header->size ||
+      header->groups_offset + header->n_groups * sizeof(ps_group_t) >
+          header->size ||
+      header->sets_offset + header->n_sets * sizeof(ps_set_t) >
+          header->size) {
+    munmap(data, size);
+    return NULL;
+  }
+
+  pattern_set_t *set = wrap_pattern_set(data, 1);
+  if (set == NULL) {
+    munmap(data, size);
+  }
+
+  return set;
+}
+
+static int is_pattern_set_of_lists(pattern_set_t *set, char ***pattern_lists,
+                                   int *n_patterns, int n_sets,
+                                   uint64_t content_hash) {
+  /** @brief Checks whether a pattern set was compiled from pattern lists.
+   * @param content_hash The hash of the pattern lists (see
+   * hash_pattern_sets).
+   */
+  int res = set->header->content_hash == content_hash &&
+            set->header->n_sets == (uint32_t)n_sets;
+  for (int i = 0; res && i < n_sets; i++) {
+    ps_set_t *current_set = &set->sets[i];
+    res = current_set->n_patterns == (uint32_t)n_patterns[i];
+    for (int j = 0; res && j < n_patterns[i]; j++) {
+      res = strcmp(pattern_set_pattern(set, current_set->first_pattern + j),
+                   pattern_lists[i][j]) == 0;
+    }
+  }
+
+  return res;
+}
+
+int is_pattern_set_of(pattern_set_t *set, char **patterns, int n_patterns,
+                      uint64_t content_hash) {
+  /** @brief Checks whether a pattern set was compiled from a pattern list.
+   * @param content_hash The hash of the pattern list (see hash_patterns).
+   */
+  return is_pattern_set_of_lists(set, &patterns, &n_patterns, 1,
+                                 content_hash);
+}
+
+pattern_set_t *load_pattern_set(char **patterns, int n_patterns,
+                                const char *cache_dir) {
+  /** @brief Gets the compiled pattern set of a pattern list: it is mapped from
+   * cache_dir (<content hash>.rkps) if it was compiled before, or else it is
+   * compiled and saved there for the next runs.
+   * @param cache_dir The cache directory (NULL to compile without caching).
+   * @return The pattern set (free it with free_pattern_set), NULL on failure.
+   */
+  return load_pattern_sets(&patterns, &n_patterns, 1, cache_dir);
+}
+
+static pattern_set_t *load_pattern_lists(char ***pattern_lists,
+                                         int *n_patterns, int n_sets,
+                                         uint32_t **length_lists,
+                                         uint64_t **fingerprint_lists,
+                                         const char *cache_dir) {
+  /** @brief Same as load_pattern_sets, with the precomputed lengths and
+   * fingerprints of the patterns (see compile_pattern_lists).
+   */
+  if (cache_dir == NULL) {
+    return compile_pattern_lists(pattern_lists, n_patterns, n_sets,
+                                 length_lists, fingerprint_lists);
+  }
+
+  uint64_t content_hash = hash_pattern_sets(pattern_lists, n_patterns, n_sets);
+  char fname[MAX_FILE_PATH];
+  snprintf(fname, MAX_FILE_PATH, "%s/%016llx" PATTERN_SET_EXTENSION, cache_dir,
+           (unsigned long long)content_hash);
+
+  pattern_set_t *set = map_pattern_set(fname);
+  if (set != NULL) {
+    // The hash only selects the file, the patterns themselves must match
+    if (is_pattern_set_of_lists(set, pattern_lists, n_patterns, n_sets,
+                                content_hash)) {
+      return set;
+    }
+    free_pattern_set(set);
+  }
+
+  set = compile_pattern_lists(pattern_lists, n_patterns, n_sets, length_lists,
+                              fingerprint_lists);
+  if (set != NULL) {
+    save_pattern_set(set, fname);
+  }
+
+  return set;
+}
+
+pattern_set_t *load_pattern_sets(char ***pattern_lists, int *n_patterns,
+                                 int n_sets, const char *cache_dir) {
+  /** @brief Same as load_pattern_set, for the pattern set of several pattern
+   * lists (see compile_pattern_sets).
+   */
+  return load_pattern_lists(pattern_lists, n_patterns, n_sets, NULL, NULL,
+                            cache_dir);
+}
+
+pattern_set_t *load_input_pattern_set(input_t *input, const char *cache_dir) {
+  /** @brief Same as load_pattern_set, for the patterns of an input: their
+   * lengths and fingerprints are not computed again when the input comes
+   * with them (e.g. from a corpus, see input_t).
+   */
+  return load_pattern_lists(&input->patterns, &input->n_patterns, 1,
+                            &input->pattern_lengths,
+                            &input->pattern_fingerprints, cache_dir);
+}
+
+void free_pattern_set(pattern_set_t *set) {
+  if (set->mapped) {
+    munmap(set->data, set->header->size);
+  } else {
+    free(set->data);
+  }
+  free(set);
+}
+
+const char *pattern_set_pattern(pattern_set_t *set, int pattern_id) {
+  return set->data + set->patterns[pattern_id].offset;
+}
+
+ps_slot_t *pattern_set_table(pattern_set_t *set, int group) {
+  return (ps_slot_t *)(set->data + set->groups[group].table_offset);
+}
+
+uint64_t *pattern_set_filter(pattern_set_t *set, int group) {
+  /** @return The Bloom filter of a group, NULL if it has none.
+   */
+  uint64_t filter_offset = set->groups[group].filter_offset;
+
+  return filter_offset != 0 ? (uint64_t *)(set->data + filter_offset) : NULL;
+}
+
+long visit_pattern_set_matches(pattern_set_t *set, const char *text,
+                               size_t text_length, size_t batch_size,
+                               ps_match_fn visit, void *arg) {
+  /** @brief Searches all the patterns of a compiled pattern set in a text: for
+   * each group, a fingerprint is rolled over the text and every window is
+   * looked up in the table of the group, then verified byte by byte. The
+   * occurrences are passed to visit as soon as they are confirmed, in batches
+   * of up to batch_size (grouped by pattern length and by increasing offset
+   * for each pattern); nothing is stored per pattern.
+   * @param batch_size At most PATTERN_SET_MATCH_BATCH; smaller batches let
+   * visit stop the search sooner.
+   * @param visit Called with each batch and arg; returns 0 to go on, anything
+   * else to stop the search.
+   * @return The number of occurrences passed to visit.
+   */
+  ps_match_t batch[PATTERN_SET_MATCH_BATCH];
+  size_t n_batched = 0;
+  long res = 0;
+  if (batch_size == 0 || batch_size > PATTERN_SET_MATCH_BATCH) {
+    batch_size = PATTERN_SET_MATCH_BATCH;
+  }
+
+  for (uint32_t group = 0; group < set->header->n_groups; group++) {
+    ps_group_t *current_group = &set->groups[group];
+    ps_slot_t *table = pattern_set_table(set, group);
+    uint64_t *filter = pattern_set_filter(set, group);
+    size_t length = current_group->length;
+    if (length == 0 || length > text_length) {
+      continue;
+    }
+
+    uint64_t fingerprint = compute_fingerprint(text, length);
+    for (size_t text_offset = 0; text_offset <= text_length - length;
+         ++text_offset) {
+      if (text_offset > 0) {
+        unsigned char out = text[text_offset - 1];
+        unsigned char in = text[text_offset + length - 1];
+        fingerprint =
+            roll_fingerprint(fingerprint, out, in, current_group->power);
+      }
+
+      if (filter != NULL &&
+          !is_in_filter(filter, current_group->filter_mask, fingerprint)) {
+        continue;
+      }
+
+      uint32_t slot = slot_index(fingerprint, current_group->table_size);
+      for (; table[slot].pattern_id != PATTERN_SET_EMPTY_SLOT;
+           slot = (slot + 1) & (current_group->table_size - 1)) {
+        uint32_t pattern_id = table[slot].pattern_id;
+        if (table[slot].fingerprint != fingerprint ||
+            memcmp(text + text_offset, pattern_set_pattern(set, pattern_id),
+                   length) != 0) {
+          continue;
+        }
+
+        // The slot stands for the pattern and its duplicates
+        for (; pattern_id != PATTERN_SET_EMPTY_SLOT;
+             pattern_id = set->patterns[pattern_id].next_duplicate) {
+          batch[n_batched].offset = text_offset;
+          batch[n_batched].pattern_id = pattern_id;
+          batch[n_batched].set_id = set->patterns[pattern_id].set_id;
+          if (++n_batched == batch_size) {
+            res += n_batched;
+            n_batched = 0;
+            if (visit(batch, batch_size, arg) != 0) {
+              return res;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (n_batched > 0) {
+    res += n_batched;
+    visit(batch, n_batched, arg);
+  }
+
+  return res;
+}
+
+/**
+ * @brief Struct for recording the occurrences of a search in an output.
+ * @var output: The output.
+ * @var query: The query.
+ * @var n_answered: The number of patterns whose first k occurrences are known
+ * (QUERY_FIRST).
+ */
+typedef struct QueryOutput {
+  output_t *output;
+  query_t *query;
+  int n_answered;
+} query_output_t;
+
+static int record_to_output(const ps_match_t *matches, size_t n_matches,
+                            void *arg) {
+  query_output_t *query_output = (query_output_t *)arg;
+  query_t *query = query_output->query;
+
+  for (size_t i = 0; i < n_matches; i++) {
+    pattern_w_idx_t *pattern_w_idx =
+        query_output->output->identified_patterns[matches[i].pattern_id];
+    int was_answered = query_limit(pattern_w_idx, query) != INT_MAX;
+    record_match(pattern_w_idx, matches[i].offset, query);
+    if (!was_answered && query_limit(pattern_w_idx, query) != INT_MAX) {
+      query_output->n_answered++;
+    }
+  }
+
+  // The offsets of a pattern come in increasing order, so once every pattern
+  // has its answer the rest of the text does not matter
+  return query_output->n_answered == query_output->output->n_patterns ||
+         (query->mode == QUERY_EXISTS && query_output->n_answered > 0);
+}
+
+int search_pattern_set(pattern_set_t *set, const char *text, int text_length,
+                       output_t *output, query_t *query) {
+  /** @brief Searches all the patterns of a compiled pattern set in a text (see
+   * visit_pattern_set_matches), into an output, as needed by the query; the
+   * early exit queries get the occurrences one by one, so that the search
+   * stops as soon as the answer is known.
+   * @param output The output, with the n_patterns identified patterns of the
+   * set allocated.
+   * @return The number of occurrences found.
+   */
+  for (uint32_t i = 0; i < set->header->n_patterns; i++) {
+    strcpy(output->identified_patterns[i]->pattern,
+           pattern_set_pattern(set, i));
+    output->identified_patterns[i]->len = 0;
+  }
+
+  query_output_t query_output = {output, query, 0};
+  int is_early_exit =
+      query->mode == QUERY_EXISTS || query->mode == QUERY_FIRST;
+
+  return visit_pattern_set_matches(
+      set, text, text_length, is_early_exit ? 1 : PATTERN_SET_MATCH_BATCH,
+      record_to_output, &query_output);
+}
+
+/**
+ * @brief Struct for splitting the occurrences of a search by pattern list.
+ * @var set: The pattern set.
+ * @var outputs: The output of each pattern list.
+ */
+typedef struct SplitOutputs {
+  pattern_set_t *set;
+  output_t **outputs;
+} split_outputs_t;
+
+static int split_to_outputs(const ps_match_t *matches, size_t n_matches,
+                            void *arg) {
+  split_outputs_t *split = (split_outputs_t *)arg;
+
+  for (size_t i = 0; i < n_matches; i++) {
+    uint32_t set_id = matches[i].set_id;
+    uint32_t first_pattern = split->set->sets[set_id].first_pattern;
+    pattern_w_idx_t *pattern_w_idx =
+        split->outputs[set_id]
+            ->identified_patterns[matches[i].pattern_id - first_pattern];
+    if (pattern_w_idx->len < MAX_FOUND_PATTERNS) {
+      pattern_w_idx->indexes[pattern_w_idx->len++] = matches[i].offset;
+    }
+  }
+
+  return 0;
+}
+
+int search_pattern_sets(pattern_set_t *set, const char *text, int text_length,
+                        output_t **outputs) {
+  /** @brief Searches all the pattern lists of a pattern set (see
+   * compile_pattern_sets) in a text, with a single scan; the occurrences are
+   * split by the set id of their slots, into an output per pattern list.
+   * @param outputs The output of each pattern list, with its identified
+   * patterns allocated.
+   * @return The total number of occurrences.
+   */
+  for (uint32_t i = 0; i < set->header->n_sets; i++) {
+    ps_set_t *current_set = &set->sets[i];
+    for (uint32_t j = 0; j < current_set->n_patterns; j++) {
+      pattern_w_idx_t *pattern_w_idx = outputs[i]->identified_patterns[j];
+      strcpy(pattern_w_idx->pattern,
+             pattern_set_pattern(set, current_set->first_pattern + j));
+      pattern_w_idx->len = 0;
+    }
+  }
+
+  split_outputs_t split = {set, outputs};
+
+  return visit_pattern_set_matches(set, text, text_length,
+                                   PATTERN_SET_MATCH_BATCH, split_to_outputs,
+                                   &split);
+}
+
+/**
+ * @brief Struct for sorting the texts of a multi-text search by length.
+ */
+typedef struct TextLength {
+  size_t length;
+  uint64_t text_id;
+} text_length_t;
+
+static int cmp_text_lengths(const void *a, const void *b) {
+  const text_length_t *lengthA = (const text_length_t *)a;
+  const text_length_t *lengthB = (const text_length_t *)b;
+
+  // By decreasing length, so the texts of a block of lanes are about as long
+  if (lengthA->length != lengthB->length) {
+    return lengthA->length > lengthB->length ? -1 : 1;
+  }
+
+  return lengthA->text_id < lengthB->text_id ? -1 : 1;
+}
+
+/**
+ * @brief Struct for batching the occurrences of a multi-text search.
+ * @var matches: The batch.
+ * @var n_batched: The number of occurrences in the batch.
+ * @var batch_size: The size of a full batch.
+ * @var n_visited: The number of occurrences passed to visit.
+ * @var visit: The function called with each batch, and its argument arg.
+ */
+typedef struct TextBatch {
+  ps_text_match_t matches[PATTERN_SET_MATCH_BATCH];
+  size_t n_batched;
+  size_t batch_size;
+  long n_visited;
+  ps_text_match_fn visit;
+  void *arg;
+} text_batch_t;
+
+static unsigned int is_text_candidate(ps_group_t *group, ps_slot_t *table,
+                                      uint64_t *filter, uint64_t fingerprint) {
+  /** @return Whether a window may hold a pattern of a group: it passes the
+   * filter of the group, or else its first slot is not empty.
+   */
+  if (filter != NULL) {
+    return is_in_filter(filter, group->filter_mask, fingerprint);
+  }
+
+  return table[slot_index(fingerprint, group->table_size)].pattern_id !=
+         PATTERN_SET_EMPTY_SLOT;
+}
+
+static int check_text_window(pattern_set_t *set, uint32_t group,
+                             const char *window, uint64_t fingerprint,
+                             uint64_t offset, uint64_t text_id,
+                             text_batch_t *batch) {
+  /** @brief Looks a candidate window of a text up in the table of a group
+   * (see visit_pattern_set_matches) and batches its occurrences.
+   * @return 0 to go on, anything else if visit stopped the search.
+   */
+  ps_group_t *current_group = &set->groups[group];
+  ps_slot_t *table = pattern_set_table(set, group);
+
+  uint32_t slot = slot_index(fingerprint, current_group->table_size);
+  for (; table[slot].pattern_id != PATTERN_SET_EMPTY_SLOT;
+       slot = (slot + 1) & (current_group->table_size - 1)) {
+    uint32_t pattern_id = table[slot].pattern_id;
+    if (table[slot].fingerprint != fingerprint ||
+        memcmp(window, pattern_set_pattern(set, pattern_id),
+               current_group->length) != 0) {
+      continue;
+    }
+
+    for (; pattern_id != PATTERN_SET_EMPTY_SLOT;
+         pattern_id = set->patterns[pattern_id].next_duplicate) {
+      ps_text_match_t *match = &batch->matches[batch->n_batched];
+      match->offset = offset;
+      match->pattern_id = pattern_id;
+      match->set_id = set->patterns[pattern_id].set_id;
+      match->text_id = text_id;
+      if (++batch->n_batched == batch->batch_size) {
+        batch->n_visited += batch->n_batched;
+        batch->n_batched = 0;
+        if (batch->visit(batch->matches, batch->batch_size, batch->arg) != 0) {
+          return 1;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+static int scan_text_lanes(pattern_set_t *set, uint32_t group,
+                           const char *const *texts, text_length_t *lengths,
+                           int n_lanes, const uint64_t *removed,
+                           text_batch_t *batch) {
+  /** @brief Searches the patterns of a group in up to PATTERN_SET_LANES texts
+   * (by decreasing length): the windows they all have are scanned side by
+   * side, one fingerprint per lane, then the rest of the longer texts one by
+   * one.
+   * @param removed The removal table of the group (see removal_table).
+   * @return 0 to go on, anything else if visit stopped the search.
+   */
+  ps_group_t *current_group = &set->groups[group];
+  ps_slot_t *table = pattern_set_table(set, group);
+  uint64_t *filter = pattern_set_filter(set, group);
+  size_t length = current_group->length;
+  const char *lane_texts[PATTERN_SET_LANES];
+  size_t n_windows[PATTERN_SET_LANES];
+  uint64_t fingerprints[PATTERN_SET_LANES];
+
+  // The missing lanes of the last block repeat its last text, so that every
+  // block rolls the same number of lanes; their candidates are dropped
+  for (int lane = 0; lane < PATTERN_SET_LANES; lane++) {
+    text_length_t *text_length = &lengths[lane < n_lanes ? lane : n_lanes - 1];
+    lane_texts[lane] = texts[text_length->text_id];
+    n_windows[lane] = text_length->length - length + 1;
+    fingerprints[lane] = compute_fingerprint(lane_texts[lane], length);
+  }
+  unsigned int lanes_mask = (1U << n_lanes) - 1;
+
+  size_t n_common = n_windows[n_lanes - 1];
+  for (size_t offset = 0; offset < n_common; offset++) {
+    if (offset > 0) {
+      for (int lane = 0; lane < PATTERN_SET_LANES; lane++) {
+        const unsigned char *text = (const unsigned char *)lane_texts[lane];
+        fingerprints[lane] =
+            slide_fingerprint(fingerprints[lane], removed[text[offset - 1]],
+                              text[offset + length - 1]);
+      }
+    }
+
+    // The lanes are tested without branching, and only the candidates are
+    // looked up
+    unsigned int candidates = 0;
+    for (int lane = 0; lane < PATTERN_SET_LANES; lane++) {
+      candidates |= is_text_candidate(current_group, table, filter,
+                                      fingerprints[lane])
+                    << lane;
+    }
+    candidates &= lanes_mask;
+    while (candidates != 0) {
+      int lane = __builtin_ctz(candidates);
+      candidates &= candidates - 1;
+      if (check_text_window(set, group, lane_texts[lane] + offset,
+                            fingerprints[lane], offset,
+                            lengths[lane].text_id, batch) != 0) {
+        return 1;
+      }
+    }
+  }
+
+  for (int lane = 0; lane < n_lanes - 1; lane++) {
+    const unsigned char *text = (const unsigned char *)lane_texts[lane];
+    uint64_t fingerprint = fingerprints[lane];
+    for (size_t offset = n_common; offset < n_windows[lane]; offset++) {
+      if (offset > 0) {
+        fingerprint = slide_fingerprint(fingerprint, removed[text[offset - 1]],
+                                        text[offset + length - 1]);
+      }
+      if (is_text_candidate(current_group, table, filter, fingerprint) &&
+          check_text_window(set, group, lane_texts[lane] + offset,
+                            fingerprint, offset, lengths[lane].text_id,
+                            batch) != 0) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+long visit_pattern_set_texts(pattern_set_t *set, const char *const *texts,
+                             const size_t *text_lengths, size_t n_texts,
+                             size_t batch_size, ps_text_match_fn visit,
+                             void *arg) {
+  /** @brief Searches all the patterns of a compiled pattern set in many
+   * texts (e.g. short log lines), PATTERN_SET_LANES texts at a time: the
+   * texts are sorted by length, and a block of texts of about the same length
+   * is scanned side by side, so that short texts do not leave the search
+   * waiting on a single chain of rolls and lookups. The occurrences are
+   * passed to visit in batches, as by visit_pattern_set_matches (grouped by
+   * pattern length, then by block of texts, and by increasing offset for each
+   * text and pattern).
+   * @return The number of occurrences passed to visit, -1 on failure.
+   */
+  text_batch_t *batch = (text_batch_t *)(malloc(sizeof(text_batch_t)));
+  text_length_t *lengths =
+      (text_length_t *)(malloc((n_texts + 1) * sizeof(text_length_t)));
+  if (batch == NULL || lengths == NULL) {
+    perror("Error allocating memory for the texts");
+    free(batch);
+    free(lengths);
+    return -1;
+  }
+
+  for (size_t i = 0; i < n_texts; i++) {
+    lengths[i].length = text_lengths[i];
+    lengths[i].text_id = i;
+  }
+  qsort(lengths, n_texts, sizeof(text_length_t), cmp_text_lengths);
+
+  batch->n_batched = 0;
+  batch->batch_size = batch_size == 0 || batch_size > PATTERN_SET_MATCH_BATCH
+                          ? PATTERN_SET_MATCH_BATCH
+                          : batch_size;
+  batch->n_visited = 0;
+  batch->visit = visit;
+  batch->arg = arg;
+
+  uint64_t removed[256];
+  int is_stopped = 0;
+  for (uint32_t group = 0; group < set->header->n_groups && !is_stopped;
+       group++) {
+    size_t length = set->groups[group].length;
+    removal_table(set->groups[group].power, removed);
+    for (size_t first = 0; first < n_texts && !is_stopped;
+         first += PATTERN_SET_LANES) {
+      // The texts are by decreasing length, so the next ones are too short
+      if (length == 0 || lengths[first].length < length) {
+        break;
+      }
+
+      int n_lanes = 0;
+      while (n_lanes < PATTERN_SET_LANES && first + n_lanes < n_texts &&
+             lengths[first + n_lanes].length >= length) {
+        n_lanes++;
+      }
+      is_stopped = scan_text_lanes(set, group, texts, lengths + first,
+                                   n_lanes, removed, batch);
+    }
+  }
+
+  if (!is_stopped && batch->n_batched > 0) {
+    batch->n_visited += batch->n_batched;
+    visit(batch->matches, batch->n_batched, arg);
+  }
+
+  long res = batch->n_visited;
+  free(batch);
+  free(lengths);
+
+  return res;
+}
+
+static int record_to_text_outputs(const ps_text_match_t *matches,
+                                  size_t n_matches, void *arg) {
+  output_t **outputs = (output_t **)arg;
+
+  for (size_t i = 0; i < n_matches; i++) {
+    pattern_w_idx_t *pattern_w_idx =
+        outputs[matches[i].text_id]
+            ->identified_patterns[matches[i].pattern_id];
+    if (pattern_w_idx->len < MAX_FOUND_PATTERNS) {
+      pattern_w_idx->indexes[pattern_w_idx->len++] = matches[i].offset;
+    }
+  }
+
+  return 0;
+}
+
+int search_pattern_set_texts(pattern_set_t *set, input_t **inputs,
+                             int n_inputs, output_t **outputs) {
+  /** @brief Searches all the patterns of a compiled pattern set in the texts
+   * of several inputs at once (see visit_pattern_set_texts), into an output
+   * per input; the patterns of the inputs are not used.
+   * @param outputs The output of each input, with the n_patterns identified
+   * patterns of the set allocated.
+   * @return The total number of occurrences found, -1 on failure.
+   */
+  const char **texts = (const char **)(malloc((n_inputs + 1) * sizeof(char *)));
+  size_t *text_lengths = (size_t *)(malloc((n_inputs + 1) * sizeof(size_t)));
+  if (texts == NULL || text_lengths == NULL) {
+    perror("Error allocating memory for the texts");
+    free(texts);
+    free(text_lengths);
+    return -1;
+  }
+
+  for (int i = 0; i < n_inputs; i++) {
+    texts[i] = inputs[i]->text;
+    text_lengths[i] = strlen(inputs[i]->text);
+    for (uint32_t j = 0; j < set->header->n_patterns; j++) {
+      strcpy(outputs[i]->identified_patterns[j]->pattern,
+             pattern_set_pattern(set, j));
+      outputs[i]->identified_patterns[j]->len = 0;
+    }
+  }
+
+  long res = visit_pattern_set_texts(set, texts, text_lengths, n_inputs,
+                                     PATTERN_SET_MATCH_BATCH,
+                                     record_to_text_outputs, outputs);
+
+  free(texts);
+  free(text_lengths);
+
+  return res;
+}
+
+/**
+ * @brief Struct for collecting the occurrences in a match list.
+ * @var matches: The match list.
+ * @var capacity: The capacity of the match list.
+ * @var n_matches: The number of occurrences collected.
+ */
+typedef struct MatchList {
+  ps_match_t **matches;
+  size_t *capacity;
+  size_t n_matches;
+} match_list_t;
+
+static int append_to_match_list(const ps_match_t *matches, size_t n_matches,
+                                void *arg) {
+  match_list_t *list = (match_list_t *)arg;
+
+  if (list->n_matches + n_matches > *list->capacity) {
+    size_t new_capacity = *list->capacity > 0 ? 2 * *list->capacity : 64;
+    while (new_capacity < list->n_matches + n_matches) {
+      new_capacity *= 2;
+    }
+    ps_match_t *new_matches = (ps_match_t *)(realloc(
+        *list->matches, new_capacity * sizeof(ps_match_t)));
+    if (new_matches == NULL) {
+      perror("Error allocating memory for matches");
+      return -1;
+    }
+    *list->matches = new_matches;
+    *list->capacity = new_capacity;
+  }
+
+  memcpy(*list->matches + list->n_matches, matches,
+         n_matches * sizeof(ps_match_t));
+  list->n_matches += n_matches;
+
+  return 0;
+}
+
+long collect_pattern_set_matches(pattern_set_t *set, const char *text,
+                                 size_t text_length, ps_match_t **matches,
+                                 size_t *capacity) {
+  /** @brief Same as search_pattern_set, but without any limit on the number
+   * of occurrences: they are appended to a match list (see
+   * visit_pattern_set_matches for their order).
+   * @param matches The match list (input and output, grown if needed; NULL
+   * at first).
+   * @param capacity The capacity of the match list (input and output).
+   * @return The number of occurrences, -1 on failure.
+   */
+  match_list_t list = {matches, capacity, 0};
+  long res =
+      visit_pattern_set_matches(set, text, text_length, PATTERN_SET_MATCH_BATCH,
+                                append_to_match_list, &list);
+
+  return (size_t)res == list.n_matches ? res : -1;
+}
+
+int resume_pattern_set_search(pattern_set_t *set, const char *buffer,
+                              int buffer_length, int start, long base,
+                              uint64_t *fingerprints, output_t *output) {
+  /** @brief Continues the search of a compiled pattern set over a text which
+   * is read in parts: buffer holds the text from position base, the first
+   * start bytes of buffer were scanned before (at least the last
+   * length - 1 of them, for every group length) and the rest are new.
+   * @param fingerprints The fingerprint of the last length - 1 scanned bytes
+   * of each group (input and output; all 0 at the beginning of the text).
+   * @param output The output, with the n_patterns identified patterns of the
+   * set allocated; only the occurrences ending in the new bytes are appended.
+   * @return The number of new occurrences.
+   */
+  int res = 0;
+
+  for (uint32_t group = 0; group < set->header->n_groups; group++) {
+    ps_group_t *current_group = &set->groups[group];
+    ps_slot_t *table = pattern_set_table(set, group);
+    uint64_t *filter = pattern_set_filter(set, group);
+    long length = current_group->length;
+    if (length == 0) {
+      continue;
+    }
+
+    uint64_t fingerprint = fingerprints[group];
+    for (int i = start; i < buffer_length; ++i) {
+      unsigned char in = buffer[i];
+      fingerprint = append_fingerprint(fingerprint, in);
+      int text_offset = i + 1 - length;
+      if (base + i + 1 < length) {
+        continue;
+      }
+
+      int is_candidate =
+          filter == NULL ||
+          is_in_filter(filter, current_group->filter_mask, fingerprint);
+      uint32_t slot = slot_index(fingerprint, current_group->table_size);
+      for (; is_candidate && table[slot].pattern_id != PATTERN_SET_EMPTY_SLOT;
+           slot = (slot + 1) & (current_group->table_size - 1)) {
+        uint32_t pattern_id = table[slot].pattern_id;
+        if (table[slot].fingerprint != fingerprint ||
+            memcmp(buffer + text_offset, pattern_set_pattern(set, pattern_id),
+                   length) != 0) {
+          continue;
+        }
+
+        for (; pattern_id != PATTERN_SET_EMPTY_SLOT;
+             pattern_id = set->patterns[pattern_id].next_duplicate) {
+          pattern_w_idx_t *pattern_w_idx =
+              output->identified_patterns[pattern_id];
+          if (pattern_w_idx->len < MAX_FOUND_PATTERNS) {
+            pattern_w_idx->indexes[pattern_w_idx->len++] = base + text_offset;
+          }
+          res++;
+        }
+      }
+
+      // Drop the first byte of the window, for the next one
+      uint64_t removed = mul_fingerprint((unsigned char)buffer[text_offset],
+                                         current_group->power);
+      fingerprint = fingerprint >= removed
+                        ? fingerprint - removed
+                        : fingerprint + FINGERPRINT_PRIME - removed;
+    }
+    fingerprints[group] = fingerprint;
+  }
+
+  return res;
+}
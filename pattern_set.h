@@ -0,0 +1,245 @@
+#ifndef PATTERN_SET_H__
+#define PATTERN_SET_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+/**
+ * @brief A compiled pattern set is a single position independent block of
+ * memory (all the references are offsets from its beginning), so it can be
+ * written to a file as is and mapped back in memory, ready to be used.
+ */
+#define PATTERN_SET_MAGIC "RKPATSET"
+#define PATTERN_SET_VERSION 3
+#define PATTERN_SET_EXTENSION ".rkps"
+
+/**
+ * @brief The command line option selecting the compiled pattern sets, followed
+ * by the cache directory.
+ */
+#define PATTERN_CACHE_FLAG "--pattern-cache"
+
+/**
+ * @brief The marker of an empty slot of a fingerprint table (and of the end of
+ * a duplicate list).
+ */
+#define PATTERN_SET_EMPTY_SLOT UINT32_MAX
+
+/**
+ * @brief The groups of at least PATTERN_SET_FILTER_MIN_PATTERNS distinct
+ * patterns get a Bloom filter in front of their table, of
+ * PATTERN_SET_FILTER_BITS_PER_PATTERN bits per pattern (rounded up to a power
+ * of 2 words): the table of a large group does not fit in the caches, while
+ * its filter mostly does, and most windows are rejected by the filter alone.
+ */
+#define PATTERN_SET_FILTER_MIN_PATTERNS 4096
+#define PATTERN_SET_FILTER_BITS_PER_PATTERN 16
+
+/**
+ * @brief The header of a compiled pattern set.
+ * @var magic: PATTERN_SET_MAGIC (not null terminated).
+ * @var version: PATTERN_SET_VERSION.
+ * @var n_patterns: The number of patterns.
+ * @var n_groups: The number of distinct pattern lengths.
+ * @var n_sets: The number of pattern lists merged in the pattern set (see
+ * compile_pattern_sets), 1 for a single pattern list.
+ * @var content_hash: The hash of the pattern lists (see hash_pattern_sets).
+ * @var size: The size of the whole pattern set.
+ * @var patterns_offset: The offset of the pattern table (n_patterns
+ * ps_pattern_t, in the order of the pattern lists).
+ * @var groups_offset: The offset of the group table (n_groups ps_group_t,
+ * by increasing length).
+ * @var sets_offset: The offset of the set table (n_sets ps_set_t).
+ */
+typedef struct PatternSetHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_patterns;
+  uint32_t n_groups;
+  uint32_t n_sets;
+  uint64_t content_hash;
+  uint64_t size;
+  uint64_t patterns_offset;
+  uint64_t groups_offset;
+  uint64_t sets_offset;
+} ps_header_t;
+
+/**
+ * @brief An entry of the pattern table.
+ * @var offset: The offset of the pattern; the pattern is null terminated, and
+ * stored once for all its duplicates.
+ * @var length: The length of the pattern.
+ * @var group: The index of the group of the pattern.
+ * @var fingerprint: The fingerprint of the pattern (see compute_fingerprint).
+ * @var next_duplicate: The next pattern equal to this one (by increasing
+ * index), PATTERN_SET_EMPTY_SLOT if there is none: the equal patterns share
+ * the slot of the first one.
+ * @var set_id: The index of the pattern list of the pattern in the set table.
+ */
+typedef struct PatternSetPattern {
+  uint64_t offset;
+  uint32_t length;
+  uint32_t group;
+  uint64_t fingerprint;
+  uint32_t next_duplicate;
+  uint32_t set_id;
+} ps_pattern_t;
+
+/**
+ * @brief A group of patterns of the same length, searched together: a single
+ * fingerprint is rolled over the text and looked up in the table of the group.
+ * @var length: The length of the patterns.
+ * @var n_patterns: The number of patterns.
+ * @var n_unique: The number of distinct patterns.
+ * @var table_size: The number of slots of the table (a power of 2, at least
+ * twice n_unique).
+ * @var power: FINGERPRINT_BASE ^ (length - 1) (see roll_fingerprint).
+ * @var table_offset: The offset of the table (table_size ps_slot_t), with
+ * linear probing; equal patterns share a slot (see next_duplicate).
+ * @var filter_offset: The offset of the Bloom filter (filter_mask + 1
+ * uint64_t), 0 if the group has none.
+ * @var filter_mask: The number of words of the filter, minus one.
+ */
+typedef struct PatternSetGroup {
+  uint32_t length;
+  uint32_t n_patterns;
+  uint32_t n_unique;
+  uint32_t table_size;
+  uint64_t power;
+  uint64_t table_offset;
+  uint64_t filter_offset;
+  uint32_t filter_mask;
+  uint32_t reserved;
+} ps_group_t;
+
+/**
+ * @brief An entry of the set table: the patterns of a pattern list are
+ * contiguous in the pattern table.
+ * @var first_pattern: The index of its first pattern in the pattern table.
+ * @var n_patterns: The number of patterns.
+ */
+typedef struct PatternSetSet {
+  uint32_t first_pattern;
+  uint32_t n_patterns;
+} ps_set_t;
+
+/**
+ * @brief A slot of a fingerprint table.
+ * @var fingerprint: The fingerprint of the pattern.
+ * @var pattern_id: The index of the pattern in the pattern table (the first
+ * of its duplicates), PATTERN_SET_EMPTY_SLOT if the slot is empty.
+ * @var set_id: The index of the pattern list of the pattern in the set table,
+ * so that the occurrences are tagged with it for free.
+ */
+typedef struct PatternSetSlot {
+  uint64_t fingerprint;
+  uint32_t pattern_id;
+  uint32_t set_id;
+} ps_slot_t;
+
+/**
+ * @brief An occurrence of a pattern of a compiled pattern set.
+ * @var offset: The position of the occurrence in the text.
+ * @var pattern_id: The index of the pattern in the pattern table.
+ * @var set_id: The index of the pattern list of the pattern in the set table.
+ */
+typedef struct PatternSetMatch {
+  uint64_t offset;
+  uint32_t pattern_id;
+  uint32_t set_id;
+} ps_match_t;
+
+/**
+ * @brief The function called with the occurrences of a search, in batches of
+ * up to PATTERN_SET_MATCH_BATCH (see visit_pattern_set_matches).
+ */
+#define PATTERN_SET_MATCH_BATCH 256
+typedef int (*ps_match_fn)(const ps_match_t *matches, size_t n_matches,
+                           void *arg);
+
+/**
+ * @brief The number of texts searched together by visit_pattern_set_texts,
+ * one per lane: their fingerprints are rolled side by side, as independent
+ * dependency chains (in scalar code), so the latency of a roll and of a table
+ * lookup is spread over PATTERN_SET_LANES windows instead of one.
+ */
+#define PATTERN_SET_LANES 8
+
+/**
+ * @brief An occurrence of a pattern of a compiled pattern set in one of the
+ * texts of a multi-text search.
+ * @var offset: The position of the occurrence in its text.
+ * @var pattern_id: The index of the pattern in the pattern table.
+ * @var set_id: The index of the pattern list of the pattern in the set table.
+ * @var text_id: The index of the text.
+ */
+typedef struct PatternSetTextMatch {
+  uint64_t offset;
+  uint32_t pattern_id;
+  uint32_t set_id;
+  uint64_t text_id;
+} ps_text_match_t;
+
+typedef int (*ps_text_match_fn)(const ps_text_match_t *matches,
+                                size_t n_matches, void *arg);
+
+/**
+ * @brief Struct for handling a compiled pattern set.
+ * @var data: The pattern set (header first).
+ * @var mapped: Whether data is a mapping of a file (or else, malloc-ed).
+ * @var header: The header.
+ * @var patterns: The pattern table.
+ * @var groups: The group table.
+ * @var sets: The set table.
+ */
+typedef struct PatternSet {
+  char *data;
+  int mapped;
+  ps_header_t *header;
+  ps_pattern_t *patterns;
+  ps_group_t *groups;
+  ps_set_t *sets;
+} pattern_set_t;
+
+uint64_t hash_patterns(char **patterns, int n_patterns);
+uint64_t hash_pattern_sets(char ***pattern_lists, int *n_patterns, int n_sets);
+pattern_set_t *compile_pattern_set(char **patterns, int n_patterns);
+pattern_set_t *compile_pattern_sets(char ***pattern_lists, int *n_patterns,
+                                    int n_sets);
+int save_pattern_set(pattern_set_t *set, const char *fname);
+pattern_set_t *map_pattern_set(const char *fname);
+int is_pattern_set_of(pattern_set_t *set, char **patterns, int n_patterns,
+                      uint64_t content_hash);
+pattern_set_t *load_pattern_set(char **patterns, int n_patterns,
+                                const char *cache_dir);
+pattern_set_t *load_pattern_sets(char ***pattern_lists, int *n_patterns,
+                                 int n_sets, const char *cache_dir);
+pattern_set_t *load_input_pattern_set(input_t *input, const char *cache_dir);
+void free_pattern_set(pattern_set_t *set);
+
+const char *pattern_set_pattern(pattern_set_t *set, int pattern_id);
+ps_slot_t *pattern_set_table(pattern_set_t *set, int group);
+uint64_t *pattern_set_filter(pattern_set_t *set, int group);
+long visit_pattern_set_matches(pattern_set_t *set, const char *text,
+                               size_t text_length, size_t batch_size,
+                               ps_match_fn visit, void *arg);
+int search_pattern_set(pattern_set_t *set, const char *text, int text_length,
+                       output_t *output, query_t *query);
+int search_pattern_sets(pattern_set_t *set, const char *text, int text_length,
+                        output_t **outputs);
+long visit_pattern_set_texts(pattern_set_t *set, const char *const *texts,
+                             const size_t *text_lengths, size_t n_texts,
+                             size_t batch_size, ps_text_match_fn visit,
+                             void *arg);
+int search_pattern_set_texts(pattern_set_t *set, input_t **inputs,
+                             int n_inputs, output_t **outputs);
+long collect_pattern_set_matches(pattern_set_t *set, const char *text,
+                                 size_t text_length, ps_match_t **matches,
+                                 size_t *capacity);
+int resume_pattern_set_search(pattern_set_t *set, const char *buffer,
+                              int buffer_length, int start, long base,
+                              uint64_t *fingerprints, output_t *output);
+
+#endif
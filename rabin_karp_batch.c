@@ -0,0 +1,107 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "helpers.h"
+#include "pattern_set.h"
+
+void print_output(const char *fname, output_t *output) {
+  /** @brief Prints the output of a pattern list, in the format of the ref
+   * files, after a line with the name of its file.
+   */
+  printf("==> %s <==\n", fname);
+  for (int i = 0; i < output->n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    printf("%s:", pattern_w_idx->pattern);
+    for (int j = 0; j < pattern_w_idx->len; j++) {
+      printf(" %d", pattern_w_idx->indexes[j]);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  // Sanity check for arguments
+  if (argc < 3) {
+    printf("Usage: %s <text_file> <patterns_file>...\n", argv[0]);
+    return -1;
+  }
+
+  // Get arguments; the patterns files have the format of the test input
+  // files (only their patterns are read)
+  char *text_path = argv[1];
+  char **patterns_paths = argv + 2;
+  int n_sets = argc - 2;
+
+  size_t text_length;
+  char *text = map_file(text_path, 1, &text_length);
+  if (text == NULL) {
+    return -1;
+  }
+  if (text_length > INT_MAX) {
+    fprintf(stderr, "Error: the texts are limited to %d bytes\n", INT_MAX);
+    return -1;
+  }
+
+  input_t **inputs = (input_t **)(calloc(n_sets, sizeof(input_t *)));
+  char ***pattern_lists = (char ***)(malloc(n_sets * sizeof(char **)));
+  int *n_patterns = (int *)(malloc(n_sets * sizeof(int)));
+  output_t **outputs = (output_t **)(calloc(n_sets, sizeof(output_t *)));
+  if (inputs == NULL || pattern_lists == NULL || n_patterns == NULL ||
+      outputs == NULL) {
+    perror("Error allocating memory for pattern lists");
+    return -1;
+  }
+
+  int n_all_patterns = 0;
+  for (int i = 0; i < n_sets; i++) {
+    inputs[i] = parse_input_file_header(patterns_paths[i], NULL, NULL);
+    if (inputs[i] == NULL) {
+      return -1;
+    }
+    pattern_lists[i] = inputs[i]->patterns;
+    n_patterns[i] = inputs[i]->n_patterns;
+    n_all_patterns += n_patterns[i];
+
+    outputs[i] = alloc_output_struct(n_patterns[i]);
+    if (outputs[i] == NULL) {
+      perror("Error allocating memory for output");
+      return -1;
+    }
+  }
+
+  // All the pattern lists are merged into a single pattern set, so the text
+  // is scanned once; the occurrences are split by list afterwards
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pattern_set_t *set = compile_pattern_sets(pattern_lists, n_patterns, n_sets);
+  if (set == NULL) {
+    return -1;
+  }
+  int n_occurrences = search_pattern_sets(set, text, text_length, outputs);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  for (int i = 0; i < n_sets; i++) {
+    print_output(patterns_paths[i], outputs[i]);
+  }
+  fprintf(stderr,
+          "%d pattern lists (%d patterns), %zu bytes scanned once, %d "
+          "occurrences in %.6f s\n",
+          n_sets, n_all_patterns, text_length, n_occurrences,
+          (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+  free_pattern_set(set);
+  for (int i = 0; i < n_sets; i++) {
+    free_output_struct(outputs[i]);
+    free_input_struct(inputs[i]);
+  }
+  free(outputs);
+  free(n_patterns);
+  free(pattern_lists);
+  free(inputs);
+  munmap(text, text_length);
+
+  return 0;
+}
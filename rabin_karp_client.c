@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "daemon.h"
+#include "helpers.h"
+
+#define FILE_FLAG "--file"
+
+/**
+ * @brief The latency of small requests is measured by searching the first
+ * SMALL_BUFFER_LENGTH bytes of each text, SMALL_BUFFER_REPEATS times.
+ */
+#define SMALL_BUFFER_LENGTH 256
+#define SMALL_BUFFER_REPEATS 100
+
+int connect_daemon(const char *socket_path) {
+  /** @return The socket connected to the daemon, -1 on failure.
+   */
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror("Error connecting to the daemon");
+    if (fd != -1) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  return fd;
+}
+
+int compile_patterns(int fd, char **patterns, int n_patterns) {
+  /** @brief Sends a pattern list to the daemon, to be compiled.
+   * @return The id of the pattern set, -1 on failure.
+   */
+  uint32_t length = 0;
+  for (int i = 0; i < n_patterns; i++) {
+    length += strlen(patterns[i]) + 1;
+  }
+
+  char *payload = (char *)(malloc(length));
+  if (payload == NULL) {
+    perror("Error allocating memory for patterns");
+    return -1;
+  }
+
+  char *ptr = payload;
+  for (int i = 0; i < n_patterns; i++) {
+    size_t pattern_length = strlen(patterns[i]) + 1;
+    memcpy(ptr, patterns[i], pattern_length);
+    ptr += pattern_length;
+  }
+
+  daemon_message_t response;
+  char *buffer = NULL;
+  uint32_t capacity = 0;
+  int res = -1;
+  if (send_message(fd, DAEMON_COMPILE, n_patterns, payload, length) == 0 &&
+      receive_message(fd, &response, &buffer, &capacity) == 0 &&
+      response.type == DAEMON_OK) {
+    res = response.arg;
+  }
+
+  free(payload);
+  free(buffer);
+
+  return res;
+}
+
+output_t *search_daemon(int fd, uint32_t type, int set_id, char **patterns,
+                        int n_patterns, const char *payload, uint32_t length) {
+  /** @brief Sends a search request (DAEMON_SEARCH_BUFFER or
+   * DAEMON_SEARCH_FILE) and unpacks the response.
+   * @return The output, NULL on failure.
+   */
+  daemon_message_t response;
+  char *buffer = NULL;
+  uint32_t capacity = 0;
+  if (send_message(fd, type, set_id, payload, length) != 0 ||
+      receive_message(fd, &response, &buffer, &capacity) != 0 ||
+      response.type != DAEMON_OK || response.arg != (uint32_t)n_patterns) {
+    free(buffer);
+    return NULL;
+  }
+
+  output_t *output = alloc_output_struct(n_patterns);
+  if (output == NULL) {
+    free(buffer);
+    return NULL;
+  }
+
+  uint32_t *ptr = (uint32_t *)buffer;
+  uint32_t *end = ptr + response.length / sizeof(uint32_t);
+  for (int i = 0; i < n_patterns && output != NULL; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    strcpy(pattern_w_idx->pattern, patterns[i]);
+    if (ptr == end || *ptr > (uint32_t)(end - ptr - 1)) {
+      free_output_struct(output);
+      output = NULL;
+      break;
+    }
+
+    // The output keeps the first MAX_FOUND_PATTERNS occurrences
+    uint32_t count = *ptr++;
+    pattern_w_idx->len = MIN(count, MAX_FOUND_PATTERNS);
+    for (int j = 0; j < pattern_w_idx->len; j++) {
+      pattern_w_idx->indexes[j] = ptr[j];
+    }
+    ptr += count;
+  }
+  free(buffer);
+
+  return output;
+}
+
+void print_output(output_t *output) {
+  /** @brief Prints an output in the format of the ref files.
+   */
+  for (int i = 0; i < output->n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    printf("%s:", pattern_w_idx->pattern);
+    for (int j = 0; j < pattern_w_idx->len; j++) {
+      printf(" %d", pattern_w_idx->indexes[j]);
+    }
+    printf("\n");
+  }
+}
+
+int run_tests(int fd, const char *tests_directory_path, int number_of_tests) {
+  /** @brief Searches the tests of a directory through the daemon (the texts
+   * are sent as buffers) and checks the outputs against the refs.
+   */
+  input_t **inputs;
+  output_t **ref;
+  corpus_t *corpus =
+      load_tests(tests_directory_path, number_of_tests, &inputs, &ref);
+
+  double search_time = 0, small_search_time = 0;
+  for (int i = 0; i < number_of_tests; i++) {
+    int set_id = compile_patterns(fd, inputs[i]->patterns,
+                                  inputs[i]->n_patterns);
+    size_t text_length = strlen(inputs[i]->text);
+    size_t small_length = MIN(text_length, SMALL_BUFFER_LENGTH);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    output_t *output =
+        set_id == -1 ? NULL
+                     : search_daemon(fd, DAEMON_SEARCH_BUFFER, set_id,
+                                     inputs[i]->patterns,
+                                     inputs[i]->n_patterns, inputs[i]->text,
+                                     text_length);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    search_time +=
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    for (int j = 0; output != NULL && j < SMALL_BUFFER_REPEATS; j++) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      output_t *small_output = search_daemon(
+          fd, DAEMON_SEARCH_BUFFER, set_id, inputs[i]->patterns,
+          inputs[i]->n_patterns, inputs[i]->text, small_length);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      small_search_time +=
+          (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+      if (small_output == NULL) {
+        free_output_struct(output);
+        output = NULL;
+      } else {
+        free_output_struct(small_output);
+      }
+    }
+
+    if (output == NULL) {
+      fprintf(stderr, "Error searching test %d\n", i);
+      unload_tests(corpus, inputs, ref, number_of_tests);
+      return -1;
+    }
+
+    // Check correctness
+    const char *correctness =
+        check_correctness(output, ref[i]) ? "FAILED" : "PASSED";
+    printf("test %d: %s\n", i, correctness);
+
+    free_output_struct(output);
+  }
+
+  if (number_of_tests > 0) {
+    printf("mean search latency: %.1f us (whole texts), %.1f us (%d-byte "
+           "buffers)\n",
+           search_time * 1e6 / number_of_tests,
+           small_search_time * 1e6 / (number_of_tests * SMALL_BUFFER_REPEATS),
+           SMALL_BUFFER_LENGTH);
+  }
+
+  unload_tests(corpus, inputs, ref, number_of_tests);
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  // Sanity check for arguments
+  int is_file_search = argc >= 5 && strcmp(argv[2], FILE_FLAG) == 0;
+  if (argc != 4 && !is_file_search) {
+    printf("Usage: %s <socket_path> <tests_directory_path> "
+           "<number_of_tests>\n"
+           "       %s <socket_path> " FILE_FLAG " <file_path> <pattern>...\n",
+           argv[0], argv[0]);
+    return -1;
+  }
+
+  int fd = connect_daemon(argv[1]);
+  if (fd == -1) {
+    return -1;
+  }
+
+  int res = 0;
+  if (is_file_search) {
+    // The daemon reads the file itself; the paths are relative to its
+    // working directory
+    char **patterns = argv + 4;
+    int n_patterns = argc - 4;
+    for (int i = 0; i < n_patterns; i++) {
+      if (strlen(patterns[i]) >= MAX_PATTERN_LENGTH) {
+        fprintf(stderr, "Error: the patterns are limited to %d characters\n",
+                MAX_PATTERN_LENGTH - 1);
+        close(fd);
+        return -1;
+      }
+    }
+    int set_id = compile_patterns(fd, patterns, n_patterns);
+    output_t *output =
+        set_id == -1 ? NULL
+                     : search_daemon(fd, DAEMON_SEARCH_FILE, set_id, patterns,
+                                     n_patterns, argv[3], strlen(argv[3]) + 1);
+    if (output != NULL) {
+      print_output(output);
+      free_output_struct(output);
+    } else {
+      fprintf(stderr, "Error searching %s\n", argv[3]);
+      res = -1;
+    }
+  } else {
+    res = run_tests(fd, argv[2], atoi(argv[3]));
+  }
+
+  close(fd);
+
+  return res;
+}
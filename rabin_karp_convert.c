@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "corpus.h"
+#include "helpers.h"
+
+int main(int argc, char *argv[]) {
+  // Sanity check for arguments
+  if (argc != 3 && argc != 4) {
+    printf("Usage: %s <tests_directory_path> <number_of_tests> "
+           "[<corpus_file>]\n",
+           argv[0]);
+    return -1;
+  }
+
+  // Get arguments; by default, the corpus is written in the tests directory,
+  // where load_tests looks for it
+  char *tests_directory_path = argv[1];
+  int number_of_tests = atoi(argv[2]);
+
+  char corpus_path[MAX_FILE_PATH];
+  if (argc == 4) {
+    snprintf(corpus_path, MAX_FILE_PATH, "%s", argv[3]);
+  } else {
+    snprintf(corpus_path, MAX_FILE_PATH, "%s/%s", tests_directory_path,
+             CORPUS_FILE_NAME);
+  }
+
+  input_t **inputs =
+      parse_all_input_files(tests_directory_path, number_of_tests);
+
+  output_t **ref =
+      parse_all_ref_files(tests_directory_path, inputs, number_of_tests);
+
+  int res = write_corpus(corpus_path, tests_directory_path, inputs, ref,
+                         number_of_tests);
+  if (res == 0) {
+    printf("%d tests written to %s\n", number_of_tests, corpus_path);
+  }
+
+  destroy_tests(inputs, ref, number_of_tests);
+
+  return res;
+}
@@ -0,0 +1,343 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "helpers.h"
+#include "pattern_set.h"
+
+#define NUM_DAEMON_THREADS 8
+
+/**
+ * @brief Struct for the state shared by the threads of the daemon.
+ * @var listen_fd: The listening socket; every thread accepts its own
+ * connections and serves them until they are closed.
+ * @var lock: Protects the pattern sets.
+ * @var n_pattern_sets: The number of compiled pattern sets.
+ * @var pattern_sets: The compiled pattern sets (their index is their id);
+ * they are kept until the daemon stops.
+ */
+typedef struct Daemon {
+  int listen_fd;
+  pthread_mutex_t lock;
+  int n_pattern_sets;
+  pattern_set_t *pattern_sets[DAEMON_MAX_PATTERN_SETS];
+} daemon_t;
+
+/**
+ * @brief Struct for the buffers of a thread, reused from a request to the
+ * next.
+ * @var daemon: The daemon.
+ * @var matches: The match list of the current search (see
+ * collect_pattern_set_matches).
+ * @var cursors: The per pattern counters used to build the responses.
+ * @var payload: The payload of the current request.
+ * @var response: The payload of the current response (of response_capacity
+ * uint32_t).
+ */
+typedef struct DaemonWorker {
+  daemon_t *daemon;
+  ps_match_t *matches;
+  size_t match_capacity;
+  uint32_t *cursors;
+  size_t cursors_capacity;
+  char *payload;
+  uint32_t payload_capacity;
+  uint32_t *response;
+  size_t response_capacity;
+} daemon_worker_t;
+
+static const char *socket_path;
+
+static void stop_daemon(int signum) {
+  (void)signum;
+  unlink(socket_path);
+  _exit(0);
+}
+
+static int reserve_buffer(void **buffer, size_t *capacity, size_t size,
+                          size_t element_size) {
+  /** @brief Grows a buffer to at least size elements.
+   * @return 0 on success, -1 on failure.
+   */
+  if (size <= *capacity) {
+    return 0;
+  }
+
+  void *new_buffer = realloc(*buffer, size * element_size);
+  if (new_buffer == NULL) {
+    perror("Error allocating memory for buffer");
+    return -1;
+  }
+  *buffer = new_buffer;
+  *capacity = size;
+
+  return 0;
+}
+
+static int find_pattern_set(daemon_t *daemon, char **patterns, int n_patterns,
+                            uint64_t content_hash) {
+  /** @return The id of the pattern set of a pattern list, -1 if it was not
+   * compiled yet (call it with the lock held).
+   */
+  for (int i = 0; i < daemon->n_pattern_sets; i++) {
+    if (is_pattern_set_of(daemon->pattern_sets[i], patterns, n_patterns,
+                          content_hash)) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+int compile_request(daemon_t *daemon, char *payload, uint32_t length,
+                    uint32_t n_patterns) {
+  /** @brief Compiles a pattern list (or finds it, if it was compiled before).
+   * @param payload The patterns, each null terminated.
+   * @return The id of the pattern set, or minus a DAEMON_* status on failure.
+   */
+  if (n_patterns == 0 || n_patterns > length) {
+    return -DAEMON_BAD_REQUEST;
+  }
+
+  char **patterns = (char **)(malloc(n_patterns * sizeof(char *)));
+  if (patterns == NULL) {
+    return -DAEMON_SERVER_ERROR;
+  }
+
+  // The patterns are used in place
+  char *ptr = payload;
+  for (uint32_t i = 0; i < n_patterns; i++) {
+    size_t pattern_length = strnlen(ptr, payload + length - ptr);
+    if (ptr + pattern_length == payload + length) {
+      free(patterns);
+      return -DAEMON_BAD_REQUEST;
+    }
+    patterns[i] = ptr;
+    ptr += pattern_length + 1;
+  }
+
+  uint64_t content_hash = hash_patterns(patterns, n_patterns);
+
+  pthread_mutex_lock(&daemon->lock);
+  int res = find_pattern_set(daemon, patterns, n_patterns, content_hash);
+  pthread_mutex_unlock(&daemon->lock);
+
+  if (res == -1) {
+    // Compile outside of the lock, then look again before adding the set
+    pattern_set_t *set = compile_pattern_set(patterns, n_patterns);
+    if (set == NULL) {
+      free(patterns);
+      return -DAEMON_SERVER_ERROR;
+    }
+
+    pthread_mutex_lock(&daemon->lock);
+    res = find_pattern_set(daemon, patterns, n_patterns, content_hash);
+    if (res == -1 && daemon->n_pattern_sets < DAEMON_MAX_PATTERN_SETS) {
+      res = daemon->n_pattern_sets;
+      daemon->pattern_sets[daemon->n_pattern_sets++] = set;
+      set = NULL;
+    }
+    pthread_mutex_unlock(&daemon->lock);
+
+    if (set != NULL) {
+      free_pattern_set(set);
+    }
+    if (res == -1) {
+      res = -DAEMON_SERVER_ERROR;
+    }
+  }
+
+  free(patterns);
+
+  return res;
+}
+
+int search_request(daemon_worker_t *worker, int fd, uint32_t set_id,
+                   const char *text, size_t text_length) {
+  /** @brief Searches a pattern set in a text and sends the response.
+   * @return 0 on success, -1 if the response could not be sent.
+   */
+  daemon_t *daemon = worker->daemon;
+
+  pattern_set_t *set = NULL;
+  pthread_mutex_lock(&daemon->lock);
+  if (set_id < (uint32_t)daemon->n_pattern_sets) {
+    set = daemon->pattern_sets[set_id];
+  }
+  pthread_mutex_unlock(&daemon->lock);
+
+  if (set == NULL) {
+    return send_message(fd, DAEMON_UNKNOWN_PATTERN_SET, 0, NULL, 0);
+  }
+  if (text_length > INT32_MAX) {
+    return send_message(fd, DAEMON_BAD_REQUEST, 0, NULL, 0);
+  }
+
+  // The occurrences are collected in a match list (no per pattern arrays),
+  // then the response is built by counting the occurrences of each pattern
+  long n_matches = collect_pattern_set_matches(
+      set, text, text_length, &worker->matches, &worker->match_capacity);
+  int n_patterns = set->header->n_patterns;
+  size_t response_length = n_patterns + (n_matches > 0 ? n_matches : 0);
+  if (n_matches < 0 ||
+      response_length > DAEMON_MAX_PAYLOAD / sizeof(uint32_t) ||
+      reserve_buffer((void **)&worker->response, &worker->response_capacity,
+                     response_length, sizeof(uint32_t)) != 0 ||
+      reserve_buffer((void **)&worker->cursors, &worker->cursors_capacity,
+                     n_patterns, sizeof(uint32_t)) != 0) {
+    return send_message(fd, DAEMON_SERVER_ERROR, 0, NULL, 0);
+  }
+
+  memset(worker->cursors, 0, n_patterns * sizeof(uint32_t));
+  for (long i = 0; i < n_matches; i++) {
+    worker->cursors[worker->matches[i].pattern_id]++;
+  }
+
+  // Write the count of each pattern, keeping the position of its indexes
+  for (int i = 0, position = 0; i < n_patterns; i++) {
+    uint32_t count = worker->cursors[i];
+    worker->response[position] = count;
+    worker->cursors[i] = position + 1;
+    position += count + 1;
+  }
+
+  // The occurrences of each pattern come in increasing order
+  for (long i = 0; i < n_matches; i++) {
+    ps_match_t *match = &worker->matches[i];
+    worker->response[worker->cursors[match->pattern_id]++] = match->offset;
+  }
+
+  return send_message(fd, DAEMON_OK, n_patterns, worker->response,
+                      response_length * sizeof(uint32_t));
+}
+
+void serve_connection(daemon_worker_t *worker, int fd) {
+  /** @brief Serves the requests of a connection, until it is closed.
+   */
+  daemon_message_t request;
+  while (receive_message(fd, &request, &worker->payload,
+                         &worker->payload_capacity) == 0) {
+    int res = 0;
+    if (request.type == DAEMON_COMPILE) {
+      int set_id = compile_request(worker->daemon, worker->payload,
+                                   request.length, request.arg);
+      res = set_id >= 0 ? send_message(fd, DAEMON_OK, set_id, NULL, 0)
+                        : send_message(fd, -set_id, 0, NULL, 0);
+    } else if (request.type == DAEMON_SEARCH_BUFFER) {
+      res = search_request(worker, fd, request.arg, worker->payload,
+                           request.length);
+    } else if (request.type == DAEMON_SEARCH_FILE) {
+      size_t size;
+      char *text = map_file(worker->payload, 1, &size);
+      if (text == NULL) {
+        res = send_message(fd, DAEMON_BAD_REQUEST, 0, NULL, 0);
+      } else {
+        res = search_request(worker, fd, request.arg, text, size);
+        munmap(text, size);
+      }
+    } else {
+      res = send_message(fd, DAEMON_BAD_REQUEST, 0, NULL, 0);
+    }
+
+    if (res != 0) {
+      break;
+    }
+  }
+}
+
+void *daemon_thread_fn(void *arg) {
+  daemon_worker_t worker;
+  memset(&worker, 0, sizeof(worker));
+  worker.daemon = (daemon_t *)arg;
+
+  while (1) {
+    int fd = accept(worker.daemon->listen_fd, NULL, NULL);
+    if (fd == -1) {
+      if (errno != EINTR) {
+        perror("Error accepting connection");
+      }
+      continue;
+    }
+
+    serve_connection(&worker, fd);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  // Sanity check for arguments
+  if (argc != 2 && argc != 3) {
+    printf("Usage: %s <socket_path> [<number_of_threads>]\n", argv[0]);
+    return -1;
+  }
+
+  // Get arguments
+  socket_path = argv[1];
+  int num_threads = argc == 3 ? atoi(argv[2]) : NUM_DAEMON_THREADS;
+  if (num_threads <= 0 ||
+      strlen(socket_path) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+    printf("Usage: %s <socket_path> [<number_of_threads>]\n", argv[0]);
+    return -1;
+  }
+
+  daemon_t *daemon = (daemon_t *)(calloc(1, sizeof(daemon_t)));
+  if (daemon == NULL) {
+    perror("Error allocating memory for daemon");
+    return -1;
+  }
+  pthread_mutex_init(&daemon->lock, NULL);
+
+  daemon->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (daemon->listen_fd == -1) {
+    perror("Error creating socket");
+    return -1;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+
+  // A stale socket (left by a daemon which did not stop cleanly) is replaced
+  unlink(socket_path);
+  if (bind(daemon->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(daemon->listen_fd, SOMAXCONN) != 0) {
+    perror("Error binding socket");
+    return -1;
+  }
+
+  signal(SIGINT, stop_daemon);
+  signal(SIGTERM, stop_daemon);
+  // A client gone before its reply only ends its connection
+  signal(SIGPIPE, SIG_IGN);
+
+  // The threads are created once, and wait for connections
+  pthread_t *threads = (pthread_t *)(malloc(num_threads * sizeof(pthread_t)));
+  if (threads == NULL) {
+    perror("Error allocating memory for threads");
+    unlink(socket_path);
+    return -1;
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pthread_create(&threads[i], NULL, daemon_thread_fn, (void *)daemon);
+  }
+
+  printf("Listening on %s with %d threads\n", socket_path, num_threads);
+  fflush(stdout);
+
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  return 0;
+}
@@ -0,0 +1,159 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "helpers.h"
+#include "pattern_set.h"
+
+static double elapsed(struct timespec *start, struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void print_dictionary_matches(input_t *input, ps_match_t *matches,
+                              long n_matches) {
+  /** @brief Prints all the occurrences of every pattern, in the format of the
+   * ref files (without their limit on the number of occurrences): the matches
+   * come length by length, so they are sorted by pattern first (a counting
+   * sort, which keeps the offsets of each pattern in increasing order).
+   */
+  int n_patterns = input->n_patterns;
+  long *starts = (long *)(calloc(n_patterns + 1, sizeof(long)));
+  uint64_t *offsets = (uint64_t *)(malloc((n_matches + 1) * sizeof(uint64_t)));
+  if (starts == NULL || offsets == NULL) {
+    perror("Error allocating memory for the occurrences");
+    free(starts);
+    free(offsets);
+    return;
+  }
+
+  for (long i = 0; i < n_matches; i++) {
+    starts[matches[i].pattern_id + 1]++;
+  }
+  for (int i = 0; i < n_patterns; i++) {
+    starts[i + 1] += starts[i];
+  }
+  for (long i = 0; i < n_matches; i++) {
+    offsets[starts[matches[i].pattern_id]++] = matches[i].offset;
+  }
+
+  // Each start is now the end of its pattern
+  long start = 0;
+  for (int i = 0; i < n_patterns; i++) {
+    printf("%s:", input->patterns[i]);
+    for (long j = start; j < starts[i]; j++) {
+      printf(" %lu", (unsigned long)offsets[j]);
+    }
+    printf("\n");
+    start = starts[i];
+  }
+
+  free(starts);
+  free(offsets);
+}
+
+void print_dictionary_stats(input_t *input, pattern_set_t *set,
+                            size_t text_length, long n_matches,
+                            double compile_time, double scan_time) {
+  /** @brief Prints the memory used by the patterns and the compiled set, and
+   * the lookup rate of the scan (one lookup per window of every group).
+   */
+  size_t input_bytes = (input->n_patterns + 1) * sizeof(char *);
+  for (int i = 0; i < input->n_patterns; i++) {
+    input_bytes += strlen(input->patterns[i]) + 1;
+  }
+
+  size_t table_bytes = 0, filter_bytes = 0;
+  long n_unique = 0, n_filtered = 0;
+  double n_windows = 0;
+  for (uint32_t i = 0; i < set->header->n_groups; i++) {
+    ps_group_t *group = &set->groups[i];
+    n_unique += group->n_unique;
+    table_bytes += (size_t)group->table_size * sizeof(ps_slot_t);
+    if (group->filter_offset != 0) {
+      filter_bytes += ((size_t)group->filter_mask + 1) * sizeof(uint64_t);
+      n_filtered += group->n_unique;
+    }
+    if (group->length <= text_length) {
+      n_windows += text_length - group->length + 1;
+    }
+  }
+
+  int n_patterns = input->n_patterns > 0 ? input->n_patterns : 1;
+  fprintf(stderr,
+          "%d patterns (%ld distinct, %ld behind a filter) in %u groups, "
+          "%zu bytes read (%.1f per pattern)\n",
+          input->n_patterns, n_unique, n_filtered, set->header->n_groups,
+          input_bytes, (double)input_bytes / n_patterns);
+  fprintf(stderr,
+          "compiled in %.3f ms: %lu bytes (%.1f per pattern), %zu in tables, "
+          "%zu in filters\n",
+          compile_time * 1e3, (unsigned long)set->header->size,
+          (double)set->header->size / n_patterns, table_bytes, filter_bytes);
+  fprintf(stderr,
+          "%zu bytes scanned in %.3f ms: %.0f lookups (%.1f M/s), %ld "
+          "occurrences\n",
+          text_length, scan_time * 1e3, n_windows,
+          scan_time > 0 ? n_windows / scan_time / 1e6 : 0, n_matches);
+}
+
+int main(int argc, char *argv[]) {
+  // Sanity check for arguments
+  if (argc != 3) {
+    printf("Usage: %s <text_file> <patterns_file>\n", argv[0]);
+    return -1;
+  }
+
+  // Get arguments; the patterns file has the format of the test input files
+  // (only its patterns are read)
+  char *text_path = argv[1];
+  char *patterns_path = argv[2];
+
+  size_t text_length;
+  char *text = map_file(text_path, 1, &text_length);
+  if (text == NULL) {
+    return -1;
+  }
+  if (text_length > INT_MAX) {
+    fprintf(stderr, "Error: the texts are limited to %d bytes\n", INT_MAX);
+    return -1;
+  }
+
+  input_t *input = parse_input_file_header(patterns_path, NULL, NULL);
+  if (input == NULL) {
+    return -1;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pattern_set_t *set = compile_pattern_set(input->patterns, input->n_patterns);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (set == NULL) {
+    return -1;
+  }
+  double compile_time = elapsed(&start, &end);
+
+  ps_match_t *matches = NULL;
+  size_t capacity = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long n_matches =
+      collect_pattern_set_matches(set, text, text_length, &matches, &capacity);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (n_matches == -1) {
+    return -1;
+  }
+  double scan_time = elapsed(&start, &end);
+
+  print_dictionary_matches(input, matches, n_matches);
+  print_dictionary_stats(input, set, text_length, n_matches, compile_time,
+                         scan_time);
+
+  free(matches);
+  free_pattern_set(set);
+  free_input_struct(input);
+  munmap(text, text_length);
+
+  return 0;
+}
@@ -0,0 +1,296 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "dynamic_set.h"
+#include "helpers.h"
+#include "pattern_set.h"
+
+/**
+ * @brief The patterns of each test are removed and added back for
+ * NUM_CHANGE_ROUNDS rounds; each of the first NUM_CHECKED_SCANS rounds waits
+ * for the end of a scan, so that the next scan runs during the next round
+ * (the changes are much faster than the scans).
+ */
+#define NUM_CHANGE_ROUNDS 100
+#define NUM_CHECKED_SCANS 20
+
+/**
+ * @brief Struct for a scanner thread, which scans a text again and again
+ * while the patterns are removed and added back, and checks that every scan
+ * saw a consistent snapshot.
+ * @var set: The dynamic pattern set.
+ * @var input: The input of the test.
+ * @var ref: The ref of the test.
+ * @var counts: The number of occurrences of each id found by the last scan
+ * (of counts_capacity).
+ * @var is_done: Set once the changes are done.
+ * @var n_scans: The number of scans (output).
+ * @var n_inconsistent: The number of inconsistent scans (output).
+ */
+typedef struct Scanner {
+  dynamic_set_t *set;
+  input_t *input;
+  output_t *ref;
+  uint32_t *counts;
+  uint64_t counts_capacity;
+  int is_done;
+  long n_scans;
+  long n_inconsistent;
+} scanner_t;
+
+static double elapsed(struct timespec *start, struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int count_matches(const ps_match_t *matches, size_t n_matches,
+                         void *arg) {
+  uint32_t *counts = (uint32_t *)arg;
+
+  for (size_t i = 0; i < n_matches; i++) {
+    counts[matches[i].pattern_id]++;
+  }
+
+  return 0;
+}
+
+int find_ref_pattern(output_t *ref, const char *pattern) {
+  /** @return The index of a pattern in a ref, -1 if it is not there.
+   */
+  for (int i = 0; i < ref->n_patterns; i++) {
+    if (strcmp(ref->identified_patterns[i]->pattern, pattern) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+int check_snapshot(scanner_t *scanner) {
+  /** @brief Scans the text once and checks the snapshot: all the patterns of
+   * the test but the one being changed are visible, and each visible pattern
+   * has all its occurrences (and the others, none).
+   * @return 0 if the snapshot is consistent, -1 otherwise.
+   */
+  dynamic_set_t *set = scanner->set;
+  input_t *input = scanner->input;
+
+  uint64_t generation = begin_dynamic_set_scan(set);
+
+  // Every change gives at most one id, so the ids of the snapshot are below
+  // its generation
+  if (generation > scanner->counts_capacity) {
+    uint32_t *counts = (uint32_t *)(realloc(
+        scanner->counts, 2 * generation * sizeof(uint32_t)));
+    if (counts == NULL) {
+      perror("Error allocating memory for counts");
+      end_dynamic_set_scan(set, generation);
+      return -1;
+    }
+    scanner->counts = counts;
+    scanner->counts_capacity = 2 * generation;
+  }
+
+  uint32_t *counts = scanner->counts;
+  memset(counts, 0, generation * sizeof(uint32_t));
+  visit_dynamic_set_matches(set, generation, input->text,
+                            strlen(input->text), PATTERN_SET_MATCH_BATCH,
+                            count_matches, counts);
+
+  int n_visible = 0;
+  int res = 0;
+  for (uint32_t id = 0; id < generation && res == 0; id++) {
+    if (!is_dynamic_pattern_visible(set, id, generation)) {
+      res = counts[id] == 0 ? 0 : -1;
+      continue;
+    }
+
+    n_visible++;
+    int j = find_ref_pattern(scanner->ref, dynamic_set_pattern(set, id));
+    int expected = j == -1 ? -1 : scanner->ref->identified_patterns[j]->len;
+    if (expected == -1 ||
+        (expected < MAX_FOUND_PATTERNS && counts[id] != (uint32_t)expected)) {
+      res = -1;
+    }
+  }
+  end_dynamic_set_scan(set, generation);
+
+  // The changes remove a pattern, then add it back
+  if (n_visible < input->n_patterns - 1) {
+    res = -1;
+  }
+
+  return res;
+}
+
+void *scanner_thread_fn(void *arg) {
+  scanner_t *scanner = (scanner_t *)arg;
+
+  do {
+    if (check_snapshot(scanner) != 0) {
+      scanner->n_inconsistent++;
+    }
+    __atomic_store_n(&scanner->n_scans, scanner->n_scans + 1,
+                     __ATOMIC_RELAXED);
+  } while (!__atomic_load_n(&scanner->is_done, __ATOMIC_ACQUIRE));
+
+  free(scanner->counts);
+
+  return NULL;
+}
+
+int check_dynamic_set(dynamic_set_t *set, input_t *input, output_t *ref,
+                      uint32_t *ids) {
+  /** @brief Searches the current snapshot and checks it against the ref.
+   * @param ids The id of each pattern of the input.
+   * @return 0 if the output matches the ref, -1 otherwise.
+   */
+  uint32_t n_ids = 0;
+  for (int i = 0; i < input->n_patterns; i++) {
+    n_ids = ids[i] + 1 > n_ids ? ids[i] + 1 : n_ids;
+  }
+
+  output_t *found = alloc_output_struct(n_ids);
+  output_t *output = alloc_output_struct(input->n_patterns);
+  if (found == NULL || output == NULL) {
+    perror("Error allocating memory for output");
+    if (found != NULL) {
+      free_output_struct(found);
+    }
+    if (output != NULL) {
+      free_output_struct(output);
+    }
+    return -1;
+  }
+
+  search_dynamic_set(set, input->text, strlen(input->text), found);
+
+  // Put the outputs back in the order of the patterns of the input
+  for (int i = 0; i < input->n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    pattern_w_idx_t *found_pattern_w_idx = found->identified_patterns[ids[i]];
+    strcpy(pattern_w_idx->pattern, input->patterns[i]);
+    pattern_w_idx->len = found_pattern_w_idx->len;
+    memcpy(pattern_w_idx->indexes, found_pattern_w_idx->indexes,
+           found_pattern_w_idx->len * sizeof(int));
+  }
+
+  int res = check_correctness(output, ref) ? -1 : 0;
+  free_output_struct(found);
+  free_output_struct(output);
+
+  return res;
+}
+
+int main(int argc, char *argv[]) {
+  // Sanity check for arguments
+  if (argc != 3 && argc != 4) {
+    printf("Usage: %s <tests_directory_path> <number_of_tests> "
+           "[<number_of_rounds>]\n",
+           argv[0]);
+    return -1;
+  }
+
+  char *tests_directory_path = argv[1];
+  int number_of_tests = atoi(argv[2]);
+  int number_of_rounds = argc == 4 ? atoi(argv[3]) : NUM_CHANGE_ROUNDS;
+
+  input_t **inputs;
+  output_t **ref;
+  corpus_t *corpus =
+      load_tests(tests_directory_path, number_of_tests, &inputs, &ref);
+
+  double add_time = 0, compile_time = 0, change_time = 0;
+  long n_added = 0, n_changes = 0, n_scans = 0;
+  for (int i = 0; i < number_of_tests; i++) {
+    input_t *input = inputs[i];
+    int n_patterns = input->n_patterns;
+    uint32_t *ids = (uint32_t *)(malloc((n_patterns + 1) * sizeof(uint32_t)));
+    if (ids == NULL) {
+      perror("Error allocating memory for ids");
+      return -1;
+    }
+
+    // Add the patterns one by one, compared to compiling them all at once
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    dynamic_set_t *set = create_dynamic_set(NULL, 0);
+    for (int j = 0; set != NULL && j < n_patterns; j++) {
+      ids[j] = add_dynamic_pattern(set, input->patterns[j]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    add_time += elapsed(&start, &end);
+    n_added += n_patterns;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pattern_set_t *compiled = compile_pattern_set(input->patterns, n_patterns);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    compile_time += elapsed(&start, &end);
+
+    if (set == NULL || compiled == NULL) {
+      perror("Error building the pattern sets");
+      return -1;
+    }
+    free_pattern_set(compiled);
+
+    int res = check_dynamic_set(set, input, ref[i], ids);
+
+    // Remove every pattern and add it back, round after round, while another
+    // thread scans
+    scanner_t scanner = {set, input, ref[i], NULL, 0, 0, 0, 0};
+    pthread_t scanner_thread;
+    pthread_create(&scanner_thread, NULL, scanner_thread_fn, &scanner);
+
+    for (int round = 0; round < number_of_rounds; round++) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int j = 0; j < n_patterns; j++) {
+        long id = -1;
+        if (remove_dynamic_pattern(set, ids[j]) == 0) {
+          id = add_dynamic_pattern(set, input->patterns[j]);
+        }
+        if (id == -1) {
+          res = -1;
+        } else {
+          ids[j] = id;
+        }
+        n_changes += 2;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      change_time += elapsed(&start, &end);
+
+      while (round < NUM_CHECKED_SCANS &&
+             __atomic_load_n(&scanner.n_scans, __ATOMIC_RELAXED) <= round) {
+        usleep(10);
+      }
+    }
+
+    __atomic_store_n(&scanner.is_done, 1, __ATOMIC_RELEASE);
+    pthread_join(scanner_thread, NULL);
+    n_scans += scanner.n_scans;
+
+    if (scanner.n_inconsistent > 0 ||
+        check_dynamic_set(set, input, ref[i], ids) != 0) {
+      res = -1;
+    }
+
+    printf("test %d: %s\n", i, res == 0 ? "PASSED" : "FAILED");
+
+    free_dynamic_set(set);
+    free(ids);
+  }
+
+  printf("dynamic set: %ld patterns added one by one in %.3f ms (%.3f ms to "
+         "compile them at once), %ld changes in %.3f ms (%.0f ns each), %ld "
+         "scans during the changes\n",
+         n_added, add_time * 1e3, compile_time * 1e3, n_changes,
+         change_time * 1e3, n_changes > 0 ? change_time * 1e9 / n_changes : 0,
+         n_scans);
+
+  unload_tests(corpus, inputs, ref, number_of_tests);
+
+  return 0;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+#include "incremental.h"
+#include "pattern_set.h"
+
+int main(int argc, char *argv[]) {
+  // Sanity check for arguments
+  if (argc != 3) {
+    printf("Usage: %s <input_file> <state_file>\n", argv[0]);
+    return -1;
+  }
+
+  // Get arguments; the input file has the format of the test input files,
+  // with a text which only grows between the runs
+  char *input_path = argv[1];
+  char *state_path = argv[2];
+
+  long text_offset, text_length;
+  input_t *input = parse_input_file_header(input_path, &text_offset,
+                                           &text_length);
+  if (input == NULL) {
+    return -1;
+  }
+
+  pattern_set_t *set = compile_pattern_set(input->patterns, input->n_patterns);
+  output_t *output = alloc_output_struct(input->n_patterns);
+  FILE *fp = fopen(input_path, "rb");
+  if (set == NULL || output == NULL || fp == NULL) {
+    perror("Error preparing the search");
+    return -1;
+  }
+
+  search_state_t *state =
+      load_search_state(state_path, set, text_offset, text_length);
+  if (state == NULL) {
+    return -1;
+  }
+
+  for (int i = 0; i < input->n_patterns; i++) {
+    strcpy(output->identified_patterns[i]->pattern, input->patterns[i]);
+    output->identified_patterns[i]->len = 0;
+  }
+
+  long scanned_length = state->header.scanned_length;
+  int res = search_appended_text(set, state, fp, text_length, output);
+  fclose(fp);
+  if (res == -1 || save_search_state(state, state_path) != 0) {
+    return -1;
+  }
+
+  // Print only the new occurrences, in the format of the ref files
+  for (int i = 0; i < input->n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    if (pattern_w_idx->len == 0) {
+      continue;
+    }
+    printf("%s:", pattern_w_idx->pattern);
+    for (int j = 0; j < pattern_w_idx->len; j++) {
+      printf(" %d", pattern_w_idx->indexes[j]);
+    }
+    printf("\n");
+  }
+  fprintf(stderr, "%ld new bytes scanned (from %ld), %d new occurrences\n",
+          text_length - scanned_length, scanned_length, res);
+
+  free_search_state(state);
+  free_output_struct(output);
+  free_pattern_set(set);
+  free_input_struct(input);
+
+  return 0;
+}
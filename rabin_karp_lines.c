@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "helpers.h"
+#include "pattern_set.h"
+
+static double elapsed(struct timespec *start, struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Struct for collecting the occurrences of a multi-text search.
+ * @var matches: The occurrences (n_matches of capacity).
+ */
+typedef struct LineMatches {
+  ps_text_match_t *matches;
+  size_t n_matches;
+  size_t capacity;
+} line_matches_t;
+
+static int append_line_matches(const ps_text_match_t *matches,
+                               size_t n_matches, void *arg) {
+  line_matches_t *list = (line_matches_t *)arg;
+
+  if (list->n_matches + n_matches > list->capacity) {
+    size_t capacity = list->capacity > 0 ? 2 * list->capacity : 64;
+    while (capacity < list->n_matches + n_matches) {
+      capacity *= 2;
+    }
+    ps_text_match_t *new_matches = (ps_text_match_t *)(realloc(
+        list->matches, capacity * sizeof(ps_text_match_t)));
+    if (new_matches == NULL) {
+      perror("Error allocating memory for matches");
+      return -1;
+    }
+    list->matches = new_matches;
+    list->capacity = capacity;
+  }
+
+  memcpy(list->matches + list->n_matches, matches,
+         n_matches * sizeof(ps_text_match_t));
+  list->n_matches += n_matches;
+
+  return 0;
+}
+
+static int count_matches(const ps_match_t *matches, size_t n_matches,
+                         void *arg) {
+  (void)matches;
+  *(long *)arg += n_matches;
+
+  return 0;
+}
+
+static int count_line_matches(const ps_text_match_t *matches,
+                              size_t n_matches, void *arg) {
+  (void)matches;
+  *(long *)arg += n_matches;
+
+  return 0;
+}
+
+static int cmp_line_matches(const void *a, const void *b) {
+  const ps_text_match_t *matchA = (const ps_text_match_t *)a;
+  const ps_text_match_t *matchB = (const ps_text_match_t *)b;
+
+  if (matchA->text_id != matchB->text_id) {
+    return matchA->text_id < matchB->text_id ? -1 : 1;
+  }
+  if (matchA->pattern_id != matchB->pattern_id) {
+    return matchA->pattern_id < matchB->pattern_id ? -1 : 1;
+  }
+
+  return matchA->offset < matchB->offset ? -1 : 1;
+}
+
+void print_line_matches(pattern_set_t *set, line_matches_t *list) {
+  /** @brief Prints the occurrences line by line: a `<line number>:<pattern>:`
+   * line, followed by the offsets in the line, for every pattern found in a
+   * line (the lines are numbered from 1).
+   */
+  qsort(list->matches, list->n_matches, sizeof(ps_text_match_t),
+        cmp_line_matches);
+
+  for (size_t i = 0; i < list->n_matches; i++) {
+    ps_text_match_t *match = &list->matches[i];
+    if (i == 0 || match->text_id != match[-1].text_id ||
+        match->pattern_id != match[-1].pattern_id) {
+      if (i > 0) {
+        printf("\n");
+      }
+      printf("%lu:%s:", (unsigned long)match->text_id + 1,
+             pattern_set_pattern(set, match->pattern_id));
+    }
+    printf(" %lu", (unsigned long)match->offset);
+  }
+  if (list->n_matches > 0) {
+    printf("\n");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  // Sanity check for arguments
+  if (argc != 3) {
+    printf("Usage: %s <lines_file> <patterns_file>\n", argv[0]);
+    return -1;
+  }
+
+  // Get arguments; every line of the lines file is a text, and the patterns
+  // file has the format of the test input files (only its patterns are read)
+  char *lines_path = argv[1];
+  char *patterns_path = argv[2];
+
+  size_t data_length;
+  char *data = map_file(lines_path, 1, &data_length);
+  if (data == NULL) {
+    fprintf(stderr, "Error: cannot read %s\n", lines_path);
+    return -1;
+  }
+
+  size_t n_lines = 0, capacity = 1024;
+  const char **lines = (const char **)(malloc(capacity * sizeof(char *)));
+  size_t *line_lengths = (size_t *)(malloc(capacity * sizeof(size_t)));
+  for (size_t start = 0; start < data_length && lines && line_lengths;) {
+    const char *end = memchr(data + start, '\n', data_length - start);
+    size_t length = end != NULL ? (size_t)(end - data) - start
+                                : data_length - start;
+    if (n_lines == capacity) {
+      capacity *= 2;
+      lines = (const char **)(realloc(lines, capacity * sizeof(char *)));
+      line_lengths =
+          (size_t *)(realloc(line_lengths, capacity * sizeof(size_t)));
+      if (lines == NULL || line_lengths == NULL) {
+        break;
+      }
+    }
+    lines[n_lines] = data + start;
+    line_lengths[n_lines++] = length;
+    start += length + 1;
+  }
+  if (lines == NULL || line_lengths == NULL) {
+    perror("Error allocating memory for lines");
+    return -1;
+  }
+
+  input_t *input = parse_input_file_header(patterns_path, NULL, NULL);
+  if (input == NULL) {
+    return -1;
+  }
+  pattern_set_t *set = compile_pattern_set(input->patterns, input->n_patterns);
+  if (set == NULL) {
+    return -1;
+  }
+
+  // All the lines at once, PATTERN_SET_LANES side by side, then the same
+  // lines one by one, for comparison (both only count the occurrences)
+  long n_matches = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  visit_pattern_set_texts(set, lines, line_lengths, n_lines,
+                          PATTERN_SET_MATCH_BATCH, count_line_matches,
+                          &n_matches);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double lanes_time = elapsed(&start, &end);
+
+  long n_single_matches = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < n_lines; i++) {
+    visit_pattern_set_matches(set, lines[i], line_lengths[i],
+                              PATTERN_SET_MATCH_BATCH, count_matches,
+                              &n_single_matches);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double single_time = elapsed(&start, &end);
+
+  line_matches_t list = {NULL, 0, 0};
+  if (visit_pattern_set_texts(set, lines, line_lengths, n_lines,
+                              PATTERN_SET_MATCH_BATCH, append_line_matches,
+                              &list) != (long)list.n_matches) {
+    return -1;
+  }
+  print_line_matches(set, &list);
+  fprintf(stderr,
+          "%zu lines (%zu bytes), %d patterns: %ld occurrences in %.3f ms "
+          "with %d lanes (%.1f MB/s), %ld in %.3f ms line by line (%.1f "
+          "MB/s)\n",
+          n_lines, data_length, input->n_patterns, n_matches, lanes_time * 1e3,
+          PATTERN_SET_LANES,
+          lanes_time > 0 ? data_length / lanes_time / 1e6 : 0,
+          n_single_matches, single_time * 1e3,
+          single_time > 0 ? data_length / single_time / 1e6 : 0);
+
+  free(list.matches);
+  free_pattern_set(set);
+  free_input_struct(input);
+  free(lines);
+  free(line_lengths);
+  munmap(data, data_length);
+
+  return n_matches == n_single_matches &&
+                 (size_t)n_matches == list.n_matches
+             ? 0
+             : -1;
+}
@@ -5,29 +5,19 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "corpus.h"
 #include "helpers.h"
+#include "mpi_helpers.h"
 
 #define MAPPER_RANK 0
 #define REDUCER_RANK 1
 
-#define MAPPING_DONE_MARKER -1
+#define TEST_PASSED 1
+#define TEST_FAILED 2
 
 #define HASH_BASE 256
 #define HASH_PRIME 101
 
-const int MAPPING_DONE_MARKER_INT = MAPPING_DONE_MARKER;
-
-int check_if_any_worker_busy(int worker_availabilities[], int n_workers) {
-  // Skip MAPPER_RANK (0) and REDUCER_RANK (1)
-  for (int i = 2; i < n_workers; i++) {
-    if (!worker_availabilities[i]) {
-      return 1;
-    }
-  }
-
-  return 0;
-}
-
 int compute_hash(char *str, int len) {
   int hash = 0;
   for (int i = 0; i < len; i++) {
@@ -50,16 +40,209 @@ int is_pattern_matching(char *text, int text_offset, char *pattern,
   return is_matching;
 }
 
+void search_patterns(char *text, int text_length, int search_length,
+                     char **patterns, int n_patterns, output_t *output,
+                     query_t *query, cancel_flag_t *cancel) {
+  /** @brief Searches all the patterns in the text, until the answer to the
+   * query is known.
+   * @param text The text.
+   * @param text_length The length of the text.
+   * @param search_length Only the windows starting in the first search_length
+   * bytes of the text are searched (the rest of the text is a halo, in split
+   * mode).
+   * @param output The output, with n_patterns identified patterns allocated.
+   * @param cancel The flag shared with the ranks searching the other parts of
+   * the text (QUERY_EXISTS in split mode), NULL if there is none.
+   */
+  int is_answered = 0;
+  for (int pattern_idx = 0; pattern_idx < n_patterns; ++pattern_idx) {
+    char *pattern = patterns[pattern_idx];
+    int pattern_length = strlen(pattern);
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[pattern_idx];
+
+    strcpy(pattern_w_idx->pattern, pattern);
+    pattern_w_idx->len = 0;
+    if (is_answered) {
+      continue;
+    }
+
+    // Compute the hash of the current pattern
+    int pattern_hash = compute_hash(pattern, pattern_length);
+
+    // Move the sliding window over the text
+    int sliding_points = text_length - pattern_length;
+    if (sliding_points > search_length - 1) {
+      sliding_points = search_length - 1;
+    }
+
+    for (int text_offset = 0; text_offset <= sliding_points; ++text_offset) {
+      if (cancel != NULL && text_offset % CANCEL_POLL_INTERVAL == 0 &&
+          is_cancel_flag_raised(cancel)) {
+        is_answered = 1;
+        break;
+      }
+
+      // Compute the hash of the current window
+      int text_window_hash = compute_hash(text + text_offset, pattern_length);
+      if (text_window_hash == pattern_hash) {
+        int is_matching =
+            is_pattern_matching(text, text_offset, pattern, pattern_length);
+        if (is_matching) {
+          record_match(pattern_w_idx, text_offset, query);
+          // The windows come in order: none after the limit is needed
+          if (text_offset >= query_limit(pattern_w_idx, query)) {
+            break;
+          }
+        }
+      }
+    }
+
+    if (query->mode == QUERY_EXISTS && pattern_w_idx->len > 0) {
+      is_answered = 1;
+      if (cancel != NULL) {
+        raise_cancel_flag(cancel);
+      }
+    }
+  }
+}
+
+void run_split_mode(char *tests_directory_path, int number_of_tests,
+                    int mpi_rank, int local_io, query_t *query) {
+  /** @brief Split mode: every text is split in byte ranges, one for each rank,
+   * which are searched independently and merged at MAPPER_RANK; useful when a
+   * single text is too large to be searched by one worker.
+   * @param local_io If set, the ranks read the patterns and their own range of
+   * the text from the test files, instead of receiving them from MAPPER_RANK.
+   */
+  input_t **inputs = NULL;
+  output_t **ref = NULL;
+  corpus_t *corpus = NULL;
+
+  // The ranks of the same node share their part of the text
+  node_comm_t *node_comm = create_node_comm(MPI_COMM_WORLD);
+
+  // The first rank which finds an occurrence stops the others
+  cancel_flag_t *cancel = NULL;
+  if (query->mode == QUERY_EXISTS) {
+    cancel = create_cancel_flag(MAPPER_RANK, MPI_COMM_WORLD);
+  }
+
+  if (mpi_rank == MAPPER_RANK) {
+    // With local I/O, the texts are only needed by the ranks searching them
+    if (local_io) {
+      inputs = parse_all_input_headers(tests_directory_path, number_of_tests);
+      ref = parse_all_ref_files(tests_directory_path, inputs, number_of_tests);
+    } else {
+      corpus = load_tests(tests_directory_path, number_of_tests, &inputs, &ref);
+    }
+  }
+
+  for (int i = 0; i < number_of_tests; i++) {
+    split_range_t range;
+    MPI_Win text_win;
+    char *local_text;
+    char **local_patterns;
+    int n_patterns = 0;
+    input_t *header = NULL;
+
+    if (local_io) {
+      // Every rank reads all the patterns...
+      char path[MAX_FILE_PATH];
+      long text_offset, text_length;
+      snprintf(path, MAX_FILE_PATH, "%s/test%d.in", tests_directory_path, i);
+
+      header = parse_input_file_header(path, &text_offset, &text_length);
+      if (header == NULL) {
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+      }
+      n_patterns = header->n_patterns;
+      local_patterns = header->patterns;
+
+      // ...and its own range of the text
+      int halo = max_pattern_length(local_patterns, n_patterns) - 1;
+      local_text = read_text(path, text_offset, text_length, halo, node_comm,
+                             &range, &text_win);
+    } else {
+      // Parse input parameters (only MAPPER_RANK has them)
+      char *text = NULL;
+      int text_length = 0;
+      char **patterns = NULL;
+      if (mpi_rank == MAPPER_RANK) {
+        text = inputs[i]->text;
+        text_length = strlen(text);
+        n_patterns = inputs[i]->n_patterns;
+        patterns = inputs[i]->patterns;
+      }
+
+      // Every rank searches all the patterns...
+      local_patterns =
+          bcast_patterns(patterns, &n_patterns, MAPPER_RANK, MPI_COMM_WORLD);
+
+      // ...in its own range of the text
+      int halo = max_pattern_length(local_patterns, n_patterns) - 1;
+      local_text = scatter_text(text, text_length, halo, MAPPER_RANK,
+                                MPI_COMM_WORLD, node_comm, &range, &text_win);
+    }
+
+    output_t *local_output = alloc_output_struct(n_patterns);
+    output_t *output = NULL;
+    if (mpi_rank == MAPPER_RANK) {
+      output = alloc_output_struct(n_patterns);
+    }
+    if (local_output == NULL || (mpi_rank == MAPPER_RANK && output == NULL)) {
+      perror("Error allocating memory for output");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    if (cancel != NULL) {
+      start_cancellable_search(cancel);
+    }
+    search_patterns(local_text, range.length, range.owned, local_patterns,
+                    n_patterns, local_output, query, cancel);
+
+    gather_split_results(local_output, &range, output, query, MAPPER_RANK,
+                         MPI_COMM_WORLD);
+
+    if (mpi_rank == MAPPER_RANK) {
+      // Check correctness
+      const char *correctness =
+          check_query(output, ref[i], query) ? "FAILED" : "PASSED";
+      printf("test %d: %s\n", i, correctness);
+      free_output_struct(output);
+    }
+
+    free_output_struct(local_output);
+    // The patterns read from the file share the block of their header
+    if (header != NULL) {
+      free_input_struct(header);
+    } else {
+      free_patterns(local_patterns, n_patterns);
+    }
+    free_shared_text(&text_win);
+  }
+
+  if (cancel != NULL) {
+    destroy_cancel_flag(cancel);
+  }
+  destroy_node_comm(node_comm);
+
+  if (mpi_rank == MAPPER_RANK) {
+    unload_tests(corpus, inputs, ref, number_of_tests);
+  }
+}
+
 int main(int argc, char *argv[]) {
   // Sanity check for arguments
-  if (argc != 3) {
-    printf("Usage: %s <tests_directory_path> <number_of_tests>\n", argv[0]);
+  mpi_options_t options;
+  if (argc < 3 || parse_mpi_options(argc, argv, &options) != 0) {
+    printf("Usage: %s <tests_directory_path> <number_of_tests> "
+           MPI_OPTIONS_USAGE "\n",
+           argv[0]);
     return -1;
   }
 
   // MPI initialization
   int mpi_rank, mpi_size;
-  MPI_Status status;
   MPI_Init(&argc, &argv);
 
   // Get the rank and size of the current process
@@ -68,6 +251,20 @@ int main(int argc, char *argv[]) {
   // Get the size of the group associated with the communicator
   MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
 
+  // Parse command line arguments
+  char *tests_directory_path = argv[1];
+  int number_of_tests = atoi(argv[2]);
+
+  if (options.split_mode) {
+    run_split_mode(tests_directory_path, number_of_tests, mpi_rank,
+                   options.local_io, &options.query);
+    MPI_Finalize();
+    return 0;
+  }
+
+  // With local I/O, the task queue only hands out task ids
+  const char *local_dir = options.local_io ? tests_directory_path : NULL;
+
   // Sanity check for the number of processes
   if (mpi_size < 3) {
     perror("Error: The number of processes must be at least 3 (mapper, "
@@ -76,521 +273,221 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  // Initialize the worker availabilities array
-  int worker_availabilities[mpi_size];
-  for (int i = 0; i < mpi_size; i++) {
-    worker_availabilities[i] = 1;
-  }
-
-  // (Safe guard) Mark the mapper and reducer processes as busy
-  worker_availabilities[MAPPER_RANK] = 0;
-  worker_availabilities[REDUCER_RANK] = 0;
+  // The results are sharded by task id across the reducers (ranks
+  // REDUCER_RANK to REDUCER_RANK + n_reducers - 1); each reducer checks the
+  // results it owns, so a result is only sent once, to its final destination
+  int n_reducers = count_reducers(mpi_size);
 
-  // Parse command line arguments
-  char *tests_directory_path = argv[1];
-  int number_of_tests = atoi(argv[2]);
+  // The verdict of each test (TEST_PASSED or TEST_FAILED), reduced at
+  // MAPPER_RANK; the ranks that did not check a test leave it 0
+  int *verdicts = (int *)(calloc(number_of_tests, sizeof(int)));
+  if (verdicts == NULL) {
+    perror("Error allocating memory for verdicts");
+    MPI_Finalize();
+    exit(EXIT_FAILURE);
+  }
 
   if (mpi_rank == MAPPER_RANK) {
     // Master process is responsible for distributing tasks to workers - one
     // task is equivalent to searching for all the patterns in one text
-    input_t **inputs =
-        parse_all_input_files(tests_directory_path, number_of_tests);
-
-    output_t **ref =
-        parse_all_ref_files(tests_directory_path, inputs, number_of_tests);
-
-    // Distribute the tasks to the workers
-    for (int i = 0; i < number_of_tests; i++) {
-      // Parse input parameters
-      input_t *input = inputs[i];
-      char *text = input->text;
-      int n_patterns = input->n_patterns;
-      char **patterns = input->patterns;
-
-      int text_length = strlen(text);
-
-      int is_task_assigned = 0;
-      while (!is_task_assigned) {
-        // Receives all worker availability updates from REDUCER_RANK
-        int available_worker;
-        int flag;
-        while (MPI_Iprobe(REDUCER_RANK, 0, MPI_COMM_WORLD, &flag, &status) ==
-                   MPI_SUCCESS &&
-               flag) {
-          MPI_Recv(&available_worker, 1, MPI_INT, REDUCER_RANK, 0,
-                   MPI_COMM_WORLD, &status);
-          worker_availabilities[available_worker] = 1;
-        }
-
-        // Get the index of the first available worker (skip MAPPER_RANK (0)
-        // and REDUCER_RANK (1))
-        int next_worker = -1;
-        for (int i = 2; i < mpi_size; i++) {
-          if (worker_availabilities[i]) {
-            next_worker = i;
-            break;
-          }
-        }
-
-        if (next_worker != -1) {
-          // Signal the next available worker that a new text is ready to be
-          // processed by sending an UUID of the task
-          MPI_Send(&i, 1, MPI_INT, next_worker, 0, MPI_COMM_WORLD);
-
-          // Send the length of the text to the next available worker
-          MPI_Send(&text_length, 1, MPI_INT, next_worker, 0, MPI_COMM_WORLD);
-
-          // Send the text to the next available worker
-          MPI_Send(text, text_length, MPI_CHAR, next_worker, 0, MPI_COMM_WORLD);
-
-          // Send the number of patterns to the next available worker
-          MPI_Send(&n_patterns, 1, MPI_INT, next_worker, 0, MPI_COMM_WORLD);
-
-          // Send the patterns to the next available worker
-          for (int pattern_idx = 0; pattern_idx < n_patterns; ++pattern_idx) {
-            char *pattern = patterns[pattern_idx];
-            int pattern_length = strlen(pattern);
-
-            // Send the length of the current pattern to the next available
-            // worker
-            MPI_Send(&pattern_length, 1, MPI_INT, next_worker, 0,
-                     MPI_COMM_WORLD);
-
-            // Send the current pattern to the next available worker
-            MPI_Send(pattern, pattern_length, MPI_CHAR, next_worker, 0,
-                     MPI_COMM_WORLD);
-          }
-
-          // Mark the worker as unavailable
-          MPI_Send(&next_worker, 1, MPI_INT, REDUCER_RANK, 0, MPI_COMM_WORLD);
-          worker_availabilities[next_worker] = 0;
+    // With local I/O, the texts are only read by the workers
+    input_t **inputs;
+    output_t **ref = NULL;
+    corpus_t *corpus = NULL;
+    if (options.local_io) {
+      inputs = parse_all_input_headers(tests_directory_path, number_of_tests);
+    } else {
+      corpus = load_tests(tests_directory_path, number_of_tests, &inputs, &ref);
+
+      // Without local I/O, the reducers get their refs from MAPPER_RANK
+      scatter_refs(ref, number_of_tests, REDUCER_RANK, n_reducers, MAPPER_RANK,
+                   MPI_COMM_WORLD);
+    }
 
-          is_task_assigned = 1;
-        }
-      }
+    // Expose the tasks to the workers; they pull them on their own, so there is
+    // nothing else to do until the verdicts arrive
+    task_queue_t *queue = create_task_queue(
+        options.local_io ? NULL : inputs, local_dir, number_of_tests,
+        MAPPER_RANK, MPI_COMM_WORLD);
+
+    // The mapper sizes the result stores of the reducers, but does not
+    // collect results
+    scatter_result_capacities(inputs, local_dir, number_of_tests, REDUCER_RANK,
+                              n_reducers, MAPPER_RANK, MPI_COMM_WORLD);
+    result_store_t *store = create_result_store(0, MPI_COMM_WORLD);
+    collect_results(store, MPI_COMM_WORLD);
+
+    // Receive the verdicts from the reducers
+    int *results = (int *)(calloc(number_of_tests, sizeof(int)));
+    if (results == NULL) {
+      perror("Error allocating memory for results");
+      MPI_Finalize();
+      exit(EXIT_FAILURE);
     }
+    MPI_Reduce(verdicts, results, number_of_tests, MPI_INT, MPI_MAX,
+               MAPPER_RANK, MPI_COMM_WORLD);
 
-    // Notify all workers that the mapping is done
-    for (int i = REDUCER_RANK + 1; i < mpi_size; i++) {
-      MPI_Send(&MAPPING_DONE_MARKER_INT, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+    for (int i = 0; i < number_of_tests; ++i) {
+      const char *correctness =
+          results[i] == TEST_PASSED ? "PASSED" : "FAILED";
+      printf("test %d: %s\n", i, correctness);
     }
 
-    // Consume all worker availability updates from REDUCER_RANK; all updates
-    // are processed when all workers become available
-    int available_worker;
-    while (check_if_any_worker_busy(worker_availabilities, mpi_size)) {
-      MPI_Recv(&available_worker, 1, MPI_INT, REDUCER_RANK, 0, MPI_COMM_WORLD,
-               &status);
-      worker_availabilities[available_worker] = 1;
+    free(results);
+    destroy_result_store(store);
+    destroy_task_queue(queue);
+    unload_tests(corpus, inputs, ref, number_of_tests);
+  } else if (mpi_rank < REDUCER_RANK + n_reducers) {
+    // Reducer process is responsible for collecting the results of its tasks
+    // (task_id % n_reducers == reducer_idx) and checking them against the refs;
+    // the workers deposit the results in its result store on their own
+    int reducer_idx = mpi_rank - REDUCER_RANK;
+    int files_to_process =
+        count_reducer_tasks(number_of_tests, reducer_idx, n_reducers);
+
+    // With local I/O, the refs are read as the results come
+    output_t **refs = NULL;
+    if (!options.local_io) {
+      refs = scatter_refs(NULL, number_of_tests, REDUCER_RANK, n_reducers,
+                          MAPPER_RANK, MPI_COMM_WORLD);
     }
 
-    // Receive all results from REDUCER_RANK
-    for (int i = 0; i < number_of_tests; ++i) {
-      // Receive the number of patterns from REDUCER_RANK
-      int n_patterns = 0;
-      MPI_Recv(&n_patterns, 1, MPI_INT, REDUCER_RANK, 0, MPI_COMM_WORLD,
-               &status);
+    // The reducer takes part in the creation of the task queue, but it never
+    // grabs tasks
+    task_queue_t *queue =
+        create_task_queue(NULL, local_dir, number_of_tests, MAPPER_RANK,
+                          MPI_COMM_WORLD);
+
+    // The store is sized for the results of all the tasks of the reducer
+    MPI_Aint capacity = scatter_result_capacities(
+        NULL, NULL, number_of_tests, REDUCER_RANK, n_reducers, MAPPER_RANK,
+        MPI_COMM_WORLD);
+    result_store_t *store = create_result_store(capacity, MPI_COMM_WORLD);
+
+    // Reducer's work starts when all the results have been deposited
+    char *result = collect_results(store, MPI_COMM_WORLD);
+
+    for (int files_processed = 0; files_processed < files_to_process;
+         ++files_processed) {
+      // The results are packed one after the other, in the order in which the
+      // workers reserved their slots
+      int task_uuid = 0, result_size = 0;
+      output_t *output = unpack_output(result, &task_uuid, &result_size);
+      result += result_size;
 
-      // Initialize output parameters
-      output_t *output = (output_t *)(malloc(sizeof(output_t)));
-      if (output == NULL) {
-        perror("Error allocating memory for output");
-        MPI_Finalize();
-        exit(EXIT_FAILURE);
+      // Check correctness
+      output_t *ref = refs != NULL ? refs[task_uuid]
+                                   : parse_ref_file(tests_directory_path,
+                                                    task_uuid,
+                                                    output->n_patterns);
+      if (ref == NULL) {
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
       }
+      verdicts[task_uuid] =
+          check_query(output, ref, &options.query) ? TEST_FAILED : TEST_PASSED;
 
-      // Allocate memory for the identified patterns array
-      output->identified_patterns =
-          (pattern_w_idx_t **)(malloc(n_patterns * sizeof(pattern_w_idx_t *)));
-      if (output->identified_patterns == NULL) {
-        perror("Error allocating memory for output.identified_patterns\n");
-        free(output);
-        MPI_Finalize();
-        exit(EXIT_FAILURE);
-      }
+      free_output_struct(ref);
+      free_output_struct(output);
+    }
 
-      // Allocate memory for each identified pattern
-      for (int i = 0; i < n_patterns; ++i) {
-        output->identified_patterns[i] = alloc_pattern_w_idx();
-        if (output->identified_patterns[i] == NULL) {
-          perror("Error allocating memory for output.identified_patterns[i]\n");
-          free(output->identified_patterns);
-          free(output);
-          MPI_Finalize();
-          exit(EXIT_FAILURE);
-        }
-      }
+    free(refs);
 
-      // Receive the identified patterns from REDUCER_RANK
-      for (int pattern_idx = 0; pattern_idx < n_patterns; ++pattern_idx) {
-        // Receive the length of the current pattern from REDUCER_RANK
-        int pattern_length = 0;
-        MPI_Recv(&pattern_length, 1, MPI_INT, REDUCER_RANK, 0, MPI_COMM_WORLD,
-                 &status);
-
-        // Receive the current pattern from REDUCER_RANK
-        char pattern[pattern_length + 1];
-        MPI_Recv(pattern, pattern_length, MPI_CHAR, REDUCER_RANK, 0,
-                 MPI_COMM_WORLD, &status);
-
-        // Place the null terminator at the end of the pattern
-        pattern[pattern_length] = '\0';
-
-        // Receive the number of times the current pattern has been identified
-        // from REDUCER_RANK
-        int pattern_occurrences = 0;
-        MPI_Recv(&pattern_occurrences, 1, MPI_INT, REDUCER_RANK, 0,
-                 MPI_COMM_WORLD, &status);
-
-        // Receive the indexes of the current pattern from REDUCER_RANK
-        int pattern_indexes[pattern_occurrences];
-        MPI_Recv(pattern_indexes, pattern_occurrences, MPI_INT, REDUCER_RANK, 0,
-                 MPI_COMM_WORLD, &status);
-
-        // Store the received data in the output struct
-        output->n_patterns = n_patterns;
-        strcpy(output->identified_patterns[pattern_idx]->pattern, pattern);
-        output->identified_patterns[pattern_idx]->len = pattern_occurrences;
-        for (int i = 0; i < pattern_occurrences; i++) {
-          output->identified_patterns[pattern_idx]->indexes[i] =
-              pattern_indexes[i];
-        }
-      }
+    // Send the verdicts to MAPPER_RANK
+    MPI_Reduce(verdicts, NULL, number_of_tests, MPI_INT, MPI_MAX, MAPPER_RANK,
+               MPI_COMM_WORLD);
 
-      // Check correctness
-      const char *correctness =
-          check_correctness(output, ref[i]) ? "FAILED" : "PASSED";
-      printf("test %d: %s\n", i, correctness);
+    destroy_result_store(store);
+    destroy_task_queue(queue);
+  } else {
+    // Worker process is responsible for searching for the patterns in the text
+    // grabbed from the task queue of MAPPER_RANK
+    // The worker takes part in the scatter of the refs, but gets none
+    if (!options.local_io) {
+      scatter_refs(NULL, number_of_tests, REDUCER_RANK, n_reducers,
+                   MAPPER_RANK, MPI_COMM_WORLD);
     }
 
-    destroy_tests(inputs, ref, number_of_tests);
-  } else if (mpi_rank == REDUCER_RANK) {
-    // Reducer process is responsible for receiving the results from the workers
-    // and combining them to produce the final result to be sent to MAPPER_RANK
-    int files_processed = 0;
-
-    // Initialize outputs
-    output_t **outputs =
-        (output_t **)(malloc(number_of_tests * sizeof(output_t *)));
-    if (outputs == NULL) {
-      perror("Error allocating memory for outputs");
-      MPI_Finalize();
-      exit(EXIT_FAILURE);
+    task_queue_t *queue =
+        create_task_queue(NULL, local_dir, number_of_tests, MAPPER_RANK,
+                          MPI_COMM_WORLD);
+
+    // The workers do not collect results
+    scatter_result_capacities(NULL, NULL, number_of_tests, REDUCER_RANK,
+                              n_reducers, MAPPER_RANK, MPI_COMM_WORLD);
+    result_store_t *store = create_result_store(0, MPI_COMM_WORLD);
+
+    // One task is always kept in flight: the next task is read while the
+    // current one is searched
+    pending_task_t pending;
+    int task_uuid = next_task(queue);
+    if (task_uuid != -1) {
+      prefetch_task(queue, task_uuid, &pending);
     }
 
-    // Reducer's work is done when all workers are done and there are no more
-    // patterns to be processed
-    while (files_processed < number_of_tests) {
-      // Receives all available messages from MAPPER_RANK
-      int message = 0;
-      int flag;
-      while (MPI_Iprobe(MAPPER_RANK, 0, MPI_COMM_WORLD, &flag, &status) ==
-                 MPI_SUCCESS &&
-             flag) {
-        MPI_Recv(&message, 1, MPI_INT, MAPPER_RANK, 0, MPI_COMM_WORLD, &status);
-        worker_availabilities[message] = 0;
-      }
-
-      // For safety, make sure the next messages are not worker availability
-      // updates from MAPPER_RANK; otherwise, we will receive them when we try
-      // to receive the results from the workers
-      while (MPI_Probe(MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status) ==
-                 MPI_SUCCESS &&
-             status.MPI_SOURCE == MAPPER_RANK) {
-        MPI_Recv(&message, 1, MPI_INT, MAPPER_RANK, 0, MPI_COMM_WORLD, &status);
-        worker_availabilities[message] = 0;
-      }
+    // The results are put without waiting; the previous put is only waited for
+    // after the search of the current task
+    char *result = NULL;
+    MPI_Request result_request = MPI_REQUEST_NULL;
 
-      // Receive a new result from a worker
-      // Receive the UUID of the task from the worker
-      int task_uuid = 0;
-      MPI_Recv(&task_uuid, 1, MPI_INT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD,
-               &status);
+    while (task_uuid != -1) {
+      // Wait for the text and the patterns of the current task
+      input_t *input = wait_task(queue, &pending);
+      char *text = input->text;
+      int text_length = strlen(text);
+      int n_patterns = input->n_patterns;
+      char **patterns = input->patterns;
+      int current_task_uuid = task_uuid;
 
-      // Receive the number of patterns from the worker
-      int n_patterns = 0;
-      MPI_Recv(&n_patterns, 1, MPI_INT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD,
-               &status);
+      // Grab the next task and start reading it
+      task_uuid = next_task(queue);
+      if (task_uuid != -1) {
+        prefetch_task(queue, task_uuid, &pending);
+      }
 
       // Initialize output parameters
-      output_t *output = (output_t *)(malloc(sizeof(output_t)));
+      output_t *output = alloc_output_struct(n_patterns);
       if (output == NULL) {
         perror("Error allocating memory for output");
         MPI_Finalize();
         exit(EXIT_FAILURE);
       }
 
-      // Allocate memory for the identified patterns array
-      output->identified_patterns =
-          (pattern_w_idx_t **)(malloc(n_patterns * sizeof(pattern_w_idx_t *)));
-      if (output->identified_patterns == NULL) {
-        perror("Error allocating memory for output.identified_patterns\n");
-        free(output);
-        MPI_Finalize();
-        exit(EXIT_FAILURE);
-      }
-
-      // Allocate memory for each identified pattern
-      for (int i = 0; i < n_patterns; ++i) {
-        output->identified_patterns[i] = alloc_pattern_w_idx();
-        if (output->identified_patterns[i] == NULL) {
-          perror("Error allocating memory for output.identified_patterns[i]\n");
-          free(output->identified_patterns);
-          free(output);
-          MPI_Finalize();
-          exit(EXIT_FAILURE);
-        }
-      }
+      // Do the search for each pattern
+      search_patterns(text, text_length, text_length, patterns, n_patterns,
+                      output, &options.query, NULL);
 
-      // Receive the identified patterns from the previous worker
-      for (int pattern_idx = 0; pattern_idx < n_patterns; ++pattern_idx) {
-        // Receive the length of the current pattern from the worker
-        int pattern_length = 0;
-        MPI_Recv(&pattern_length, 1, MPI_INT, status.MPI_SOURCE, 0,
-                 MPI_COMM_WORLD, &status);
-
-        // Receive the current pattern from the worker
-        char pattern[pattern_length + 1];
-        MPI_Recv(pattern, pattern_length, MPI_CHAR, status.MPI_SOURCE, 0,
-                 MPI_COMM_WORLD, &status);
-
-        // Place the null terminator at the end of the pattern
-        pattern[pattern_length] = '\0';
-
-        // Receive the number of times the current pattern has been identified
-        // from the worker
-        int pattern_occurrences = 0;
-        MPI_Recv(&pattern_occurrences, 1, MPI_INT, status.MPI_SOURCE, 0,
-                 MPI_COMM_WORLD, &status);
-
-        // Receive the indexes of the current pattern from the worker
-        int pattern_indexes[pattern_occurrences];
-        MPI_Recv(pattern_indexes, pattern_occurrences, MPI_INT,
-                 status.MPI_SOURCE, 0, MPI_COMM_WORLD, &status);
-
-        // Store the received data in the output struct
-        output->n_patterns = n_patterns;
-        strcpy(output->identified_patterns[pattern_idx]->pattern, pattern);
-        output->identified_patterns[pattern_idx]->len = pattern_occurrences;
-        for (int i = 0; i < pattern_occurrences; i++) {
-          output->identified_patterns[pattern_idx]->indexes[i] =
-              pattern_indexes[i];
-        }
-      }
+      // Processing is done; deposit the output in the store of the reducer of
+      // the task, once the previous output is gone
+      MPI_Wait(&result_request, MPI_STATUS_IGNORE);
+      free(result);
 
-      // Store the output in the outputs array
-      outputs[task_uuid] = output;
+      int result_size = 0;
+      int reducer_rank = REDUCER_RANK + current_task_uuid % n_reducers;
+      result = pack_output(current_task_uuid, output, &options.query,
+                           &result_size);
+      put_result(store, reducer_rank, result, result_size, &result_request);
 
-      // Increment the number of files processed
-      ++files_processed;
-
-      // Mark the worker as available
-      worker_availabilities[status.MPI_SOURCE] = 1;
-
-      // Notify MAPPER_RANK that the worker is available
-      MPI_Send(&status.MPI_SOURCE, 1, MPI_INT, MAPPER_RANK, 0, MPI_COMM_WORLD);
-    }
-
-    // Send all results to MAPPER_RANK
-    for (int i = 0; i < number_of_tests; i++) {
-      // Send the number of patterns to MAPPER_RANK
-      MPI_Send(&outputs[i]->n_patterns, 1, MPI_INT, MAPPER_RANK, 0,
-               MPI_COMM_WORLD);
-
-      // Send the identified patterns to MAPPER_RANK
-      for (int pattern_idx = 0; pattern_idx < outputs[i]->n_patterns;
-           ++pattern_idx) {
-        pattern_w_idx_t *pattern_w_idx =
-            outputs[i]->identified_patterns[pattern_idx];
-
-        int pattern_length = strlen(pattern_w_idx->pattern);
-
-        // Send the length of the current pattern to MAPPER_RANK
-        MPI_Send(&pattern_length, 1, MPI_INT, MAPPER_RANK, 0, MPI_COMM_WORLD);
-
-        // Send the current pattern to MAPPER_RANK
-        MPI_Send(pattern_w_idx->pattern, strlen(pattern_w_idx->pattern),
-                 MPI_CHAR, MAPPER_RANK, 0, MPI_COMM_WORLD);
-
-        // Send the number of times the current pattern has been identified to
-        // MAPPER_RANK
-        MPI_Send(&pattern_w_idx->len, 1, MPI_INT, MAPPER_RANK, 0,
-                 MPI_COMM_WORLD);
-
-        // Send the indexes of the current pattern to MAPPER_RANK
-        MPI_Send(pattern_w_idx->indexes, pattern_w_idx->len, MPI_INT,
-                 MAPPER_RANK, 0, MPI_COMM_WORLD);
-      }
+      // Free the memory allocated for the current task
+      free_output_struct(output);
+      release_task(queue, input);
     }
 
-    MPI_Finalize();
-    exit(EXIT_SUCCESS);
-  } else {
-    // Worker process is responsible for searching for the patterns in the text
-    // received from MAPPER_RANK
-    int mapper_signal = 0;
-    while (1) {
-      // Wait for a signal from MAPPER_RANK
-      MPI_Recv(&mapper_signal, 1, MPI_INT, MAPPER_RANK, 0, MPI_COMM_WORLD,
-               &status);
-      if (mapper_signal == MAPPING_DONE_MARKER)
-        break; // MAPPER_RANK marked the mapping as done; no more work to do
-      else {
-        // Received signal from MAPPER_RANK represents the UUID of the task
-        int task_uuid = mapper_signal;
-
-        // Receive the length of the text from MAPPER_RANK
-        int text_length = 0;
-        MPI_Recv(&text_length, 1, MPI_INT, MAPPER_RANK, 0, MPI_COMM_WORLD,
-                 &status);
-
-        // Receive the text from MAPPER_RANK
-        char *text = (char *)(malloc((text_length + 1) * sizeof(char)));
-        if (text == NULL) {
-          perror("Error allocating memory for text");
-          MPI_Finalize();
-          exit(EXIT_FAILURE);
-        }
-        MPI_Recv(text, text_length, MPI_CHAR, MAPPER_RANK, 0, MPI_COMM_WORLD,
-                 &status);
-
-        // Place the null terminator at the end of the text
-        text[text_length] = '\0';
-
-        // Receive the number of patterns from MAPPER_RANK
-        int n_patterns = 0;
-        MPI_Recv(&n_patterns, 1, MPI_INT, MAPPER_RANK, 0, MPI_COMM_WORLD,
-                 &status);
-
-        // Receive the patterns from MAPPER_RANK
-        char *patterns[n_patterns];
-        for (int pattern_idx = 0; pattern_idx < n_patterns; ++pattern_idx) {
-          // Receive the length of the current pattern from MAPPER_RANK
-          int pattern_length = 0;
-          MPI_Recv(&pattern_length, 1, MPI_INT, MAPPER_RANK, 0, MPI_COMM_WORLD,
-                   &status);
-
-          // Receive the current pattern from MAPPER_RANK
-          char *pattern = (char *)(malloc((pattern_length + 1) * sizeof(char)));
-          if (pattern == NULL) {
-            perror("Error allocating memory for pattern");
-            MPI_Finalize();
-            exit(EXIT_FAILURE);
-          }
-
-          MPI_Recv(pattern, pattern_length, MPI_CHAR, MAPPER_RANK, 0,
-                   MPI_COMM_WORLD, &status);
+    MPI_Wait(&result_request, MPI_STATUS_IGNORE);
+    free(result);
 
-          // Place the null terminator at the end of the pattern
-          pattern[pattern_length] = '\0';
+    // Let the reducers know that all the results have been deposited
+    collect_results(store, MPI_COMM_WORLD);
 
-          patterns[pattern_idx] = pattern;
-        }
-
-        // Initialize output parameters
-        output_t *output = (output_t *)(malloc(sizeof(output_t)));
-        if (output == NULL) {
-          perror("Error allocating memory for output");
-          MPI_Finalize();
-          exit(EXIT_FAILURE);
-        }
-
-        output->n_patterns = n_patterns;
-
-        // Allocate memory for the identified patterns array
-        output->identified_patterns = (pattern_w_idx_t **)(malloc(
-            n_patterns * sizeof(pattern_w_idx_t *)));
-        if (output->identified_patterns == NULL) {
-          perror("Error allocating memory for output.identified_patterns\n");
-          free(output);
-          MPI_Finalize();
-          exit(EXIT_FAILURE);
-        }
-
-        // Allocate memory for each identified pattern
-        for (int i = 0; i < n_patterns; ++i) {
-          output->identified_patterns[i] = alloc_pattern_w_idx();
-          if (output->identified_patterns[i] == NULL) {
-            perror(
-                "Error allocating memory for output.identified_patterns[i]\n");
-            free(output->identified_patterns);
-            free(output);
-            MPI_Finalize();
-            exit(EXIT_FAILURE);
-          }
-        }
-
-        // Do the search for each pattern
-        for (int pattern_idx = 0; pattern_idx < n_patterns; ++pattern_idx) {
-          char *pattern = patterns[pattern_idx];
-          int pattern_length = strlen(pattern);
-
-          strcpy(output->identified_patterns[pattern_idx]->pattern, pattern);
-          output->identified_patterns[pattern_idx]->len = 0;
-
-          // Compute the hash of the current pattern
-          int pattern_hash = compute_hash(pattern, pattern_length);
-
-          // Move the sliding window over the text
-          int sliding_points = text_length - pattern_length;
-          for (int text_offset = 0; text_offset <= sliding_points;
-               ++text_offset) {
-            // Compute the hash of the current window
-            int text_window_hash =
-                compute_hash(text + text_offset, pattern_length);
-            if (text_window_hash == pattern_hash) {
-              int is_matching = is_pattern_matching(text, text_offset, pattern,
-                                                    pattern_length);
-              if (is_matching) {
-                output->identified_patterns[pattern_idx]
-                    ->indexes[output->identified_patterns[pattern_idx]->len++] =
-                    text_offset;
-              }
-            }
-          }
-        }
-
-        // Processing is done; send the output to REDUCER_RANK
-        // Send the UUID of the task to REDUCER_RANK
-        MPI_Send(&task_uuid, 1, MPI_INT, REDUCER_RANK, 0, MPI_COMM_WORLD);
-
-        // Send the number of patterns to REDUCER_RANK
-        MPI_Send(&n_patterns, 1, MPI_INT, REDUCER_RANK, 0, MPI_COMM_WORLD);
-
-        // Send the identified patterns to REDUCER_RANK
-        for (int pattern_idx = 0; pattern_idx < n_patterns; ++pattern_idx) {
-          pattern_w_idx_t *pattern_w_idx =
-              output->identified_patterns[pattern_idx];
-
-          int pattern_length = strlen(pattern_w_idx->pattern);
-
-          // Send the length of the current pattern to REDUCER_RANK
-          MPI_Send(&pattern_length, 1, MPI_INT, REDUCER_RANK, 0,
-                   MPI_COMM_WORLD);
-
-          // Send the current pattern to REDUCER_RANK
-          MPI_Send(pattern_w_idx->pattern, strlen(pattern_w_idx->pattern),
-                   MPI_CHAR, REDUCER_RANK, 0, MPI_COMM_WORLD);
-
-          // Send the number of times the current pattern has been identified to
-          // REDUCER_RANK
-          MPI_Send(&pattern_w_idx->len, 1, MPI_INT, REDUCER_RANK, 0,
-                   MPI_COMM_WORLD);
-
-          // Send the indexes of the current pattern to REDUCER_RANK
-          MPI_Send(pattern_w_idx->indexes, pattern_w_idx->len, MPI_INT,
-                   REDUCER_RANK, 0, MPI_COMM_WORLD);
-        }
-
-        // Free the memory allocated for the current output
-        free_output_struct(output);
-      }
-    }
+    // The workers checked nothing
+    MPI_Reduce(verdicts, NULL, number_of_tests, MPI_INT, MPI_MAX, MAPPER_RANK,
+               MPI_COMM_WORLD);
 
-    MPI_Finalize();
-    exit(EXIT_SUCCESS);
+    destroy_result_store(store);
+    destroy_task_queue(queue);
   }
 
+  free(verdicts);
+
   MPI_Finalize();
   return 0;
 }
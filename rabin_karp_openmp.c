@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,6 +6,7 @@
 #include <unistd.h>
 #include <omp.h>
 
+#include "corpus.h"
 #include "helpers.h"
 
 #define HASH_BASE 256
@@ -37,7 +39,7 @@ int is_pattern_matching(char *text, int text_offset, char *pattern,
   return is_matching;
 }
 
-output_t *rabin_karp_omp(input_t *input) {
+output_t *rabin_karp_omp(input_t *input, query_t *query) {
   // Parse input parameters
   char *text = input->text;
   int n_patterns = input->n_patterns;
@@ -73,23 +75,43 @@ output_t *rabin_karp_omp(input_t *input) {
       return NULL;
     }
   }
-  // Do the search for each pattern
+  // Do the search for each pattern; the threads stop as soon as the answer is
+  // known (is_answered for the whole text, limit for a pattern)
+  int is_answered = 0;
   #pragma omp parallel for schedule(auto)
   for (int pattern_idx = 0; pattern_idx < n_patterns; ++pattern_idx) {
     char *pattern = patterns[pattern_idx];
-    size_t pattern_length = strlen(pattern);
+    size_t pattern_length = input_pattern_length(input, pattern_idx);
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[pattern_idx];
 
-    strcpy(output->identified_patterns[pattern_idx]->pattern, pattern);
-    output->identified_patterns[pattern_idx]->len = 0;
+    strcpy(pattern_w_idx->pattern, pattern);
+    pattern_w_idx->len = 0;
+
+    int is_text_answered;
+    #pragma omp atomic read
+    is_text_answered = is_answered;
+    if (is_text_answered) {
+      continue;
+    }
 
     // Compute the hash of the current pattern
     int pattern_hash = compute_hash(pattern, pattern_length);
 
     // Move the sliding window over the text
     size_t sliding_points = text_length - pattern_length;
+    int limit = INT_MAX;
 
     #pragma omp parallel for schedule(static)
     for (size_t text_offset = 0; text_offset <= sliding_points; ++text_offset) {
+      int current_limit, is_current_answered;
+      #pragma omp atomic read
+      current_limit = limit;
+      #pragma omp atomic read
+      is_current_answered = is_answered;
+      if (is_current_answered || (int)text_offset > current_limit) {
+        continue;
+      }
+
       // Compute the hash of the current window
       int text_window_hash = compute_hash(text + text_offset, pattern_length);
       if (text_window_hash == pattern_hash) {
@@ -97,9 +119,16 @@ output_t *rabin_karp_omp(input_t *input) {
             is_pattern_matching(text, text_offset, pattern, pattern_length);
         if (is_matching) {
           #pragma omp critical
-          output->identified_patterns[pattern_idx]
-              ->indexes[output->identified_patterns[pattern_idx]->len++] =
-              text_offset;
+          {
+            record_match(pattern_w_idx, text_offset, query);
+            current_limit = query_limit(pattern_w_idx, query);
+            #pragma omp atomic write
+            limit = current_limit;
+            if (query->mode == QUERY_EXISTS) {
+              #pragma omp atomic write
+              is_answered = 1;
+            }
+          }
         }
       }
     }
@@ -110,8 +139,15 @@ output_t *rabin_karp_omp(input_t *input) {
 
 int main(int argc, char *argv[]) {
   // Sanity check for arguments
-  if (argc != 3) {
-    printf("Usage: %s <tests_directory_path> <number_of_tests>\n", argv[0]);
+  query_t query = {QUERY_ALL, 0};
+  int is_usage_valid = argc >= 3;
+  for (int i = 3; is_usage_valid && i < argc; i++) {
+    is_usage_valid = parse_query_option(argc, argv, &i, &query) == 1;
+  }
+  if (!is_usage_valid) {
+    printf("Usage: %s <tests_directory_path> <number_of_tests> " QUERY_USAGE
+           "\n",
+           argv[0]);
     return -1;
   }
 
@@ -119,11 +155,11 @@ int main(int argc, char *argv[]) {
   char *tests_directory_path = argv[1];
   int number_of_tests = atoi(argv[2]);
 
-  input_t **inputs =
-      parse_all_input_files(tests_directory_path, number_of_tests);
-
-  output_t **ref =
-      parse_all_ref_files(tests_directory_path, inputs, number_of_tests);
+  // The tests are mapped from the corpus of the directory, if there is one
+  input_t **inputs;
+  output_t **ref;
+  corpus_t *corpus =
+      load_tests(tests_directory_path, number_of_tests, &inputs, &ref);
 
   int stop_flag = 0;
   #pragma omp parallel for
@@ -131,22 +167,23 @@ int main(int argc, char *argv[]) {
     if (stop_flag) {
         continue;
     }
-    output_t *output = rabin_karp_omp(inputs[i]);
+    output_t *output = rabin_karp_omp(inputs[i], &query);
 
     if (output == NULL) {
       perror("Error computing the output");
-      destroy_tests(inputs, ref, number_of_tests);
+      unload_tests(corpus, inputs, ref, number_of_tests);
       stop_flag = 1;
       continue;
     }
 
     // Check correctness
-    const char *correctness = check_correctness(output, ref[i]) ? "FAILED" : "PASSED";
+    const char *correctness =
+        check_query(output, ref[i], &query) ? "FAILED" : "PASSED";
     printf("test %d: %s\n", i, correctness);
     free_output_struct(output);
   }
 
-  destroy_tests(inputs, ref, number_of_tests);
+  unload_tests(corpus, inputs, ref, number_of_tests);
 
   return 0;
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
+#include "corpus.h"
 #include "thread_helpers.h"
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,9 +41,18 @@ void *thread_text_fn(void *arg) {
   int pattern_hash = text_arg->pattern_hash;
   char *pattern = text_arg->pattern;
   output_t *output = text_arg->output;
+  pattern_w_idx_t *pattern_w_idx =
+      output->identified_patterns[text_arg->pattern_idx];
+  query_t *query = text_arg->query;
 
   for (size_t text_offset = text_arg->start; text_offset < text_arg->end;
        ++text_offset) {
+    // Stop as soon as the answer is known, for the text or for the pattern
+    if (__atomic_load_n(text_arg->is_answered, __ATOMIC_RELAXED) ||
+        (int)text_offset > __atomic_load_n(text_arg->limit, __ATOMIC_RELAXED)) {
+      break;
+    }
+
     // Compute the hash of the current window
     int text_window_hash = compute_hash(text + text_offset, pattern_length);
     if (text_window_hash == pattern_hash) {
@@ -49,9 +60,12 @@ void *thread_text_fn(void *arg) {
           is_pattern_matching(text, text_offset, pattern, pattern_length);
       if (is_matching) {
         pthread_mutex_lock(text_arg->lock);
-        output->identified_patterns[text_arg->pattern_idx]
-            ->indexes[output->identified_patterns[text_arg->pattern_idx]
-                          ->len++] = text_offset;
+        record_match(pattern_w_idx, text_offset, query);
+        __atomic_store_n(text_arg->limit, query_limit(pattern_w_idx, query),
+                         __ATOMIC_RELAXED);
+        if (query->mode == QUERY_EXISTS) {
+          __atomic_store_n(text_arg->is_answered, 1, __ATOMIC_RELAXED);
+        }
         pthread_mutex_unlock(text_arg->lock);
       }
     }
@@ -65,7 +79,8 @@ void *thread_pattern_fn(void *arg) {
   int start = pattern_arg->start;
   int end = pattern_arg->end;
   output_t *output = pattern_arg->output;
-  char **patterns = pattern_arg->patterns;
+  input_t *input = pattern_arg->input;
+  char **patterns = input->patterns;
   char *text = pattern_arg->text;
   size_t text_length = pattern_arg->text_length;
 
@@ -76,10 +91,13 @@ void *thread_pattern_fn(void *arg) {
     }
 
     char *pattern = patterns[i];
-    size_t pattern_length = strlen(pattern);
+    size_t pattern_length = input_pattern_length(input, i);
 
     strcpy(output->identified_patterns[i]->pattern, pattern);
     output->identified_patterns[i]->len = 0;
+    if (__atomic_load_n(pattern_arg->is_answered, __ATOMIC_RELAXED)) {
+      continue;
+    }
 
     int pattern_hash = compute_hash(pattern, pattern_length);
 
@@ -91,6 +109,9 @@ void *thread_pattern_fn(void *arg) {
     pthread_mutex_t lock;
     pthread_mutex_init(&lock, NULL);
 
+    // The offset past which the occurrences are no longer needed
+    int limit = INT_MAX;
+
     for (int j = 0; j < NUM_MAIN_THREADS; j++) {
       args[j].start = j * (double)(sliding_points + 1) / NUM_MAIN_THREADS;
       args[j].end =
@@ -104,6 +125,9 @@ void *thread_pattern_fn(void *arg) {
       args[j].output = output;
       args[j].pattern_idx = i;
       args[j].lock = &lock;
+      args[j].query = pattern_arg->query;
+      args[j].limit = &limit;
+      args[j].is_answered = pattern_arg->is_answered;
       int r =
           pthread_create(&threads[j], NULL, thread_text_fn, (void *)&args[j]);
 
@@ -127,11 +151,10 @@ void *thread_pattern_fn(void *arg) {
   return NULL;
 }
 
-output_t *rabin_karp_pthreads(input_t *input) {
+output_t *rabin_karp_pthreads(input_t *input, query_t *query) {
   // Parse input parameters
   char *text = input->text;
   int n_patterns = input->n_patterns;
-  char **patterns = input->patterns;
 
   size_t text_length = strlen(text);
 
@@ -154,6 +177,9 @@ output_t *rabin_karp_pthreads(input_t *input) {
   pthread_t threads[NUM_MAIN_THREADS];
   pthread_pattern_arg_t args[NUM_MAIN_THREADS];
 
+  // Whether the answer is known for the whole text (QUERY_EXISTS)
+  int is_answered = 0;
+
   // no reason to launch a lot of threads for too few patterns
   int threads_count = MIN(NUM_MAIN_THREADS, n_patterns);
 
@@ -161,9 +187,11 @@ output_t *rabin_karp_pthreads(input_t *input) {
     args[i].start = i * (double)n_patterns / threads_count;
     args[i].end = MIN((i + 1) * (double)n_patterns / threads_count, n_patterns);
     args[i].output = output;
-    args[i].patterns = patterns;
+    args[i].input = input;
     args[i].text = text;
     args[i].text_length = text_length;
+    args[i].query = query;
+    args[i].is_answered = &is_answered;
 
     int r =
         pthread_create(&threads[i], NULL, thread_pattern_fn, (void *)&args[i]);
@@ -187,8 +215,15 @@ output_t *rabin_karp_pthreads(input_t *input) {
 
 int main(int argc, char *argv[]) {
   // Sanity check for arguments
-  if (argc != 3) {
-    printf("Usage: %s <tests_directory_path> <number_of_tests>\n", argv[0]);
+  query_t query = {QUERY_ALL, 0};
+  int is_usage_valid = argc >= 3;
+  for (int i = 3; is_usage_valid && i < argc; i++) {
+    is_usage_valid = parse_query_option(argc, argv, &i, &query) == 1;
+  }
+  if (!is_usage_valid) {
+    printf("Usage: %s <tests_directory_path> <number_of_tests> " QUERY_USAGE
+           "\n",
+           argv[0]);
     return -1;
   }
 
@@ -196,29 +231,29 @@ int main(int argc, char *argv[]) {
   char *tests_directory_path = argv[1];
   int number_of_tests = atoi(argv[2]);
 
-  input_t **inputs =
-      parse_all_input_files(tests_directory_path, number_of_tests);
-
-  output_t **ref =
-      parse_all_ref_files(tests_directory_path, inputs, number_of_tests);
+  // The tests are mapped from the corpus of the directory, if there is one
+  input_t **inputs;
+  output_t **ref;
+  corpus_t *corpus =
+      load_tests(tests_directory_path, number_of_tests, &inputs, &ref);
 
   for (int i = 0; i < number_of_tests; i++) {
-    output_t *output = rabin_karp_pthreads(inputs[i]);
+    output_t *output = rabin_karp_pthreads(inputs[i], &query);
 
     if (output == NULL) {
       perror("Error computing the output");
-      destroy_tests(inputs, ref, number_of_tests);
+      unload_tests(corpus, inputs, ref, number_of_tests);
       return -1;
     }
 
     // Check correctness
     const char *correctness =
-        check_correctness(output, ref[i]) ? "FAILED" : "PASSED";
+        check_query(output, ref[i], &query) ? "FAILED" : "PASSED";
     printf("test %d: %s\n", i, correctness);
     free_output_struct(output);
   }
 
-  destroy_tests(inputs, ref, number_of_tests);
+  unload_tests(corpus, inputs, ref, number_of_tests);
 
   return 0;
 }
\ No newline at end of file
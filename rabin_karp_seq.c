@@ -2,9 +2,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "corpus.h"
 #include "helpers.h"
+#include "mismatch.h"
+#include "packed_text.h"
+#include "pattern_set.h"
+#include "text_index.h"
+#include "wildcard.h"
 
 #define HASH_BASE 256
 #define HASH_PRIME 101
@@ -31,7 +38,7 @@ int is_pattern_matching(char *text, int text_offset, char *pattern,
   return is_matching;
 }
 
-output_t *rabin_karp_seq(input_t *input) {
+output_t *rabin_karp_seq(input_t *input, query_t *query) {
   // Parse input parameters
   char *text = input->text;
   int n_patterns = input->n_patterns;
@@ -67,13 +74,18 @@ output_t *rabin_karp_seq(input_t *input) {
       return NULL;
     }
   }
-  // Do the search for each pattern
+  // Do the search for each pattern, until the answer is known
+  int is_answered = 0;
   for (int pattern_idx = 0; pattern_idx < n_patterns; ++pattern_idx) {
     char *pattern = patterns[pattern_idx];
-    size_t pattern_length = strlen(pattern);
+    size_t pattern_length = input_pattern_length(input, pattern_idx);
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[pattern_idx];
 
-    strcpy(output->identified_patterns[pattern_idx]->pattern, pattern);
-    output->identified_patterns[pattern_idx]->len = 0;
+    strcpy(pattern_w_idx->pattern, pattern);
+    pattern_w_idx->len = 0;
+    if (is_answered) {
+      continue;
+    }
 
     // Compute the hash of the current pattern
     int pattern_hash = compute_hash(pattern, pattern_length);
@@ -87,51 +99,354 @@ output_t *rabin_karp_seq(input_t *input) {
         int is_matching =
             is_pattern_matching(text, text_offset, pattern, pattern_length);
         if (is_matching) {
-          output->identified_patterns[pattern_idx]
-              ->indexes[output->identified_patterns[pattern_idx]->len++] =
-              text_offset;
+          record_match(pattern_w_idx, text_offset, query);
+          // The windows come in order: none after the limit is needed
+          if ((int)text_offset >= query_limit(pattern_w_idx, query)) {
+            break;
+          }
         }
       }
     }
+
+    is_answered = query->mode == QUERY_EXISTS && pattern_w_idx->len > 0;
+  }
+
+  return output;
+}
+
+output_t *rabin_karp_seq_compiled(input_t *input, const char *cache_dir,
+                                  query_t *query) {
+  /** @brief Same as rabin_karp_seq, but with the compiled pattern set of the
+   * input (mapped from cache_dir if the same patterns were compiled before):
+   * the patterns are grouped by length and each group is searched with a
+   * single rolling fingerprint.
+   */
+  pattern_set_t *set = load_input_pattern_set(input, cache_dir);
+  if (set == NULL) {
+    return NULL;
+  }
+
+  output_t *output = alloc_output_struct(input->n_patterns);
+  if (output == NULL) {
+    perror("Error allocating memory for output");
+    free_pattern_set(set);
+    return NULL;
+  }
+
+  search_pattern_set(set, input->text, strlen(input->text), output, query);
+  free_pattern_set(set);
+
+  return output;
+}
+
+/**
+ * @brief Struct for the text index figures of a run.
+ * @var n_built: The number of indexes built (and saved).
+ * @var n_mapped: The number of indexes mapped from a previous run.
+ * @var build_time: The time spent building the indexes, in seconds.
+ * @var size: The total size of the indexes, in bytes.
+ * @var text_length: The total length of the indexed texts.
+ */
+typedef struct TextIndexStats {
+  int n_built;
+  int n_mapped;
+  double build_time;
+  size_t size;
+  size_t text_length;
+} text_index_stats_t;
+
+output_t *rabin_karp_seq_indexed(input_t *input, const char *index_fname,
+                                 query_t *query, text_index_stats_t *stats) {
+  /** @brief Same as rabin_karp_seq, but with the index of the text (mapped
+   * from index_fname if it was built before, or else built and saved there):
+   * the patterns are looked up in the index instead of scanning the text.
+   */
+  size_t text_length = strlen(input->text);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int is_built;
+  text_index_t *index =
+      load_text_index(input->text, text_length, index_fname, &is_built);
+  if (index == NULL) {
+    return NULL;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (is_built) {
+    stats->n_built++;
+    stats->build_time +=
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  } else {
+    stats->n_mapped++;
+  }
+  stats->size += index->header->size;
+  stats->text_length += text_length;
+
+  output_t *output = alloc_output_struct(input->n_patterns);
+  if (output == NULL) {
+    perror("Error allocating memory for output");
+    free_text_index(index);
+    return NULL;
+  }
+
+  if (search_text_index(index, input->text, text_length, input->patterns,
+                        input->n_patterns, output, query) == -1) {
+    free_output_struct(output);
+    output = NULL;
+  }
+  free_text_index(index);
+
+  return output;
+}
+
+/**
+ * @brief Struct for the packed text figures of a run.
+ * @var n_packed: The number of texts packed.
+ * @var n_unpacked: The number of texts whose alphabet is too large.
+ * @var packed_size: The total size of the packed texts, in bytes.
+ * @var text_length: The total length of the packed texts.
+ */
+typedef struct PackedTextStats {
+  int n_packed;
+  int n_unpacked;
+  size_t packed_size;
+  size_t text_length;
+} packed_text_stats_t;
+
+output_t *rabin_karp_seq_packed(input_t *input, query_t *query,
+                                packed_text_stats_t *stats) {
+  /** @brief Same as rabin_karp_seq, but on the packed text if its alphabet is
+   * small enough (see packed_text.h), or else with the compiled pattern set
+   * of the input.
+   */
+  size_t text_length = strlen(input->text);
+  packed_text_t *packed = pack_text(input->text, text_length);
+  if (packed == NULL) {
+    stats->n_unpacked++;
+    return rabin_karp_seq_compiled(input, NULL, query);
+  }
+
+  stats->n_packed++;
+  stats->packed_size += packed->n_words * sizeof(uint64_t);
+  stats->text_length += text_length;
+
+  output_t *output = alloc_output_struct(input->n_patterns);
+  if (output == NULL) {
+    perror("Error allocating memory for output");
+    free_packed_text(packed);
+    return NULL;
+  }
+
+  if (search_packed_text(packed, input->patterns, input->n_patterns, output,
+                         query) == -1) {
+    free_output_struct(output);
+    output = NULL;
+  }
+  free_packed_text(packed);
+
+  return output;
+}
+
+output_t *rabin_karp_seq_wildcard(input_t *input, query_t *query) {
+  /** @brief Same as rabin_karp_seq, but WILDCARD_CHAR matches any byte in the
+   * patterns (see wildcard.h).
+   */
+  wildcard_set_t *wildcards =
+      compile_wildcard_set(input->patterns, input->n_patterns);
+  if (wildcards == NULL) {
+    return NULL;
+  }
+
+  output_t *output = alloc_output_struct(input->n_patterns);
+  if (output == NULL) {
+    perror("Error allocating memory for output");
+    free_wildcard_set(wildcards);
+    return NULL;
+  }
+
+  search_wildcard_set(wildcards, input->text, strlen(input->text), output,
+                      query);
+  free_wildcard_set(wildcards);
+
+  return output;
+}
+
+/**
+ * @brief Struct for the k-mismatch figures of a run.
+ * @var n_candidates: The number of positions verified.
+ * @var n_found: The number of occurrences found.
+ * @var n_exact: The number of occurrences stored without any mismatch.
+ * @var n_stored: The number of occurrences stored.
+ */
+typedef struct MismatchStats {
+  long n_candidates;
+  long n_found;
+  long n_exact;
+  long n_stored;
+} mismatch_stats_t;
+
+output_t *rabin_karp_seq_mismatch(input_t *input, int k, query_t *query,
+                                  mismatch_stats_t *stats) {
+  /** @brief Same as rabin_karp_seq, but the occurrences can have up to k
+   * mismatches (see mismatch.h); the number of mismatches of each stored
+   * occurrence is in the output.
+   */
+  mismatch_set_t *set = compile_mismatch_set(input->patterns,
+                                             input->n_patterns, k);
+  if (set == NULL) {
+    return NULL;
+  }
+
+  output_t *output = alloc_output_struct(input->n_patterns);
+  if (output == NULL) {
+    perror("Error allocating memory for output");
+    free_mismatch_set(set);
+    return NULL;
+  }
+
+  long n_candidates;
+  long n_found = search_mismatch_set(set, input->text, strlen(input->text),
+                                     output, query, &n_candidates);
+  free_mismatch_set(set);
+  if (n_found == -1) {
+    free_output_struct(output);
+    return NULL;
+  }
+
+  stats->n_candidates += n_candidates;
+  stats->n_found += n_found;
+  for (int i = 0; i < output->n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    int n_stored = count_stored_indexes(pattern_w_idx, query);
+    stats->n_stored += n_stored;
+    for (int j = 0; j < n_stored; j++) {
+      stats->n_exact += pattern_w_idx->mismatches[j] == 0;
+    }
   }
 
   return output;
 }
 
 int main(int argc, char *argv[]) {
+  // Get arguments
+  char *cache_directory = NULL;
+  int use_text_index = 0;
+  int use_packed_text = 0;
+  int use_wildcards = 0;
+  int max_mismatches = -1;
+  query_t query = {QUERY_ALL, 0};
+  int is_usage_valid = argc >= 3;
+  for (int i = 3; is_usage_valid && i < argc; i++) {
+    int is_query_option = parse_query_option(argc, argv, &i, &query);
+    if (is_query_option != 0) {
+      is_usage_valid = is_query_option == 1;
+    } else if (strcmp(argv[i], PATTERN_CACHE_FLAG) == 0 && i + 1 < argc) {
+      cache_directory = argv[++i];
+    } else if (strcmp(argv[i], TEXT_INDEX_FLAG) == 0) {
+      use_text_index = 1;
+    } else if (strcmp(argv[i], PACKED_TEXT_FLAG) == 0) {
+      use_packed_text = 1;
+    } else if (strcmp(argv[i], WILDCARD_FLAG) == 0) {
+      use_wildcards = 1;
+    } else if (strcmp(argv[i], MISMATCH_FLAG) == 0 && i + 1 < argc) {
+      max_mismatches = atoi(argv[++i]);
+      is_usage_valid =
+          max_mismatches >= 0 && max_mismatches <= MISMATCH_MAX_K;
+    } else {
+      is_usage_valid = 0;
+    }
+
+    // The search modes exclude each other: only one of them runs
+    int n_modes = (cache_directory != NULL) + use_text_index +
+                  use_packed_text + use_wildcards + (max_mismatches >= 0);
+    is_usage_valid = is_usage_valid && n_modes <= 1;
+  }
+
   // Sanity check for arguments
-  if (argc != 3) {
-    printf("Usage: %s <tests_directory_path> <number_of_tests>\n", argv[0]);
+  if (!is_usage_valid) {
+    printf("Usage: %s <tests_directory_path> <number_of_tests> "
+           "[" PATTERN_CACHE_FLAG " <cache_directory> | " TEXT_INDEX_FLAG
+           " | " PACKED_TEXT_FLAG " | " WILDCARD_FLAG " | " MISMATCH_FLAG
+           " <k>] " QUERY_USAGE "\n",
+           argv[0]);
     return -1;
   }
 
-  // Get arguments
   char *tests_directory_path = argv[1];
   int number_of_tests = atoi(argv[2]);
 
-  input_t **inputs =
-      parse_all_input_files(tests_directory_path, number_of_tests);
-
-  output_t **ref =
-      parse_all_ref_files(tests_directory_path, inputs, number_of_tests);
+  // The tests are mapped from the corpus of the directory, if there is one
+  input_t **inputs;
+  output_t **ref;
+  corpus_t *corpus =
+      load_tests(tests_directory_path, number_of_tests, &inputs, &ref);
 
+  text_index_stats_t stats = {0};
+  packed_text_stats_t packed_stats = {0};
+  mismatch_stats_t mismatch_stats = {0};
   for (int i = 0; i < number_of_tests; i++) {
-    output_t *output = rabin_karp_seq(inputs[i]);
+    output_t *output;
+    if (use_text_index) {
+      // The index of a text is stored next to it
+      char index_fname[MAX_FILE_PATH];
+      snprintf(index_fname, MAX_FILE_PATH, "%s/test%d" TEXT_INDEX_EXTENSION,
+               tests_directory_path, i);
+      output = rabin_karp_seq_indexed(inputs[i], index_fname, &query, &stats);
+    } else if (max_mismatches != -1) {
+      output = rabin_karp_seq_mismatch(inputs[i], max_mismatches, &query,
+                                       &mismatch_stats);
+    } else if (use_wildcards) {
+      output = rabin_karp_seq_wildcard(inputs[i], &query);
+    } else if (use_packed_text) {
+      output = rabin_karp_seq_packed(inputs[i], &query, &packed_stats);
+    } else if (cache_directory != NULL) {
+      output = rabin_karp_seq_compiled(inputs[i], cache_directory, &query);
+    } else {
+      output = rabin_karp_seq(inputs[i], &query);
+    }
 
     if (output == NULL) {
       perror("Error computing the output");
-      destroy_tests(inputs, ref, number_of_tests);
+      unload_tests(corpus, inputs, ref, number_of_tests);
       return -1;
     }
 
-    // Check correctness
-    const char *correctness = check_correctness(output, ref[i]) ? "FAILED" : "PASSED";
+    // Check correctness; the approximate occurrences are not in the ref
+    int is_wrong =
+        max_mismatches != -1
+            ? check_mismatch_query(output, ref[i], inputs[i]->text,
+                                   max_mismatches, &query)
+            : check_query(output, ref[i], &query);
+    const char *correctness = is_wrong ? "FAILED" : "PASSED";
     printf("test %d: %s\n", i, correctness);
 
     free_output_struct(output);
   }
 
-  destroy_tests(inputs, ref, number_of_tests);
+  if (use_text_index) {
+    printf("text index: %d built (%.3f ms), %d mapped, %zu bytes "
+           "(%.2f bytes per text byte)\n",
+           stats.n_built, stats.build_time * 1e3, stats.n_mapped, stats.size,
+           stats.text_length > 0 ? (double)stats.size / stats.text_length : 0);
+  }
+
+  if (use_packed_text) {
+    printf("packed text: %d packed (%zu bytes instead of %zu), %d with too "
+           "many symbols\n",
+           packed_stats.n_packed, packed_stats.packed_size,
+           packed_stats.text_length, packed_stats.n_unpacked);
+  }
+
+  if (max_mismatches != -1) {
+    printf("mismatches: %ld positions verified, %ld occurrences with up to %d "
+           "mismatches, %ld of the %ld stored are exact\n",
+           mismatch_stats.n_candidates, mismatch_stats.n_found, max_mismatches,
+           mismatch_stats.n_exact, mismatch_stats.n_stored);
+  }
+
+  unload_tests(corpus, inputs, ref, number_of_tests);
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,332 @@
+#include "rabinkarp.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pattern_set.h"
+
+/**
+ * @brief A matcher is a compiled pattern set.
+ * @var set: The pattern set.
+ */
+struct RabinKarpMatcher {
+  pattern_set_t *set;
+};
+
+// The batches of the pattern set are passed to the callbacks as they are
+_Static_assert(sizeof(rk_match_t) == sizeof(ps_match_t) &&
+                   offsetof(rk_match_t, offset) ==
+                       offsetof(ps_match_t, offset) &&
+                   offsetof(rk_match_t, pattern_id) ==
+                       offsetof(ps_match_t, pattern_id),
+               "rk_match_t and ps_match_t must have the same layout");
+_Static_assert(offsetof(rk_match_t, set_id) == offsetof(ps_match_t, set_id),
+               "rk_match_t and ps_match_t must have the same layout");
+_Static_assert(sizeof(rk_batch_match_t) == sizeof(ps_text_match_t) &&
+                   offsetof(rk_batch_match_t, offset) ==
+                       offsetof(ps_text_match_t, offset) &&
+                   offsetof(rk_batch_match_t, pattern_id) ==
+                       offsetof(ps_text_match_t, pattern_id),
+               "rk_batch_match_t and ps_text_match_t must have the same "
+               "layout");
+_Static_assert(offsetof(rk_batch_match_t, set_id) ==
+                       offsetof(ps_text_match_t, set_id) &&
+                   offsetof(rk_batch_match_t, buffer_id) ==
+                       offsetof(ps_text_match_t, text_id),
+               "rk_batch_match_t and ps_text_match_t must have the same "
+               "layout");
+
+/**
+ * @brief Struct for forwarding the batches of a scan to a user callback.
+ * @var callback: The callback.
+ * @var user_data: Its argument.
+ * @var is_stopped: Whether the callback stopped the scan.
+ */
+typedef struct CallbackScan {
+  rk_match_callback callback;
+  void *user_data;
+  int is_stopped;
+} callback_scan_t;
+
+/**
+ * @brief Struct for forwarding the batches of a multi-buffer scan to a user
+ * callback (see callback_scan_t).
+ */
+typedef struct BatchScan {
+  rk_batch_callback callback;
+  void *user_data;
+  int is_stopped;
+} batch_scan_t;
+
+/**
+ * @brief The results of a scan: the match list of the pattern set is sorted
+ * by pattern (a counting sort, which keeps the offsets of each pattern in
+ * increasing order) into offsets.
+ * @var matches: The match list.
+ * @var match_capacity: The capacity of the match list.
+ * @var n_matches: The number of occurrences.
+ * @var n_patterns: The number of patterns of the last scanned matcher.
+ * @var starts: The occurrences of pattern i are offsets[starts[i] ..
+ * starts[i + 1]).
+ * @var starts_capacity: The capacity of starts.
+ * @var offsets: The offsets of the occurrences, sorted by pattern.
+ * @var offsets_capacity: The capacity of offsets.
+ */
+struct RabinKarpResults {
+  ps_match_t *matches;
+  size_t match_capacity;
+  size_t n_matches;
+  size_t n_patterns;
+  size_t *starts;
+  size_t starts_capacity;
+  uint64_t *offsets;
+  size_t offsets_capacity;
+};
+
+rk_matcher_t *rk_compile(const char *const *patterns, size_t n_patterns,
+                         const char *cache_dir) {
+  if ((patterns == NULL && n_patterns > 0) || n_patterns > UINT32_MAX) {
+    return NULL;
+  }
+
+  rk_matcher_t *matcher = (rk_matcher_t *)(malloc(sizeof(rk_matcher_t)));
+  if (matcher == NULL) {
+    return NULL;
+  }
+
+  matcher->set = load_pattern_set((char **)patterns, n_patterns, cache_dir);
+  if (matcher->set == NULL) {
+    free(matcher);
+    return NULL;
+  }
+
+  return matcher;
+}
+
+rk_matcher_t *rk_compile_sets(const char *const *const *pattern_lists,
+                              const size_t *n_patterns, size_t n_sets,
+                              const char *cache_dir) {
+  if ((pattern_lists == NULL && n_sets > 0) || n_sets > UINT32_MAX) {
+    return NULL;
+  }
+
+  int *counts = (int *)(malloc((n_sets + 1) * sizeof(int)));
+  if (counts == NULL) {
+    return NULL;
+  }
+
+  size_t n_all_patterns = 0;
+  for (size_t i = 0; i < n_sets; i++) {
+    n_all_patterns += n_patterns[i];
+    if ((pattern_lists[i] == NULL && n_patterns[i] > 0) ||
+        n_all_patterns > INT32_MAX) {
+      free(counts);
+      return NULL;
+    }
+    counts[i] = n_patterns[i];
+  }
+
+  rk_matcher_t *matcher = (rk_matcher_t *)(malloc(sizeof(rk_matcher_t)));
+  if (matcher == NULL) {
+    free(counts);
+    return NULL;
+  }
+
+  matcher->set = load_pattern_sets((char ***)pattern_lists, counts, n_sets,
+                                   cache_dir);
+  free(counts);
+  if (matcher->set == NULL) {
+    free(matcher);
+    return NULL;
+  }
+
+  return matcher;
+}
+
+void rk_free(rk_matcher_t *matcher) {
+  if (matcher != NULL) {
+    free_pattern_set(matcher->set);
+    free(matcher);
+  }
+}
+
+size_t rk_pattern_count(const rk_matcher_t *matcher) {
+  return matcher->set->header->n_patterns;
+}
+
+const char *rk_pattern(const rk_matcher_t *matcher, size_t pattern_id) {
+  if (pattern_id >= rk_pattern_count(matcher)) {
+    return NULL;
+  }
+
+  return pattern_set_pattern(matcher->set, pattern_id);
+}
+
+size_t rk_set_count(const rk_matcher_t *matcher) {
+  return matcher->set->header->n_sets;
+}
+
+size_t rk_set_patterns(const rk_matcher_t *matcher, size_t set_id,
+                       size_t *first_pattern) {
+  if (set_id >= rk_set_count(matcher)) {
+    *first_pattern = 0;
+    return 0;
+  }
+
+  *first_pattern = matcher->set->sets[set_id].first_pattern;
+
+  return matcher->set->sets[set_id].n_patterns;
+}
+
+rk_results_t *rk_results_new(void) {
+  return (rk_results_t *)(calloc(1, sizeof(rk_results_t)));
+}
+
+void rk_results_free(rk_results_t *results) {
+  if (results != NULL) {
+    free(results->matches);
+    free(results->starts);
+    free(results->offsets);
+    free(results);
+  }
+}
+
+static int reserve(void **buffer, size_t *capacity, size_t size,
+                   size_t element_size) {
+  /** @brief Grows a buffer to at least size elements.
+   * @return RK_OK, or RK_ERROR_MEMORY.
+   */
+  if (size <= *capacity) {
+    return RK_OK;
+  }
+
+  void *new_buffer = realloc(*buffer, size * element_size);
+  if (new_buffer == NULL) {
+    return RK_ERROR_MEMORY;
+  }
+  *buffer = new_buffer;
+  *capacity = size;
+
+  return RK_OK;
+}
+
+int rk_scan(const rk_matcher_t *matcher, const char *buffer, size_t length,
+            rk_results_t *results) {
+  if (matcher == NULL || results == NULL || (buffer == NULL && length > 0)) {
+    return RK_ERROR_ARGUMENT;
+  }
+
+  // The match list is only read and written by this scan: the matcher is
+  // not modified, so concurrent scans only need their own results
+  long n_matches =
+      collect_pattern_set_matches(matcher->set, buffer, length,
+                                  &results->matches, &results->match_capacity);
+  size_t n_patterns = rk_pattern_count(matcher);
+  if (n_matches < 0 ||
+      reserve((void **)&results->starts, &results->starts_capacity,
+              n_patterns + 1, sizeof(size_t)) != RK_OK ||
+      reserve((void **)&results->offsets, &results->offsets_capacity,
+              n_matches, sizeof(uint64_t)) != RK_OK) {
+    results->n_matches = 0;
+    results->n_patterns = 0;
+    return RK_ERROR_MEMORY;
+  }
+
+  results->n_matches = n_matches;
+  results->n_patterns = n_patterns;
+
+  memset(results->starts, 0, (n_patterns + 1) * sizeof(size_t));
+  for (long i = 0; i < n_matches; i++) {
+    results->starts[results->matches[i].pattern_id + 1]++;
+  }
+  for (size_t i = 0; i < n_patterns; i++) {
+    results->starts[i + 1] += results->starts[i];
+  }
+
+  // Place the offsets, using starts as the insertion cursors and shifting it
+  // back afterwards
+  for (long i = 0; i < n_matches; i++) {
+    ps_match_t *match = &results->matches[i];
+    results->offsets[results->starts[match->pattern_id]++] = match->offset;
+  }
+  for (size_t i = n_patterns; i > 0; i--) {
+    results->starts[i] = results->starts[i - 1];
+  }
+  results->starts[0] = 0;
+
+  return RK_OK;
+}
+
+static int forward_matches(const ps_match_t *matches, size_t n_matches,
+                           void *arg) {
+  callback_scan_t *scan = (callback_scan_t *)arg;
+
+  scan->is_stopped =
+      scan->callback((const rk_match_t *)matches, n_matches, scan->user_data);
+
+  return scan->is_stopped;
+}
+
+int rk_scan_callback(const rk_matcher_t *matcher, const char *buffer,
+                     size_t length, rk_match_callback callback,
+                     void *user_data) {
+  if (matcher == NULL || callback == NULL || (buffer == NULL && length > 0)) {
+    return RK_ERROR_ARGUMENT;
+  }
+
+  callback_scan_t scan = {callback, user_data, 0};
+  visit_pattern_set_matches(matcher->set, buffer, length,
+                            PATTERN_SET_MATCH_BATCH, forward_matches, &scan);
+
+  return scan.is_stopped ? RK_STOPPED : RK_OK;
+}
+
+static int forward_batch_matches(const ps_text_match_t *matches,
+                                 size_t n_matches, void *arg) {
+  batch_scan_t *scan = (batch_scan_t *)arg;
+
+  scan->is_stopped = scan->callback((const rk_batch_match_t *)matches,
+                                    n_matches, scan->user_data);
+
+  return scan->is_stopped;
+}
+
+int rk_scan_batch(const rk_matcher_t *matcher, const char *const *buffers,
+                  const size_t *lengths, size_t n_buffers,
+                  rk_batch_callback callback, void *user_data) {
+  if (matcher == NULL || callback == NULL ||
+      (n_buffers > 0 && (buffers == NULL || lengths == NULL))) {
+    return RK_ERROR_ARGUMENT;
+  }
+  for (size_t i = 0; i < n_buffers; i++) {
+    if (buffers[i] == NULL && lengths[i] > 0) {
+      return RK_ERROR_ARGUMENT;
+    }
+  }
+
+  batch_scan_t scan = {callback, user_data, 0};
+  if (visit_pattern_set_texts(matcher->set, buffers, lengths, n_buffers,
+                              PATTERN_SET_MATCH_BATCH, forward_batch_matches,
+                              &scan) == -1) {
+    return RK_ERROR_MEMORY;
+  }
+
+  return scan.is_stopped ? RK_STOPPED : RK_OK;
+}
+
+size_t rk_total_matches(const rk_results_t *results) {
+  return results->n_matches;
+}
+
+size_t rk_matches(const rk_results_t *results, size_t pattern_id,
+                  const uint64_t **offsets) {
+  if (pattern_id >= results->n_patterns) {
+    *offsets = NULL;
+    return 0;
+  }
+
+  *offsets = results->offsets + results->starts[pattern_id];
+
+  return results->starts[pattern_id + 1] - results->starts[pattern_id];
+}
@@ -0,0 +1,175 @@
+#ifndef RABINKARP_H__
+#define RABINKARP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief The public API of librabinkarp (librabinkarp.a, librabinkarp.so):
+ * a pattern list is compiled once into a matcher, which is then used to scan
+ * any number of buffers. A matcher is read only once compiled, so it can be
+ * shared by any number of threads, each scanning with its own results.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RK_API __attribute__((visibility("default")))
+
+/**
+ * @brief The return codes of the library.
+ */
+#define RK_OK 0
+#define RK_STOPPED 1
+#define RK_ERROR_MEMORY -1
+#define RK_ERROR_ARGUMENT -2
+
+/**
+ * @brief A compiled pattern list (opaque).
+ */
+typedef struct RabinKarpMatcher rk_matcher_t;
+
+/**
+ * @brief The occurrences found by a scan (opaque); reuse it from a scan to
+ * the next to avoid allocations.
+ */
+typedef struct RabinKarpResults rk_results_t;
+
+/**
+ * @brief An occurrence of a pattern.
+ * @var offset: Its offset in the buffer.
+ * @var pattern_id: The index of the pattern in the matcher (see
+ * rk_set_patterns for the matchers of several pattern lists).
+ * @var set_id: The index of the pattern list of the pattern (always 0 for
+ * the matchers of a single pattern list).
+ */
+typedef struct RabinKarpMatch {
+  uint64_t offset;
+  uint32_t pattern_id;
+  uint32_t set_id;
+} rk_match_t;
+
+/**
+ * @brief The function called by rk_scan_callback with the occurrences, in
+ * batches.
+ * @return 0 to go on with the scan, anything else to stop it.
+ */
+typedef int (*rk_match_callback)(const rk_match_t *matches, size_t n_matches,
+                                 void *user_data);
+
+/**
+ * @brief An occurrence of a pattern in one of the buffers of rk_scan_batch.
+ * @var offset: Its offset in the buffer.
+ * @var pattern_id: The index of the pattern in the matcher.
+ * @var set_id: The index of the pattern list of the pattern.
+ * @var buffer_id: The index of the buffer.
+ */
+typedef struct RabinKarpBatchMatch {
+  uint64_t offset;
+  uint32_t pattern_id;
+  uint32_t set_id;
+  uint64_t buffer_id;
+} rk_batch_match_t;
+
+/**
+ * @brief The function called by rk_scan_batch with the occurrences, in
+ * batches.
+ * @return 0 to go on with the scan, anything else to stop it.
+ */
+typedef int (*rk_batch_callback)(const rk_batch_match_t *matches,
+                                 size_t n_matches, void *user_data);
+
+/**
+ * @brief Compiles a pattern list (null terminated patterns).
+ * @param cache_dir A directory where the compiled matchers are cached, keyed
+ * by the content of the pattern list (NULL to always compile).
+ * @return The matcher (free it with rk_free), NULL on failure.
+ */
+RK_API rk_matcher_t *rk_compile(const char *const *patterns,
+                                size_t n_patterns, const char *cache_dir);
+
+/**
+ * @brief Compiles several pattern lists (e.g. of different users) into a
+ * single matcher, so that a buffer is scanned once for all of them: the
+ * patterns are numbered list after list, and every occurrence is tagged with
+ * the list of its pattern.
+ * @param pattern_lists The pattern lists.
+ * @param n_patterns The number of patterns of each list.
+ * @return The matcher (free it with rk_free), NULL on failure.
+ */
+RK_API rk_matcher_t *rk_compile_sets(const char *const *const *pattern_lists,
+                                     const size_t *n_patterns, size_t n_sets,
+                                     const char *cache_dir);
+RK_API void rk_free(rk_matcher_t *matcher);
+RK_API size_t rk_pattern_count(const rk_matcher_t *matcher);
+RK_API const char *rk_pattern(const rk_matcher_t *matcher, size_t pattern_id);
+RK_API size_t rk_set_count(const rk_matcher_t *matcher);
+
+/**
+ * @brief Gets the patterns of a pattern list of a matcher, for splitting the
+ * results of a scan by list: they are the patterns first_pattern to
+ * first_pattern + n - 1 of the matcher.
+ * @param first_pattern The index of the first pattern (output).
+ * @return Their number n.
+ */
+RK_API size_t rk_set_patterns(const rk_matcher_t *matcher, size_t set_id,
+                              size_t *first_pattern);
+
+RK_API rk_results_t *rk_results_new(void);
+RK_API void rk_results_free(rk_results_t *results);
+
+/**
+ * @brief Scans a buffer for all the patterns of a matcher.
+ * @param results The results, replaced by the occurrences in the buffer.
+ * @return RK_OK, or an RK_ERROR_* code.
+ */
+RK_API int rk_scan(const rk_matcher_t *matcher, const char *buffer,
+                   size_t length, rk_results_t *results);
+
+/**
+ * @brief Scans a buffer for all the patterns of a matcher, passing the
+ * occurrences to a callback as soon as they are found, in batches of up to
+ * 256, without storing them: the occurrences come pattern length by pattern
+ * length, in increasing order for each pattern.
+ * @return RK_OK, RK_STOPPED if the callback stopped the scan, or an
+ * RK_ERROR_* code.
+ */
+RK_API int rk_scan_callback(const rk_matcher_t *matcher, const char *buffer,
+                            size_t length, rk_match_callback callback,
+                            void *user_data);
+
+/**
+ * @brief Scans many buffers (e.g. log lines) for all the patterns of a
+ * matcher, several buffers at a time, passing the occurrences to a callback
+ * in batches of up to 256, as rk_scan_callback does: this is much faster than
+ * a scan per buffer when the buffers are short. The occurrences come pattern
+ * length by pattern length, in increasing order for each buffer and pattern.
+ * @param buffers The buffers (n_buffers of them).
+ * @param lengths The length of each buffer.
+ * @return RK_OK, RK_STOPPED if the callback stopped the scan, or an
+ * RK_ERROR_* code.
+ */
+RK_API int rk_scan_batch(const rk_matcher_t *matcher,
+                         const char *const *buffers, const size_t *lengths,
+                         size_t n_buffers, rk_batch_callback callback,
+                         void *user_data);
+
+/**
+ * @return The total number of occurrences found by the last scan.
+ */
+RK_API size_t rk_total_matches(const rk_results_t *results);
+
+/**
+ * @brief Gets the occurrences of a pattern found by the last scan.
+ * @param offsets Their offsets in the buffer, in increasing order (output,
+ * valid until the next scan with the same results).
+ * @return Their number.
+ */
+RK_API size_t rk_matches(const rk_results_t *results, size_t pattern_id,
+                         const uint64_t **offsets);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
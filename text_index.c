@@ -0,0 +1,359 @@
+#include "text_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "fingerprint.h"
+#include "pattern_set.h"
+
+#define ALIGN_UP(x, alignment)                                                 \
+  (((x) + (alignment)-1) / (alignment) * (alignment))
+
+static uint32_t bucket_index(uint64_t fingerprint, uint32_t n_buckets) {
+  return (uint32_t)((fingerprint * 0x9E3779B97F4A7C15ULL) >> 32) &
+         (n_buckets - 1);
+}
+
+static int cmp_indexes(const void *a, const void *b) {
+  int indexA = *(const int *)a;
+  int indexB = *(const int *)b;
+
+  return (indexA > indexB) - (indexA < indexB);
+}
+
+static text_index_t *wrap_text_index(char *data, int mapped) {
+  text_index_t *index = (text_index_t *)(malloc(sizeof(text_index_t)));
+  if (index == NULL) {
+    perror("Error allocating memory for text index");
+    return NULL;
+  }
+
+  index->data = data;
+  index->mapped = mapped;
+  index->header = (ti_header_t *)data;
+  index->buckets = (uint32_t *)(data + index->header->buckets_offset);
+  index->positions = (uint32_t *)(data + index->header->positions_offset);
+
+  return index;
+}
+
+uint64_t hash_text(const char *text, size_t text_length) {
+  /** @brief Hashes a text (64-bit FNV-1a over its length and its bytes).
+   * @return The hash.
+   */
+  uint64_t res = 0xcbf29ce484222325ULL;
+  const uint64_t prime = 0x100000001b3ULL;
+
+  res = (res ^ (uint64_t)text_length) * prime;
+  for (size_t i = 0; i < text_length; i++) {
+    res = (res ^ (unsigned char)text[i]) * prime;
+  }
+
+  return res;
+}
+
+text_index_t *build_text_index(const char *text, size_t text_length) {
+  /** @brief Builds the index of a text: the fingerprint of the q-gram at each
+   * sampled position selects a bucket, and the positions are stored grouped
+   * by bucket (counted first, then placed).
+   * @return The index (free it with free_text_index), NULL on failure.
+   */
+  if (text_length > UINT32_MAX) {
+    fprintf(stderr, "Error building text index: the text is too long\n");
+    return NULL;
+  }
+
+  uint32_t n_samples =
+      text_length >= TEXT_INDEX_Q
+          ? (text_length - TEXT_INDEX_Q) / TEXT_INDEX_STEP + 1
+          : 0;
+  uint32_t n_buckets = 1;
+  while (n_buckets < n_samples) {
+    n_buckets <<= 1;
+  }
+
+  uint64_t buckets_offset = ALIGN_UP(sizeof(ti_header_t), 8);
+  uint64_t positions_offset =
+      buckets_offset + (uint64_t)(n_buckets + 1) * sizeof(uint32_t);
+  uint64_t size = ALIGN_UP(positions_offset + n_samples * sizeof(uint32_t), 8);
+
+  char *data = (char *)(calloc(size, 1));
+  uint32_t *sample_buckets =
+      (uint32_t *)(malloc((n_samples + 1) * sizeof(uint32_t)));
+  if (data == NULL || sample_buckets == NULL) {
+    perror("Error allocating memory for text index");
+    free(data);
+    free(sample_buckets);
+    return NULL;
+  }
+
+  ti_header_t *header = (ti_header_t *)data;
+  memcpy(header->magic, TEXT_INDEX_MAGIC, sizeof(header->magic));
+  header->version = TEXT_INDEX_VERSION;
+  header->q = TEXT_INDEX_Q;
+  header->step = TEXT_INDEX_STEP;
+  header->n_buckets = n_buckets;
+  header->n_samples = n_samples;
+  header->text_length = text_length;
+  header->text_hash = hash_text(text, text_length);
+  header->size = size;
+  header->buckets_offset = buckets_offset;
+  header->positions_offset = positions_offset;
+
+  text_index_t *index = wrap_text_index(data, 0);
+  if (index == NULL) {
+    free(data);
+    free(sample_buckets);
+    return NULL;
+  }
+
+  // Roll the fingerprint of the q-grams over the text, keeping the bucket of
+  // each sampled one
+  if (n_samples > 0) {
+    uint64_t power = fingerprint_power(TEXT_INDEX_Q);
+    uint64_t fingerprint = compute_fingerprint(text, TEXT_INDEX_Q);
+    for (size_t position = 0;; ++position) {
+      if (position % TEXT_INDEX_STEP == 0) {
+        uint32_t bucket = bucket_index(fingerprint, n_buckets);
+        sample_buckets[position / TEXT_INDEX_STEP] = bucket;
+        index->buckets[bucket + 1]++;
+      }
+
+      if (position + TEXT_INDEX_Q >= text_length) {
+        break;
+      }
+      fingerprint = roll_fingerprint(fingerprint, text[position],
+                                     text[position + TEXT_INDEX_Q], power);
+    }
+  }
+
+  for (uint32_t bucket = 0; bucket < n_buckets; bucket++) {
+    index->buckets[bucket + 1] += index->buckets[bucket];
+  }
+
+  // Place the positions, using the bucket table as the insertion cursors and
+  // shifting it back afterwards
+  for (uint32_t sample = 0; sample < n_samples; sample++) {
+    uint32_t bucket = sample_buckets[sample];
+    index->positions[index->buckets[bucket]++] = sample * TEXT_INDEX_STEP;
+  }
+  for (uint32_t bucket = n_buckets; bucket > 0; bucket--) {
+    index->buckets[bucket] = index->buckets[bucket - 1];
+  }
+  index->buckets[0] = 0;
+
+  free(sample_buckets);
+
+  return index;
+}
+
+int save_text_index(text_index_t *index, const char *fname) {
+  /** @brief Writes a text index to a file (atomically, see
+   * write_file_atomically).
+   * @return 0 on success, -1 on failure.
+   */
+  return write_file_atomically(fname, index->data, index->header->size);
+}
+
+text_index_t *map_text_index(const char *fname) {
+  /** @brief Maps a text index file in memory.
+   * @return The index (free it with free_text_index), NULL if the file does
+   * not exist or is not a valid text index.
+   */
+  size_t size;
+  char *data = map_file(fname, sizeof(ti_header_t), &size);
+  if (data == NULL) {
+    return NULL;
+  }
+
+  ti_header_t *header = (ti_header_t *)data;
+  int is_valid =
+      memcmp(header->magic, TEXT_INDEX_MAGIC, sizeof(header->magic)) == 0 &&
+      header->version == TEXT_INDEX_VERSION && header->q == TEXT_INDEX_Q &&
+      header->step == TEXT_INDEX_STEP && header->size == size &&
+      header->n_buckets > 0 &&
+      (header->n_buckets & (header->n_buckets - 1)) == 0 &&
+      header->buckets_offset +
+              (uint64_t)(header->n_buckets + 1) * sizeof(uint32_t) <=
+          header->size &&
+      header->positions_offset + header->n_samples * sizeof(uint32_t) <=
+          header->size;
+
+  // The lookups trust the bucket table, so check that it is well formed
+  uint32_t *buckets = (uint32_t *)(data + header->buckets_offset);
+  for (uint32_t bucket = 0; is_valid && bucket < header->n_buckets;
+       bucket++) {
+    is_valid = buckets[bucket] <= buckets[bucket + 1];
+  }
+  if (!is_valid || buckets[0] != 0 ||
+      buckets[header->n_buckets] != header->n_samples) {
+    munmap(data, size);
+    return NULL;
+  }
+
+  text_index_t *index = wrap_text_index(data, 1);
+  if (index == NULL) {
+    munmap(data, size);
+  }
+
+  return index;
+}
+
+text_index_t *load_text_index(const char *text, size_t text_length,
+                              const char *fname, int *is_built) {
+  /** @brief Gets the index of a text: it is mapped from fname if it was built
+   * for the same text, or else it is built and saved there for the next runs.
+   * @param fname The index file (NULL to build it without saving it).
+   * @param is_built Whether the index was built (output, can be NULL).
+   * @return The index (free it with free_text_index), NULL on failure.
+   */
+  text_index_t *index = fname != NULL ? map_text_index(fname) : NULL;
+  if (index != NULL) {
+    if (index->header->text_length == text_length &&
+        index->header->text_hash == hash_text(text, text_length)) {
+      if (is_built != NULL) {
+        *is_built = 0;
+      }
+      return index;
+    }
+    free_text_index(index);
+  }
+
+  index = build_text_index(text, text_length);
+  if (index != NULL && fname != NULL) {
+    save_text_index(index, fname);
+  }
+  if (is_built != NULL) {
+    *is_built = 1;
+  }
+
+  return index;
+}
+
+void free_text_index(text_index_t *index) {
+  if (index->mapped) {
+    munmap(index->data, index->header->size);
+  } else {
+    free(index->data);
+  }
+  free(index);
+}
+
+static int search_short_patterns(const char *text, int text_length,
+                                 char **patterns, int n_patterns,
+                                 output_t *output, query_t *query) {
+  /** @brief Searches the patterns too short to be looked up in a text index
+   * with a compiled pattern set of just those patterns.
+   * @return The number of occurrences of the short patterns, -1 on failure.
+   */
+  int n_short = 0;
+  for (int i = 0; i < n_patterns; i++) {
+    n_short += strlen(patterns[i]) < TEXT_INDEX_MIN_PATTERN_LENGTH;
+  }
+  if (n_short == 0) {
+    return 0;
+  }
+
+  char **short_patterns = (char **)(malloc(n_short * sizeof(char *)));
+  output_t short_output;
+  short_output.n_patterns = n_short;
+  short_output.identified_patterns =
+      (pattern_w_idx_t **)(malloc(n_short * sizeof(pattern_w_idx_t *)));
+  if (short_patterns == NULL || short_output.identified_patterns == NULL) {
+    perror("Error allocating memory for short patterns");
+    free(short_patterns);
+    free(short_output.identified_patterns);
+    return -1;
+  }
+
+  // The short output shares the identified patterns of the output
+  for (int i = 0, j = 0; i < n_patterns; i++) {
+    if (strlen(patterns[i]) < TEXT_INDEX_MIN_PATTERN_LENGTH) {
+      short_patterns[j] = patterns[i];
+      short_output.identified_patterns[j++] = output->identified_patterns[i];
+    }
+  }
+
+  int res = -1;
+  pattern_set_t *set = compile_pattern_set(short_patterns, n_short);
+  if (set != NULL) {
+    res = search_pattern_set(set, text, text_length, &short_output, query);
+    free_pattern_set(set);
+  }
+
+  free(short_patterns);
+  free(short_output.identified_patterns);
+
+  return res;
+}
+
+int search_text_index(text_index_t *index, const char *text,
+                      int text_length, char **patterns, int n_patterns,
+                      output_t *output, query_t *query) {
+  /** @brief Searches patterns in an indexed text: an occurrence of a pattern
+   * at position p contains the sampled q-gram at the first multiple of
+   * TEXT_INDEX_STEP from p, which is the q-gram at offset k < TEXT_INDEX_STEP
+   * of the pattern; so, for each k, the bucket of that q-gram gives the
+   * candidate positions, which are verified byte by byte.
+   * @param output The output, with the n_patterns identified patterns
+   * allocated, filled as needed by the query.
+   * @return The number of occurrences found, -1 on failure.
+   */
+  int *candidates = (int *)(malloc((text_length + 1) * sizeof(int)));
+  if (candidates == NULL) {
+    perror("Error allocating memory for candidates");
+    return -1;
+  }
+
+  for (int i = 0; i < n_patterns; i++) {
+    strcpy(output->identified_patterns[i]->pattern, patterns[i]);
+    output->identified_patterns[i]->len = 0;
+  }
+
+  int res =
+      search_short_patterns(text, text_length, patterns, n_patterns, output,
+                            query);
+  if (res == -1) {
+    free(candidates);
+    return -1;
+  }
+
+  for (int i = 0; i < n_patterns; i++) {
+    pattern_w_idx_t *pattern_w_idx = output->identified_patterns[i];
+    int pattern_length = strlen(patterns[i]);
+    if (pattern_length < TEXT_INDEX_MIN_PATTERN_LENGTH ||
+        (query->mode == QUERY_EXISTS && res > 0)) {
+      continue;
+    }
+
+    int n_candidates = 0;
+    for (int k = 0; k < TEXT_INDEX_STEP; k++) {
+      uint64_t fingerprint = compute_fingerprint(patterns[i] + k, TEXT_INDEX_Q);
+      uint32_t bucket = bucket_index(fingerprint, index->header->n_buckets);
+      for (uint32_t j = index->buckets[bucket]; j < index->buckets[bucket + 1];
+           j++) {
+        int text_offset = (int)index->positions[j] - k;
+        if (text_offset < 0 || text_offset > text_length - pattern_length ||
+            memcmp(text + text_offset, patterns[i], pattern_length) != 0) {
+          continue;
+        }
+        candidates[n_candidates++] = text_offset;
+      }
+    }
+
+    // The lookups of the different k interleave, so sort the occurrences
+    qsort(candidates, n_candidates, sizeof(int), cmp_indexes);
+    for (int j = 0; j < n_candidates; j++) {
+      if (candidates[j] > query_limit(pattern_w_idx, query)) {
+        break;
+      }
+      record_match(pattern_w_idx, candidates[j], query);
+      res++;
+    }
+  }
+
+  free(candidates);
+
+  return res;
+}
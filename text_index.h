@@ -0,0 +1,96 @@
+#ifndef TEXT_INDEX_H__
+#define TEXT_INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+/**
+ * @brief A text index maps the fingerprints of the q-grams of a text, sampled
+ * every TEXT_INDEX_STEP positions, to their positions; it is built once per
+ * text, saved next to it and mapped back in memory by the next runs, which
+ * then look the patterns up instead of scanning the whole text. Like a
+ * compiled pattern set, it is a single position independent block.
+ */
+#define TEXT_INDEX_MAGIC "RKTXTIDX"
+#define TEXT_INDEX_VERSION 1
+#define TEXT_INDEX_EXTENSION ".rkti"
+
+/**
+ * @brief The command line option selecting the text indexes.
+ */
+#define TEXT_INDEX_FLAG "--text-index"
+
+/**
+ * @brief The length of the indexed q-grams and the distance between two
+ * sampled positions; a pattern is looked up if it has at least
+ * TEXT_INDEX_Q + TEXT_INDEX_STEP - 1 characters (so that each of its
+ * occurrences contains a sampled q-gram), the shorter patterns are searched
+ * with a scan of the text.
+ */
+#define TEXT_INDEX_Q 8
+#define TEXT_INDEX_STEP 4
+#define TEXT_INDEX_MIN_PATTERN_LENGTH (TEXT_INDEX_Q + TEXT_INDEX_STEP - 1)
+
+/**
+ * @brief The header of a text index.
+ * @var magic: TEXT_INDEX_MAGIC (not null terminated).
+ * @var version: TEXT_INDEX_VERSION.
+ * @var q: TEXT_INDEX_Q, when the index was built.
+ * @var step: TEXT_INDEX_STEP, when the index was built.
+ * @var n_buckets: The number of buckets (a power of 2).
+ * @var n_samples: The number of sampled positions.
+ * @var text_length: The length of the indexed text.
+ * @var text_hash: The hash of the indexed text (see hash_text); an index is
+ * only used for a text with the same length and hash.
+ * @var size: The size of the whole index.
+ * @var buckets_offset: The offset of the bucket table (n_buckets + 1 uint32_t):
+ * the positions of bucket i are positions[buckets[i]..buckets[i + 1]).
+ * @var positions_offset: The offset of the sampled positions (n_samples
+ * uint32_t, grouped by bucket and increasing in each bucket).
+ */
+typedef struct TextIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t q;
+  uint32_t step;
+  uint32_t n_buckets;
+  uint32_t n_samples;
+  uint32_t reserved;
+  uint64_t text_length;
+  uint64_t text_hash;
+  uint64_t size;
+  uint64_t buckets_offset;
+  uint64_t positions_offset;
+} ti_header_t;
+
+/**
+ * @brief Struct for handling a text index.
+ * @var data: The index (header first).
+ * @var mapped: Whether data is a mapping of a file (or else, malloc-ed).
+ * @var header: The header.
+ * @var buckets: The bucket table.
+ * @var positions: The sampled positions.
+ */
+typedef struct TextIndex {
+  char *data;
+  int mapped;
+  ti_header_t *header;
+  uint32_t *buckets;
+  uint32_t *positions;
+} text_index_t;
+
+uint64_t hash_text(const char *text, size_t text_length);
+text_index_t *build_text_index(const char *text, size_t text_length);
+int save_text_index(text_index_t *index, const char *fname);
+text_index_t *map_text_index(const char *fname);
+text_index_t *load_text_index(const char *text, size_t text_length,
+                              const char *fname, int *is_built);
+void free_text_index(text_index_t *index);
+
+int search_text_index(text_index_t *index, const char *text,
+                      int text_length, char **patterns, int n_patterns,
+                      output_t *output, query_t *query);
+
+#endif
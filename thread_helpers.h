@@ -10,10 +10,13 @@ typedef struct PThreadPatternArg {
 
   output_t *output;
 
-  char **patterns;
+  input_t *input;
 
   char *text;
   size_t text_length;
+
+  query_t *query;
+  int *is_answered;
 } pthread_pattern_arg_t;
 
 typedef struct PThreadTextArg {
@@ -32,6 +35,10 @@ typedef struct PThreadTextArg {
 
   pthread_mutex_t *lock;
 
+  query_t *query;
+  int *limit;
+  int *is_answered;
+
 } pthread_text_arg_t;
 
 #endif
\ No newline at end of file
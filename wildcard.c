@@ -0,0 +1,244 @@
+#include "wildcard.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+wildcard_set_t *compile_wildcard_set(char **patterns, int n_patterns) {
+  /** @brief Splits wildcard patterns into their solid segments, and compiles
+   * the set of their anchors (see wildcard.h).
+   * @return The wildcard set (free it with free_wildcard_set), NULL on
+   * failure.
+   */
+  wildcard_set_t *wildcards =
+      (wildcard_set_t *)(calloc(1, sizeof(wildcard_set_t)));
+  if (wildcards == NULL) {
+    perror("Error allocating memory for wildcard set");
+    return NULL;
+  }
+
+  // A pattern has at most (length + 1) / 2 segments
+  size_t max_segments = 0;
+  for (int i = 0; i < n_patterns; i++) {
+    max_segments += (strlen(patterns[i]) + 1) / 2;
+  }
+
+  wildcards->n_patterns = n_patterns;
+  wildcards->patterns = patterns;
+  wildcards->lengths = (int *)(malloc((n_patterns + 1) * sizeof(int)));
+  wildcards->first_segments = (int *)(malloc((n_patterns + 1) * sizeof(int)));
+  wildcards->anchors = (int *)(malloc((n_patterns + 1) * sizeof(int)));
+  wildcards->segments = (wildcard_segment_t *)(malloc(
+      (max_segments + 1) * sizeof(wildcard_segment_t)));
+  char **anchor_patterns = (char **)(malloc((n_patterns + 1) * sizeof(char *)));
+  if (wildcards->lengths == NULL || wildcards->first_segments == NULL ||
+      wildcards->anchors == NULL || wildcards->segments == NULL ||
+      anchor_patterns == NULL) {
+    perror("Error allocating memory for wildcard set");
+    free(anchor_patterns);
+    free_wildcard_set(wildcards);
+    return NULL;
+  }
+
+  int n_segments = 0;
+  for (int i = 0; i < n_patterns; i++) {
+    char *pattern = patterns[i];
+    int length = strlen(pattern);
+    wildcards->lengths[i] = length;
+    wildcards->first_segments[i] = n_segments;
+    wildcards->anchors[i] = -1;
+
+    for (int start = 0, end = 0; start < length; start = end) {
+      if (pattern[start] == WILDCARD_CHAR) {
+        end = start + 1;
+        continue;
+      }
+      for (end = start; end < length && pattern[end] != WILDCARD_CHAR; end++)
+        ;
+
+      wildcard_segment_t *segment = &wildcards->segments[n_segments];
+      segment->offset = start;
+      segment->length = end - start;
+      if (wildcards->anchors[i] == -1 ||
+          segment->length > wildcards->segments[wildcards->anchors[i]].length) {
+        wildcards->anchors[i] = n_segments;
+      }
+      n_segments++;
+    }
+
+    // The anchor is copied out of its pattern by the compilation
+    if (wildcards->anchors[i] != -1) {
+      wildcard_segment_t *anchor = &wildcards->segments[wildcards->anchors[i]];
+      anchor_patterns[i] = strndup(pattern + anchor->offset, anchor->length);
+    } else {
+      anchor_patterns[i] = strdup("");
+    }
+    if (anchor_patterns[i] == NULL) {
+      perror("Error allocating memory for wildcard set");
+      for (int j = 0; j < i; j++) {
+        free(anchor_patterns[j]);
+      }
+      free(anchor_patterns);
+      free_wildcard_set(wildcards);
+      return NULL;
+    }
+  }
+  wildcards->first_segments[n_patterns] = n_segments;
+
+  wildcards->anchor_set = compile_pattern_set(anchor_patterns, n_patterns);
+  for (int i = 0; i < n_patterns; i++) {
+    free(anchor_patterns[i]);
+  }
+  free(anchor_patterns);
+  if (wildcards->anchor_set == NULL) {
+    free_wildcard_set(wildcards);
+    return NULL;
+  }
+
+  return wildcards;
+}
+
+void free_wildcard_set(wildcard_set_t *wildcards) {
+  if (wildcards == NULL) {
+    return;
+  }
+
+  free(wildcards->lengths);
+  free(wildcards->first_segments);
+  free(wildcards->anchors);
+  free(wildcards->segments);
+  if (wildcards->anchor_set != NULL) {
+    free_pattern_set(wildcards->anchor_set);
+  }
+  free(wildcards);
+}
+
+/**
+ * @brief Struct for checking the occurrences of the anchors of a search.
+ * @var wildcards: The wildcard set.
+ * @var text: The text.
+ * @var text_length: The length of the text.
+ * @var output: The output.
+ * @var query: The query.
+ * @var n_answered: The number of patterns whose answer is known (see
+ * query_limit).
+ */
+typedef struct WildcardSearch {
+  wildcard_set_t *wildcards;
+  const char *text;
+  int text_length;
+  output_t *output;
+  query_t *query;
+  int n_answered;
+} wildcard_search_t;
+
+static int is_wildcard_match(wildcard_search_t *search, int pattern_id,
+                             int text_offset) {
+  /** @brief Checks the segments of a pattern placed at an offset of the text,
+   * but its anchor (already matched).
+   */
+  wildcard_set_t *wildcards = search->wildcards;
+  const char *pattern = wildcards->patterns[pattern_id];
+
+  if (text_offset < 0 ||
+      text_offset > search->text_length - wildcards->lengths[pattern_id]) {
+    return 0;
+  }
+
+  for (int i = wildcards->first_segments[pattern_id];
+       i < wildcards->first_segments[pattern_id + 1]; i++) {
+    wildcard_segment_t *segment = &wildcards->segments[i];
+    if (i != wildcards->anchors[pattern_id] &&
+        memcmp(search->text + text_offset + segment->offset,
+               pattern + segment->offset, segment->length) != 0) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void record_wildcard_match(wildcard_search_t *search, int pattern_id,
+                                  int text_offset) {
+  pattern_w_idx_t *pattern_w_idx =
+      search->output->identified_patterns[pattern_id];
+
+  int was_answered = query_limit(pattern_w_idx, search->query) != INT_MAX;
+  record_match(pattern_w_idx, text_offset, search->query);
+  if (!was_answered && query_limit(pattern_w_idx, search->query) != INT_MAX) {
+    search->n_answered++;
+  }
+}
+
+static int is_search_answered(wildcard_search_t *search) {
+  return search->n_answered == search->output->n_patterns ||
+         (search->query->mode == QUERY_EXISTS && search->n_answered > 0);
+}
+
+static int check_anchor_matches(const ps_match_t *matches, size_t n_matches,
+                                void *arg) {
+  wildcard_search_t *search = (wildcard_search_t *)arg;
+  wildcard_set_t *wildcards = search->wildcards;
+
+  for (size_t i = 0; i < n_matches; i++) {
+    int pattern_id = matches[i].pattern_id;
+    wildcard_segment_t *anchor =
+        &wildcards->segments[wildcards->anchors[pattern_id]];
+    int text_offset = (int)matches[i].offset - anchor->offset;
+    if (text_offset > query_limit(
+                          search->output->identified_patterns[pattern_id],
+                          search->query) ||
+        !is_wildcard_match(search, pattern_id, text_offset)) {
+      continue;
+    }
+
+    record_wildcard_match(search, pattern_id, text_offset);
+  }
+
+  // The anchors of a pattern come in increasing order, and so do its
+  // occurrences
+  return is_search_answered(search);
+}
+
+int search_wildcard_set(wildcard_set_t *wildcards, const char *text,
+                        int text_length, output_t *output, query_t *query) {
+  /** @brief Searches wildcard patterns in a text, into an output, as needed by
+   * the query: the anchors are searched with a single scan of the compiled
+   * set (see visit_pattern_set_matches), and the patterns without any solid
+   * segment occur at every offset where they fit.
+   * @param output The output, with the n_patterns identified patterns
+   * allocated.
+   * @return The number of occurrences of the anchors found.
+   */
+  for (int i = 0; i < wildcards->n_patterns; i++) {
+    strcpy(output->identified_patterns[i]->pattern, wildcards->patterns[i]);
+    output->identified_patterns[i]->len = 0;
+  }
+
+  wildcard_search_t search = {wildcards, text, text_length, output, query, 0};
+  for (int i = 0; i < wildcards->n_patterns && !is_search_answered(&search);
+       i++) {
+    if (wildcards->anchors[i] != -1) {
+      continue;
+    }
+
+    for (int text_offset = 0;
+         text_offset <= text_length - wildcards->lengths[i] &&
+         text_offset <= query_limit(output->identified_patterns[i], query);
+         text_offset++) {
+      record_wildcard_match(&search, i, text_offset);
+    }
+  }
+  if (is_search_answered(&search)) {
+    return 0;
+  }
+
+  int is_early_exit =
+      query->mode == QUERY_EXISTS || query->mode == QUERY_FIRST;
+
+  return visit_pattern_set_matches(
+      wildcards->anchor_set, text, text_length,
+      is_early_exit ? 1 : PATTERN_SET_MATCH_BATCH, check_anchor_matches,
+      &search);
+}
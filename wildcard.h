@@ -0,0 +1,63 @@
+#ifndef WILDCARD_H__
+#define WILDCARD_H__
+
+#include <stddef.h>
+
+#include "helpers.h"
+#include "pattern_set.h"
+
+/**
+ * @brief A wildcard pattern has "don't care" positions (WILDCARD_CHAR), which
+ * match any byte, e.g. "ERR?R 4??". It is split into solid segments (the
+ * maximal runs without a wildcard): the longest one is its anchor, and the
+ * anchors of all the patterns are searched together with a compiled pattern
+ * set; each occurrence of an anchor places its pattern in the text, where the
+ * other segments are checked at their offsets relative to the anchor.
+ */
+#define WILDCARD_CHAR '?'
+
+/**
+ * @brief The command line option selecting the wildcard patterns.
+ */
+#define WILDCARD_FLAG "--wildcard"
+
+/**
+ * @brief A solid segment of a wildcard pattern.
+ * @var offset: The offset of the segment in its pattern.
+ * @var length: The length of the segment.
+ */
+typedef struct WildcardSegment {
+  int offset;
+  int length;
+} wildcard_segment_t;
+
+/**
+ * @brief Struct for handling a set of wildcard patterns.
+ * @var n_patterns: The number of patterns.
+ * @var patterns: The patterns (not copied).
+ * @var lengths: The length of each pattern.
+ * @var first_segments: The first segment of each pattern in segments; the
+ * segments of pattern i are segments[first_segments[i]..first_segments[i + 1]),
+ * none if it only has wildcards.
+ * @var anchors: The segment of each pattern which is searched (the longest
+ * one), -1 if it has none.
+ * @var segments: The segments of all the patterns.
+ * @var anchor_set: The compiled set of the anchors (pattern i of the set is the
+ * anchor of pattern i, the empty string for the patterns without any).
+ */
+typedef struct WildcardSet {
+  int n_patterns;
+  char **patterns;
+  int *lengths;
+  int *first_segments;
+  int *anchors;
+  wildcard_segment_t *segments;
+  pattern_set_t *anchor_set;
+} wildcard_set_t;
+
+wildcard_set_t *compile_wildcard_set(char **patterns, int n_patterns);
+void free_wildcard_set(wildcard_set_t *wildcards);
+int search_wildcard_set(wildcard_set_t *wildcards, const char *text,
+                        int text_length, output_t *output, query_t *query);
+
+#endif